@@ -310,6 +310,7 @@ assign_managed_vector(struct irq_data *irqd, const struct cpumask *dest)
 {
 	const struct cpumask *affmsk = irq_data_get_affinity_mask(irqd);
 	struct apic_chip_data *apicd = apic_chip_data(irqd);
+	int node = irq_data_get_node(irqd);
 	int vector, cpu;
 
 	cpumask_and(vector_searchmask, dest, affmsk);
@@ -317,8 +318,26 @@ assign_managed_vector(struct irq_data *irqd, const struct cpumask *dest)
 	/* set_affinity might call here for nothing */
 	if (apicd->vector && cpumask_test_cpu(apicd->cpu, vector_searchmask))
 		return 0;
-	vector = irq_matrix_alloc_managed(vector_matrix, vector_searchmask,
-					  &cpu);
+
+	/*
+	 * If the affinity mask spans the device node and others, try the
+	 * CPUs of the device node first. The managed reservation covers all
+	 * of @affmsk, so this can only fail when they are exhausted.
+	 */
+	vector = -ENOSPC;
+	if (node != NUMA_NO_NODE &&
+	    cpumask_intersects(vector_searchmask, cpumask_of_node(node)) &&
+	    !cpumask_subset(vector_searchmask, cpumask_of_node(node))) {
+		cpumask_and(vector_searchmask, vector_searchmask,
+			    cpumask_of_node(node));
+		vector = irq_matrix_alloc_managed(vector_matrix,
+						  vector_searchmask, &cpu);
+		if (vector < 0)
+			cpumask_and(vector_searchmask, dest, affmsk);
+	}
+	if (vector < 0)
+		vector = irq_matrix_alloc_managed(vector_matrix,
+						  vector_searchmask, &cpu);
 	trace_vector_alloc_managed(irqd->irq, vector, vector);
 	if (vector < 0)
 		return vector;
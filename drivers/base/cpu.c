@@ -282,7 +282,26 @@ static ssize_t print_cpus_isolated(struct device *dev,
 
 	return len;
 }
-static DEVICE_ATTR(isolated, 0444, print_cpus_isolated, NULL);
+
+static ssize_t store_cpus_isolated(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	cpumask_var_t isolated;
+	int ret;
+
+	if (!alloc_cpumask_var(&isolated, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(buf, isolated);
+	if (!ret)
+		ret = housekeeping_update(isolated);
+
+	free_cpumask_var(isolated);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR(isolated, 0644, print_cpus_isolated, store_cpus_isolated);
 
 #ifdef CONFIG_NO_HZ_FULL
 static ssize_t print_cpus_nohz_full(struct device *dev,
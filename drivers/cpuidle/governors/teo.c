@@ -43,12 +43,21 @@
  *   target residency of the idle state selected so far, use those values to
  *   compute the new expected idle duration and find an idle state matching it
  *   (which has to be shallower than the one selected so far).
+ *
+ * Optionally (CONFIG_CPU_IDLE_GOV_TEO_IRQ_TIMINGS), the time till the next
+ * interrupt predicted by the interrupt timings code is used instead of the
+ * sleep length when it is shorter, as the CPU will most likely be woken up by
+ * that interrupt rather than by the closest timer.
  */
 
 #include <linux/cpuidle.h>
+#include <linux/debugfs.h>
+#include <linux/interrupt.h>
 #include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/moduleparam.h>
 #include <linux/sched/clock.h>
+#include <linux/seq_file.h>
 #include <linux/tick.h>
 
 /*
@@ -91,6 +100,20 @@ struct teo_idle_state {
 	unsigned int misses;
 };
 
+/**
+ * struct teo_irq_stats - Accuracy of the interrupt predictions used.
+ * @used: Predictions used for idle state selection.
+ * @hits: Wakeups close enough to the predicted interrupt.
+ * @early: Wakeups significantly earlier than the predicted interrupt.
+ * @late: Wakeups significantly later than the predicted interrupt.
+ */
+struct teo_irq_stats {
+	u64 used;
+	u64 hits;
+	u64 early;
+	u64 late;
+};
+
 /**
  * struct teo_cpu - CPU data used by the TEO cpuidle governor.
  * @time_span_ns: Time between idle state selection and post-wakeup update.
@@ -98,6 +121,9 @@ struct teo_idle_state {
  * @states: Idle states data corresponding to this CPU.
  * @interval_idx: Index of the most recent saved idle interval.
  * @intervals: Saved idle duration values.
+ * @irq_next_ns: Time till the predicted interrupt used for idle state
+ *		 selection, or U64_MAX if no prediction was used.
+ * @irq_stats: Interrupt prediction accuracy statistics.
  */
 struct teo_cpu {
 	u64 time_span_ns;
@@ -105,10 +131,130 @@ struct teo_cpu {
 	struct teo_idle_state states[CPUIDLE_STATE_MAX];
 	int interval_idx;
 	u64 intervals[INTERVALS];
+	u64 irq_next_ns;
+	struct teo_irq_stats irq_stats;
 };
 
 static DEFINE_PER_CPU(struct teo_cpu, teo_cpus);
 
+#ifdef CONFIG_CPU_IDLE_GOV_TEO_IRQ_TIMINGS
+static bool irq_timings = true;
+
+static int teo_irq_timings_set(const char *val, const struct kernel_param *kp)
+{
+	bool old = irq_timings;
+	int ret;
+
+	ret = param_set_bool(val, kp);
+	if (ret || irq_timings == old)
+		return ret;
+
+	if (irq_timings)
+		irq_timings_enable();
+	else
+		irq_timings_disable();
+
+	return 0;
+}
+
+static const struct kernel_param_ops teo_irq_timings_ops = {
+	.set = teo_irq_timings_set,
+	.get = param_get_bool,
+};
+module_param_cb(irq_timings, &teo_irq_timings_ops, &irq_timings, 0644);
+MODULE_PARM_DESC(irq_timings, "Take predicted interrupts into account");
+
+/**
+ * teo_irq_next_event - Take the next predicted interrupt into account.
+ * @cpu_data: Governor data for the target CPU.
+ * @duration_ns: Time till the closest timer event.
+ *
+ * Return the time till the next interrupt predicted by the interrupt timings
+ * code if the CPU is expected to be woken up by it before the closest timer
+ * event, or @duration_ns otherwise.
+ */
+static u64 teo_irq_next_event(struct teo_cpu *cpu_data, u64 duration_ns)
+{
+	u64 now = cpu_data->time_span_ns;
+	u64 next;
+
+	cpu_data->irq_next_ns = U64_MAX;
+
+	if (!READ_ONCE(irq_timings))
+		return duration_ns;
+
+	next = irq_timings_next_event(now);
+	if (next == U64_MAX || next - now >= duration_ns)
+		return duration_ns;
+
+	cpu_data->irq_next_ns = next - now;
+	cpu_data->irq_stats.used++;
+
+	return cpu_data->irq_next_ns;
+}
+
+/**
+ * teo_irq_update - Account for the accuracy of the interrupt prediction used.
+ * @cpu_data: Governor data for the target CPU.
+ * @dev: Target CPU.
+ *
+ * A wakeup within 1/4 of the predicted interval from the predicted interrupt
+ * is counted as a hit.
+ */
+static void teo_irq_update(struct teo_cpu *cpu_data, struct cpuidle_device *dev)
+{
+	u64 predicted_ns = cpu_data->irq_next_ns;
+	u64 margin_ns = predicted_ns >> 2;
+	u64 measured_ns = dev->last_residency_ns;
+
+	if (predicted_ns == U64_MAX)
+		return;
+
+	if (measured_ns + margin_ns < predicted_ns)
+		cpu_data->irq_stats.early++;
+	else if (measured_ns > predicted_ns + margin_ns)
+		cpu_data->irq_stats.late++;
+	else
+		cpu_data->irq_stats.hits++;
+}
+
+static int teo_irq_stats_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_puts(m, "cpu       used       hits      early       late\n");
+	for_each_online_cpu(cpu) {
+		struct teo_irq_stats *stats = &per_cpu(teo_cpus, cpu).irq_stats;
+
+		seq_printf(m, "%3d %10llu %10llu %10llu %10llu\n", cpu,
+			   READ_ONCE(stats->used), READ_ONCE(stats->hits),
+			   READ_ONCE(stats->early), READ_ONCE(stats->late));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(teo_irq_stats);
+
+static void __init teo_irq_timings_init(void)
+{
+	struct dentry *dir;
+
+	if (irq_timings)
+		irq_timings_enable();
+
+	dir = debugfs_create_dir("teo", NULL);
+	debugfs_create_file("irq_stats", 0444, dir, NULL, &teo_irq_stats_fops);
+}
+#else
+static inline u64 teo_irq_next_event(struct teo_cpu *cpu_data, u64 duration_ns)
+{
+	return duration_ns;
+}
+static inline void teo_irq_update(struct teo_cpu *cpu_data,
+				  struct cpuidle_device *dev) {}
+static inline void teo_irq_timings_init(void) {}
+#endif /* CONFIG_CPU_IDLE_GOV_TEO_IRQ_TIMINGS */
+
 /**
  * teo_update - Update CPU data after wakeup.
  * @drv: cpuidle driver containing state data.
@@ -120,6 +266,8 @@ static void teo_update(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 	int i, idx_hit = -1, idx_timer = -1;
 	u64 measured_ns;
 
+	teo_irq_update(cpu_data, dev);
+
 	if (cpu_data->time_span_ns >= cpu_data->sleep_length_ns) {
 		/*
 		 * One of the safety nets has triggered or the wakeup was close
@@ -257,6 +405,13 @@ static int teo_select(struct cpuidle_driver *drv, struct cpuidle_device *dev,
 	duration_ns = tick_nohz_get_sleep_length(&delta_tick);
 	cpu_data->sleep_length_ns = duration_ns;
 
+	/*
+	 * The "hits" and "misses" metrics keep being collected against the
+	 * sleep length, but an earlier predicted interrupt caps the idle
+	 * duration the states are matched against.
+	 */
+	duration_ns = teo_irq_next_event(cpu_data, duration_ns);
+
 	hits = 0;
 	misses = 0;
 	early_hits = 0;
@@ -475,6 +630,8 @@ static int teo_enable_device(struct cpuidle_driver *drv,
 	for (i = 0; i < INTERVALS; i++)
 		cpu_data->intervals[i] = U64_MAX;
 
+	cpu_data->irq_next_ns = U64_MAX;
+
 	return 0;
 }
 
@@ -488,6 +645,8 @@ static struct cpuidle_governor teo_governor = {
 
 static int __init teo_governor_init(void)
 {
+	teo_irq_timings_init();
+
 	return cpuidle_register_governor(&teo_governor);
 }
 
@@ -305,6 +305,14 @@ struct cgroup_base_stat {
  * updated_children and updated_next - and the fields which track basic
  * resource statistics on top of it - bsync, bstat and last_bstat.
  */
+/*
+ * Kinds of stats tracked by rstat: each subsystem's own by its id, plus the
+ * base stats.
+ */
+#define CGROUP_RSTAT_BASE	CGROUP_SUBSYS_COUNT
+#define CGROUP_RSTAT_NR		(CGROUP_SUBSYS_COUNT + 1)
+#define CGROUP_RSTAT_ALL	(BIT(CGROUP_RSTAT_NR) - 1)
+
 struct cgroup_rstat_cpu {
 	/*
 	 * ->bsync protects ->bstat.  These are the only fields which get
@@ -332,6 +340,13 @@ struct cgroup_rstat_cpu {
 	 */
 	struct cgroup *updated_children;	/* terminated by self cgroup */
 	struct cgroup *updated_next;		/* NULL iff not on the list */
+
+	/*
+	 * CGROUP_RSTAT_* kinds of stats of this cgroup which were updated on
+	 * this cpu and are yet to be flushed.  A cgroup stays on the updated
+	 * list while it has either these or updated children.
+	 */
+	unsigned long updated_ss;
 };
 
 struct cgroup_freezer_state {
@@ -451,6 +466,8 @@ struct cgroup {
 	/* per-cpu recursive resource statistics */
 	struct cgroup_rstat_cpu __percpu *rstat_cpu;
 	struct list_head rstat_css_list;
+	/* per CGROUP_RSTAT_* kind, nr of cgroup/cpu pairs queued in the subtree */
+	atomic_t rstat_pending[CGROUP_RSTAT_NR];
 
 	/* cgroup basic resource statistics */
 	struct cgroup_base_stat last_bstat;
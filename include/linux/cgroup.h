@@ -750,9 +750,11 @@ static inline void cgroup_path_from_kernfs_id(u64 id, char *buf, size_t buflen)
  * cgroup scalable recursive statistics.
  */
 void cgroup_rstat_updated(struct cgroup *cgrp, int cpu);
+void cgroup_rstat_css_updated(struct cgroup_subsys_state *css, int cpu);
 void cgroup_rstat_flush(struct cgroup *cgrp);
 void cgroup_rstat_flush_irqsafe(struct cgroup *cgrp);
 void cgroup_rstat_flush_hold(struct cgroup *cgrp);
+void cgroup_rstat_flush_read_hold(struct cgroup *cgrp, struct cgroup_subsys *ss);
 void cgroup_rstat_flush_release(void);
 
 /*
@@ -11,6 +11,8 @@
 #include <linux/bug.h>
 #include <linux/mem_encrypt.h>
 
+struct dma_premap;
+
 /**
  * List of possible attributes associated with a DMA mapping. The semantics
  * of each attribute should be defined in Documentation/core-api/dma-attributes.rst.
@@ -144,6 +146,13 @@ u64 dma_get_required_mask(struct device *dev);
 size_t dma_max_mapping_size(struct device *dev);
 bool dma_need_sync(struct device *dev, dma_addr_t dma_addr);
 unsigned long dma_get_merge_boundary(struct device *dev);
+struct dma_premap *dma_premap_create(struct device *dev, struct page **pages,
+		unsigned int nr_pages, enum dma_data_direction dir,
+		unsigned long attrs);
+void dma_premap_destroy(struct dma_premap *pm);
+int dma_premap_map_sg(struct dma_premap *pm, struct scatterlist *sg, int nents);
+void dma_premap_unmap_sg(struct dma_premap *pm, struct scatterlist *sg,
+		int nents);
 #else /* CONFIG_HAS_DMA */
 static inline dma_addr_t dma_map_page_attrs(struct device *dev,
 		struct page *page, size_t offset, size_t size,
@@ -257,6 +266,24 @@ static inline unsigned long dma_get_merge_boundary(struct device *dev)
 {
 	return 0;
 }
+static inline struct dma_premap *dma_premap_create(struct device *dev,
+		struct page **pages, unsigned int nr_pages,
+		enum dma_data_direction dir, unsigned long attrs)
+{
+	return ERR_PTR(-ENXIO);
+}
+static inline void dma_premap_destroy(struct dma_premap *pm)
+{
+}
+static inline int dma_premap_map_sg(struct dma_premap *pm,
+		struct scatterlist *sg, int nents)
+{
+	return 0;
+}
+static inline void dma_premap_unmap_sg(struct dma_premap *pm,
+		struct scatterlist *sg, int nents)
+{
+}
 #endif /* CONFIG_HAS_DMA */
 
 struct page *dma_alloc_pages(struct device *dev, size_t size,
@@ -1260,6 +1260,10 @@ get_perf_callchain(struct pt_regs *regs, u32 init_nr, bool kernel, bool user,
 extern struct perf_callchain_entry *perf_callchain(struct perf_event *event, struct pt_regs *regs);
 extern int get_callchain_buffers(int max_stack);
 extern void put_callchain_buffers(void);
+extern int get_callchain_stack_ids(void);
+extern void put_callchain_stack_ids(void);
+extern void perf_callchain_stack_id(struct perf_event *event,
+				    struct perf_callchain_entry *entry);
 extern struct perf_callchain_entry *get_callchain_entry(int *rctx);
 extern void put_callchain_entry(int rctx);
 
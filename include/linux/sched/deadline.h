@@ -28,7 +28,8 @@ static inline bool dl_time_before(u64 a, u64 b)
 #ifdef CONFIG_SMP
 
 struct root_domain;
-extern void dl_add_task_root_domain(struct task_struct *p);
+extern void dl_add_task_root_domain(struct task_struct *p,
+				    const struct cpumask *cpus);
 extern void dl_clear_root_domain(struct root_domain *rd);
 
 #endif /* CONFIG_SMP */
@@ -24,6 +24,7 @@ extern const struct cpumask *housekeeping_cpumask(enum hk_flags flags);
 extern bool housekeeping_enabled(enum hk_flags flags);
 extern void housekeeping_affine(struct task_struct *t, enum hk_flags flags);
 extern bool housekeeping_test_cpu(int cpu, enum hk_flags flags);
+extern int housekeeping_update(const struct cpumask *isolated);
 extern void __init housekeeping_init(void);
 
 #else
@@ -45,6 +46,10 @@ static inline bool housekeeping_enabled(enum hk_flags flags)
 
 static inline void housekeeping_affine(struct task_struct *t,
 				       enum hk_flags flags) { }
+static inline int housekeeping_update(const struct cpumask *isolated)
+{
+	return -EOPNOTSUPP;
+}
 static inline void housekeeping_init(void) { }
 #endif /* CONFIG_CPU_ISOLATION */
 
@@ -30,6 +30,7 @@ extern unsigned int sysctl_sched_latency;
 extern unsigned int sysctl_sched_min_granularity;
 extern unsigned int sysctl_sched_wakeup_granularity;
 extern unsigned int sysctl_sched_child_runs_first;
+extern unsigned int sysctl_sched_nr_blocked_update;
 
 enum sched_tunable_scaling {
 	SCHED_TUNABLESCALING_NONE,
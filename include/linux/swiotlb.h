@@ -71,10 +71,15 @@ dma_addr_t swiotlb_map(struct device *dev, phys_addr_t phys,
 #ifdef CONFIG_SWIOTLB
 extern enum swiotlb_force swiotlb_force;
 extern phys_addr_t io_tlb_start, io_tlb_end;
+extern bool io_tlb_grown;
+bool is_swiotlb_grown_buffer(phys_addr_t paddr);
 
 static inline bool is_swiotlb_buffer(phys_addr_t paddr)
 {
-	return paddr >= io_tlb_start && paddr < io_tlb_end;
+	if (paddr >= io_tlb_start && paddr < io_tlb_end)
+		return true;
+	return unlikely(READ_ONCE(io_tlb_grown)) &&
+	       is_swiotlb_grown_buffer(paddr);
 }
 
 void __init swiotlb_exit(void);
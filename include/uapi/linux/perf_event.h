@@ -384,7 +384,8 @@ struct perf_event_attr {
 				aux_output     :  1, /* generate AUX records instead of events */
 				cgroup         :  1, /* include cgroup events */
 				text_poke      :  1, /* include text poke events */
-				__reserved_1   : 30;
+				stack_id       :  1, /* sample callchains as stack ids */
+				__reserved_1   : 29;
 
 	union {
 		__u32		wakeup_events;	  /* wakeup every n events */
@@ -1060,6 +1061,25 @@ enum perf_event_type {
 	 */
 	PERF_RECORD_TEXT_POKE			= 20,
 
+	/*
+	 * Maps a stack id to the callchain it stands for. Samples of events
+	 * with attr.stack_id set carry the callchain as the two entries
+	 * { PERF_CONTEXT_STACK_ID, id } instead; the mapping is emitted to
+	 * the ring buffer before the first sample that refers to it.
+	 * This needs a writable (non-overwrite) mmap: the mapping could be
+	 * overwritten by later records otherwise, so samples written to
+	 * overwrite buffers keep their callchain inline.
+	 *
+	 * struct {
+	 *	struct perf_event_header	header;
+	 *	u64				id;
+	 *	u64				nr;
+	 *	u64				ips[nr];
+	 *	struct sample_id		sample_id;
+	 * };
+	 */
+	PERF_RECORD_CALLCHAIN			= 21,
+
 	PERF_RECORD_MAX,			/* non-ABI */
 };
 
@@ -1095,6 +1115,8 @@ enum perf_callchain_context {
 	PERF_CONTEXT_GUEST_KERNEL	= (__u64)-2176,
 	PERF_CONTEXT_GUEST_USER		= (__u64)-2560,
 
+	PERF_CONTEXT_STACK_ID		= (__u64)-3072,
+
 	PERF_CONTEXT_MAX		= (__u64)-4095,
 };
 
@@ -636,6 +636,34 @@ static int validate_change(struct cpuset *cur, struct cpuset *trial)
 	return ret;
 }
 
+/*
+ * Sched domain rebuild statistics, reported by the root cpuset's
+ * "cpus.rebuild_stats" file.  Protected by cpuset_rwsem.
+ *
+ * Bucket i of the histogram counts the rebuilds that took less than 2^i
+ * microseconds (and at least 2^(i-1)), the last one collects the rest.
+ */
+#define REBUILD_HIST_BUCKETS	20
+
+static struct {
+	u64 nr_rebuilds;
+	u64 nr_cpus;		/* CPUs whose root domain was rebuilt */
+	u64 total_ns;
+	u64 max_ns;
+	u64 hist[REBUILD_HIST_BUCKETS];
+} rebuild_stats;
+
+static void __maybe_unused rebuild_stats_account(ktime_t delta)
+{
+	u64 ns = ktime_to_ns(delta);
+	int bucket = fls64(div_u64(ns, NSEC_PER_USEC));
+
+	rebuild_stats.nr_rebuilds++;
+	rebuild_stats.total_ns += ns;
+	rebuild_stats.max_ns = max(rebuild_stats.max_ns, ns);
+	rebuild_stats.hist[min(bucket, REBUILD_HIST_BUCKETS - 1)]++;
+}
+
 #ifdef CONFIG_SMP
 /*
  * Helper routine for generate_sched_domains().
@@ -911,53 +939,79 @@ static int generate_sched_domains(cpumask_var_t **domains,
 	return ndoms;
 }
 
-static void update_tasks_root_domain(struct cpuset *cs)
+static void update_tasks_root_domain(struct cpuset *cs,
+				     const struct cpumask *rebuilt)
 {
 	struct css_task_iter it;
 	struct task_struct *task;
 
 	css_task_iter_start(&cs->css, 0, &it);
 
-	while ((task = css_task_iter_next(&it)))
-		dl_add_task_root_domain(task);
+	while ((task = css_task_iter_next(&it))) {
+		/*
+		 * Racy pre-check, dl_add_task_root_domain() tests the task's
+		 * CPU again under its rq lock.  A task migrating across root
+		 * domains is accounted for by the migration itself.
+		 */
+		if (!cpumask_test_cpu(task_cpu(task), rebuilt))
+			continue;
+		dl_add_task_root_domain(task, rebuilt);
+	}
 
 	css_task_iter_end(&it);
 }
 
+/*
+ * Recompute the DL bandwidth accounting of the root domains that
+ * partition_sched_domains_locked() rebuilt.  Root domains of sched domains
+ * that were kept as they are still have valid accounting, so only the tasks
+ * running on the CPUs in sched_domains_rebuilt_mask() need to be visited.
+ */
 static void rebuild_root_domains(void)
 {
 	struct cpuset *cs = NULL;
 	struct cgroup_subsys_state *pos_css;
+	struct cpumask *rebuilt;
 
 	percpu_rwsem_assert_held(&cpuset_rwsem);
 	lockdep_assert_cpus_held();
 	lockdep_assert_held(&sched_domains_mutex);
 
+	rebuilt = sched_domains_rebuilt_mask();
+	if (cpumask_empty(rebuilt))
+		return;
+
 	rcu_read_lock();
 
 	/*
 	 * Clear default root domain DL accounting, it will be computed again
-	 * if a task belongs to it.
+	 * if a task belongs to it.  All the CPUs attached to it are part of
+	 * @rebuilt.
 	 */
 	dl_clear_root_domain(&def_root_domain);
 
+	/*
+	 * A cpuset's effective_cpus is a subset of its parent's, but tasks
+	 * may still sit on a CPU outside of it (e.g. while being migrated),
+	 * so don't prune whole subtrees here.
+	 */
 	cpuset_for_each_descendant_pre(cs, pos_css, &top_cpuset) {
 
-		if (cpumask_empty(cs->effective_cpus)) {
-			pos_css = css_rightmost_descendant(pos_css);
+		if (!cpumask_intersects(cs->effective_cpus, rebuilt))
 			continue;
-		}
 
 		css_get(&cs->css);
 
 		rcu_read_unlock();
 
-		update_tasks_root_domain(cs);
+		update_tasks_root_domain(cs, rebuilt);
 
 		rcu_read_lock();
 		css_put(&cs->css);
 	}
 	rcu_read_unlock();
+
+	cpumask_clear(rebuilt);
 }
 
 static void
@@ -966,6 +1020,7 @@ partition_and_rebuild_sched_domains(int ndoms_new, cpumask_var_t doms_new[],
 {
 	mutex_lock(&sched_domains_mutex);
 	partition_sched_domains_locked(ndoms_new, doms_new, dattr_new);
+	rebuild_stats.nr_cpus += cpumask_weight(sched_domains_rebuilt_mask());
 	rebuild_root_domains();
 	mutex_unlock(&sched_domains_mutex);
 }
@@ -985,6 +1040,7 @@ static void rebuild_sched_domains_locked(void)
 {
 	struct sched_domain_attr *attr;
 	cpumask_var_t *doms;
+	ktime_t start;
 	int ndoms;
 
 	lockdep_assert_cpus_held();
@@ -1003,11 +1059,15 @@ static void rebuild_sched_domains_locked(void)
 	   !cpumask_subset(top_cpuset.effective_cpus, cpu_active_mask))
 		return;
 
+	start = ktime_get();
+
 	/* Generate domain masks and attrs */
 	ndoms = generate_sched_domains(&doms, &attr);
 
 	/* Have scheduler rebuild the domains */
 	partition_and_rebuild_sched_domains(ndoms, doms, attr);
+
+	rebuild_stats_account(ktime_sub(ktime_get(), start));
 }
 #else /* !CONFIG_SMP */
 static void rebuild_sched_domains_locked(void)
@@ -2499,6 +2559,26 @@ static int sched_partition_show(struct seq_file *seq, void *v)
 	return 0;
 }
 
+static int rebuild_stats_show(struct seq_file *seq, void *v)
+{
+	int i;
+
+	percpu_down_read(&cpuset_rwsem);
+	seq_printf(seq, "rebuilds %llu\n", rebuild_stats.nr_rebuilds);
+	seq_printf(seq, "rebuilt_cpus %llu\n", rebuild_stats.nr_cpus);
+	seq_printf(seq, "total_usec %llu\n",
+		   div_u64(rebuild_stats.total_ns, NSEC_PER_USEC));
+	seq_printf(seq, "max_usec %llu\n",
+		   div_u64(rebuild_stats.max_ns, NSEC_PER_USEC));
+	for (i = 0; i < REBUILD_HIST_BUCKETS - 1; i++)
+		seq_printf(seq, "lt_%lu_usec %llu\n", 1UL << i,
+			   rebuild_stats.hist[i]);
+	seq_printf(seq, "ge_%lu_usec %llu\n", 1UL << (i - 1),
+		   rebuild_stats.hist[i]);
+	percpu_up_read(&cpuset_rwsem);
+	return 0;
+}
+
 static ssize_t sched_partition_write(struct kernfs_open_file *of, char *buf,
 				     size_t nbytes, loff_t off)
 {
@@ -2688,6 +2768,12 @@ static struct cftype dfl_files[] = {
 		.flags = CFTYPE_DEBUG,
 	},
 
+	{
+		.name = "cpus.rebuild_stats",
+		.seq_show = rebuild_stats_show,
+		.flags = CFTYPE_ONLY_ON_ROOT,
+	},
+
 	{ }	/* terminate */
 };
 
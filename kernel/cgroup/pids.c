@@ -25,6 +25,14 @@
  * pids.current tracks all child cgroup hierarchies, so parent/pids.current is
  * a superset of parent/child/pids.current.
  *
+ * The counters are per-CPU and charged in batches, so that fork() and exit()
+ * don't bounce a shared cacheline for every ancestor.  Levels without a limit
+ * are never summed up, and the per-CPU deltas of limited levels are only
+ * summed up precisely when the counter gets close to the limit, which is
+ * thus still exactly enforced.  The batch shrinks with the limit, down to
+ * charging the shared count directly for limits that are small compared to
+ * the number of CPUs.
+ *
  * Copyright (C) 2015 Aleksa Sarai <cyphar@cyphar.com>
  */
 
@@ -32,12 +40,20 @@
 #include <linux/threads.h>
 #include <linux/atomic.h>
 #include <linux/cgroup.h>
+#include <linux/percpu_counter.h>
 #include <linux/slab.h>
 #include <linux/sched/task.h>
 
 #define PIDS_MAX (PID_MAX_LIMIT + 1ULL)
 #define PIDS_MAX_STR "max"
 
+/*
+ * Maximum per-CPU drift of the counters.  The counter of a limited cgroup is
+ * summed up on every charge once it gets within its drift times the number
+ * of online CPUs of the limit, see pids_charge_batch().
+ */
+#define PIDS_CHARGE_BATCH 16
+
 struct pids_cgroup {
 	struct cgroup_subsys_state	css;
 
@@ -45,9 +61,17 @@ struct pids_cgroup {
 	 * Use 64-bit types so that we can safely represent "max" as
 	 * %PIDS_MAX = (%PID_MAX_LIMIT + 1).
 	 */
-	atomic64_t			counter;
+	struct percpu_counter		counter;
 	atomic64_t			limit;
 
+	/*
+	 * Batch charges are currently made with, and the largest batch ever
+	 * used, which bounds the per-CPU deltas.  At 1 the deltas are all 0
+	 * and the shared count is exact.
+	 */
+	int				batch;
+	atomic_t			drift;
+
 	/* Handle for "pids.events" */
 	struct cgroup_file		events_file;
 
@@ -74,15 +98,76 @@ pids_css_alloc(struct cgroup_subsys_state *parent)
 	if (!pids)
 		return ERR_PTR(-ENOMEM);
 
-	atomic64_set(&pids->counter, 0);
+	if (percpu_counter_init(&pids->counter, 0, GFP_KERNEL)) {
+		kfree(pids);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	atomic64_set(&pids->limit, PIDS_MAX);
+	pids->batch = PIDS_CHARGE_BATCH;
+	atomic_set(&pids->drift, 1);
 	atomic64_set(&pids->events_limit, 0);
 	return &pids->css;
 }
 
 static void pids_css_free(struct cgroup_subsys_state *css)
 {
-	kfree(css_pids(css));
+	struct pids_cgroup *pids = css_pids(css);
+
+	/*
+	 * All the tasks charged to @pids are gone by now, a leftover count
+	 * indicates a bug in the `pids` controller proper.
+	 */
+	WARN_ON_ONCE(percpu_counter_sum(&pids->counter));
+	percpu_counter_destroy(&pids->counter);
+	kfree(pids);
+}
+
+/*
+ * Keep the drift of all online CPUs within an eighth of @limit, so that the
+ * counter only needs to be summed up over the last part of the way to it.
+ * Adding with a batch of 1 always folds the per-CPU delta into the shared
+ * count, which then is exact.
+ */
+static int pids_charge_batch(int64_t limit)
+{
+	if (limit >= PIDS_MAX)
+		return PIDS_CHARGE_BATCH;
+
+	return clamp_t(int64_t, limit / (8 * num_online_cpus()), 1,
+		       PIDS_CHARGE_BATCH);
+}
+
+static void pids_add(struct pids_cgroup *pids, int num)
+{
+	int batch = READ_ONCE(pids->batch);
+	int drift = atomic_read(&pids->drift);
+
+	/* Account the batch before any delta can grow up to it. */
+	while (unlikely(batch > drift)) {
+		int old = atomic_cmpxchg(&pids->drift, drift, batch);
+
+		if (old == drift)
+			break;
+		drift = old;
+	}
+
+	percpu_counter_add_batch(&pids->counter, num, batch);
+}
+
+/*
+ * Return true if the count of a limited @pids exceeds @limit.  The deltas
+ * are summed up only when the shared count is within their maximum drift
+ * of @limit.
+ */
+static bool pids_over_limit(struct pids_cgroup *pids, int64_t limit)
+{
+	int drift = atomic_read(&pids->drift);
+
+	if (drift == 1)
+		return percpu_counter_read(&pids->counter) > limit;
+
+	return __percpu_counter_compare(&pids->counter, limit, drift) > 0;
 }
 
 /**
@@ -90,16 +175,12 @@ static void pids_css_free(struct cgroup_subsys_state *css)
  * @pids: the pid cgroup state
  * @num: the number of pids to cancel
  *
- * This function will WARN if the pid count goes under 0, because such a case is
- * a bug in the pids controller proper.
+ * The per-CPU counts may well go under 0, the total is checked when
+ * @pids is freed.
  */
 static void pids_cancel(struct pids_cgroup *pids, int num)
 {
-	/*
-	 * A negative count (or overflow for that matter) is invalid,
-	 * and indicates a bug in the `pids` controller proper.
-	 */
-	WARN_ON_ONCE(atomic64_add_negative(-num, &pids->counter));
+	pids_add(pids, -num);
 }
 
 /**
@@ -129,7 +210,7 @@ static void pids_charge(struct pids_cgroup *pids, int num)
 	struct pids_cgroup *p;
 
 	for (p = pids; parent_pids(p); p = parent_pids(p))
-		atomic64_add(num, &p->counter);
+		pids_add(p, num);
 }
 
 /**
@@ -146,15 +227,17 @@ static int pids_try_charge(struct pids_cgroup *pids, int num)
 	struct pids_cgroup *p, *q;
 
 	for (p = pids; parent_pids(p); p = parent_pids(p)) {
-		int64_t new = atomic64_add_return(num, &p->counter);
 		int64_t limit = atomic64_read(&p->limit);
 
+		pids_add(p, num);
+
 		/*
-		 * Since new is capped to the maximum number of pid_t, if
-		 * p->limit is %PIDS_MAX then we know that this test will never
-		 * fail.
+		 * Since the count is capped to the maximum number of pid_t, if
+		 * p->limit is %PIDS_MAX then we know that this test would never
+		 * fail.  As with the charge, the test follows it, so racing
+		 * chargers can't both slip under the limit.
 		 */
-		if (new > limit)
+		if (limit < PIDS_MAX && pids_over_limit(p, limit))
 			goto revert;
 	}
 
@@ -283,8 +366,12 @@ static ssize_t pids_max_write(struct kernfs_open_file *of, char *buf,
 set_limit:
 	/*
 	 * Limit updates don't need to be mutex'd, since it isn't
-	 * critical that any racing fork()s follow the new limit.
+	 * critical that any racing fork()s follow the new limit.  The
+	 * deltas left by a larger batch are still accounted in the drift,
+	 * so lowering the limit of a cgroup that has been charged already
+	 * keeps summing up over the old drift.
 	 */
+	WRITE_ONCE(pids->batch, pids_charge_batch(limit));
 	atomic64_set(&pids->limit, limit);
 	return nbytes;
 }
@@ -308,7 +395,7 @@ static s64 pids_current_read(struct cgroup_subsys_state *css,
 {
 	struct pids_cgroup *pids = css_pids(css);
 
-	return atomic64_read(&pids->counter);
+	return percpu_counter_sum_positive(&pids->counter);
 }
 
 static int pids_events_show(struct seq_file *sf, void *v)
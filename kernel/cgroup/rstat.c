@@ -2,10 +2,64 @@
 #include "cgroup-internal.h"
 
 #include <linux/sched/cputime.h>
+#include <linux/moduleparam.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 static DEFINE_SPINLOCK(cgroup_rstat_lock);
 static DEFINE_PER_CPU(raw_spinlock_t, cgroup_rstat_cpu_lock);
 
+/*
+ * Readers skip flushing while fewer than this many cgroup/cpu pairs have
+ * updates of the stats they read queued in the subtree they read, and get
+ * slightly stale values instead.  0 always flushes.
+ */
+static unsigned int cgroup_rstat_flush_threshold;
+
+/* Period of the asynchronous flusher in msecs, 0 disables it */
+static unsigned int cgroup_rstat_flush_interval;
+static bool cgroup_rstat_flusher_ready;
+
+static void cgroup_rstat_flush_workfn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(cgroup_rstat_flush_work, cgroup_rstat_flush_workfn);
+
+/* Flush statistics, protected by cgroup_rstat_lock */
+static struct {
+	u64 nr_flushes;
+	u64 nr_skipped;
+	u64 time_ns;
+	u64 max_time_ns;
+} cgroup_rstat_flush_stats;
+
+static int cgroup_rstat_set_flush_interval(const char *val,
+					   const struct kernel_param *kp)
+{
+	int ret;
+
+	ret = param_set_uint(val, kp);
+	if (ret)
+		return ret;
+
+	/* boot time settings are picked up by cgroup_rstat_flusher_init() */
+	if (cgroup_rstat_flush_interval && READ_ONCE(cgroup_rstat_flusher_ready))
+		mod_delayed_work(system_unbound_wq, &cgroup_rstat_flush_work,
+				 msecs_to_jiffies(cgroup_rstat_flush_interval));
+	return 0;
+}
+
+static const struct kernel_param_ops cgroup_rstat_flush_interval_ops = {
+	.set = cgroup_rstat_set_flush_interval,
+	.get = param_get_uint,
+};
+
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "cgroup_rstat."
+module_param_named(flush_threshold, cgroup_rstat_flush_threshold, uint, 0644);
+module_param_cb(flush_interval_ms, &cgroup_rstat_flush_interval_ops,
+		&cgroup_rstat_flush_interval, 0644);
+
 static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu);
 
 static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
@@ -13,44 +67,55 @@ static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
 	return per_cpu_ptr(cgrp->rstat_cpu, cpu);
 }
 
-/**
- * cgroup_rstat_updated - keep track of updated rstat_cpu
- * @cgrp: target cgroup
- * @cpu: cpu on which rstat_cpu was updated
- *
- * @cgrp's rstat_cpu on @cpu was updated.  Put it on the parent's matching
- * rstat_cpu->updated_children list.  See the comment on top of
- * cgroup_rstat_cpu definition for details.
+/*
+ * Queue @cgrp on @cpu for flushing the CGROUP_RSTAT_* kinds of stats in
+ * @mask.  See cgroup_rstat_updated().
  */
-void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
+static void __cgroup_rstat_updated(struct cgroup *cgrp, int cpu,
+				   unsigned long mask)
 {
 	raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock, cpu);
+	struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
 	struct cgroup *parent;
-	unsigned long flags;
+	unsigned long flags, new;
+	int bit;
 
 	/* nothing to do for root */
 	if (!cgroup_parent(cgrp))
 		return;
 
 	/*
-	 * Speculative already-on-list test. This may race leading to
+	 * Speculative already-pending test. This may race leading to
 	 * temporary inaccuracies, which is fine.
-	 *
-	 * Because @parent's updated_children is terminated with @parent
-	 * instead of NULL, we can tell whether @cgrp is on the list by
-	 * testing the next pointer for NULL.
 	 */
-	if (cgroup_rstat_cpu(cgrp, cpu)->updated_next)
+	if ((READ_ONCE(rstatc->updated_ss) & mask) == mask)
 		return;
 
 	raw_spin_lock_irqsave(cpu_lock, flags);
 
-	/* put @cgrp and all ancestors on the corresponding updated lists */
+	new = mask & ~rstatc->updated_ss;
+	if (!new)
+		goto unlock;
+	WRITE_ONCE(rstatc->updated_ss, rstatc->updated_ss | new);
+
+	/* account the newly pending kinds in all enclosing subtrees */
+	for_each_set_bit(bit, &new, CGROUP_RSTAT_NR)
+		for (parent = cgrp; parent; parent = cgroup_parent(parent))
+			atomic_inc(&parent->rstat_pending[bit]);
+
+	/*
+	 * Put @cgrp and all ancestors on the corresponding updated lists.
+	 *
+	 * Because @parent's updated_children is terminated with @parent
+	 * instead of NULL, we can tell whether @cgrp is on the list by
+	 * testing the next pointer for NULL.
+	 */
 	for (parent = cgroup_parent(cgrp); parent;
 	     cgrp = parent, parent = cgroup_parent(cgrp)) {
-		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
 		struct cgroup_rstat_cpu *prstatc = cgroup_rstat_cpu(parent, cpu);
 
+		rstatc = cgroup_rstat_cpu(cgrp, cpu);
+
 		/*
 		 * Both additions and removals are bottom-up.  If a cgroup
 		 * is already in the tree, all ancestors are.
@@ -61,107 +126,185 @@ void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
 		rstatc->updated_next = prstatc->updated_children;
 		prstatc->updated_children = cgrp;
 	}
-
+unlock:
 	raw_spin_unlock_irqrestore(cpu_lock, flags);
 }
 
 /**
- * cgroup_rstat_cpu_pop_updated - iterate and dismantle rstat_cpu updated tree
- * @pos: current position
- * @root: root of the tree to traversal
- * @cpu: target cpu
+ * cgroup_rstat_updated - keep track of updated rstat_cpu
+ * @cgrp: target cgroup
+ * @cpu: cpu on which rstat_cpu was updated
  *
- * Walks the udpated rstat_cpu tree on @cpu from @root.  %NULL @pos starts
- * the traversal and %NULL return indicates the end.  During traversal,
- * each returned cgroup is unlinked from the tree.  Must be called with the
- * matching cgroup_rstat_cpu_lock held.
+ * @cgrp's rstat_cpu on @cpu was updated.  Put it on the parent's matching
+ * rstat_cpu->updated_children list.  See the comment on top of
+ * cgroup_rstat_cpu definition for details.
  *
- * The only ordering guarantee is that, for a parent and a child pair
- * covered by a given traversal, if a child is visited, its parent is
- * guaranteed to be visited afterwards.
+ * As the caller doesn't tell which stats were updated, the next flush of
+ * any subsystem flushes @cgrp.  Subsystems should prefer
+ * cgroup_rstat_css_updated().
  */
-static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
-						   struct cgroup *root, int cpu)
+void cgroup_rstat_updated(struct cgroup *cgrp, int cpu)
 {
-	struct cgroup_rstat_cpu *rstatc;
+	__cgroup_rstat_updated(cgrp, cpu, CGROUP_RSTAT_ALL);
+}
 
-	if (pos == root)
-		return NULL;
+/**
+ * cgroup_rstat_css_updated - keep track of updated rstat_cpu of a subsystem
+ * @css: target css
+ * @cpu: cpu on which @css's stats were updated
+ *
+ * Like cgroup_rstat_updated(), but only queues @css->cgroup for flushes of
+ * @css->ss, so that readers of other subsystems don't flush it.
+ */
+void cgroup_rstat_css_updated(struct cgroup_subsys_state *css, int cpu)
+{
+	__cgroup_rstat_updated(css->cgroup, cpu, BIT(css->ss->id));
+}
 
-	/*
-	 * We're gonna walk down to the first leaf and visit/remove it.  We
-	 * can pick whatever unvisited node as the starting point.
-	 */
-	if (!pos)
-		pos = root;
-	else
-		pos = cgroup_parent(pos);
+/* Return the first leaf of the updated tree of @cpu below @pos. */
+static struct cgroup *cgroup_rstat_cpu_first_leaf(struct cgroup *pos, int cpu)
+{
+	struct cgroup_rstat_cpu *rstatc;
 
-	/* walk down to the first leaf */
 	while (true) {
 		rstatc = cgroup_rstat_cpu(pos, cpu);
 		if (rstatc->updated_children == pos)
-			break;
+			return pos;
 		pos = rstatc->updated_children;
 	}
+}
+
+/* Unlink @pos, which has no updated children, from its parent's list. */
+static void cgroup_rstat_cpu_unlink(struct cgroup *pos, int cpu)
+{
+	struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(pos, cpu);
+	struct cgroup *parent = cgroup_parent(pos);
+	struct cgroup **nextp;
 
 	/*
-	 * Unlink @pos from the tree.  As the updated_children list is
-	 * singly linked, we have to walk it to find the removal point.
-	 * However, due to the way we traverse, @pos will be the first
-	 * child in most cases. The only exception is @root.
+	 * As the updated_children list is singly linked, we have to walk it
+	 * to find the removal point.  However, due to the way we traverse,
+	 * @pos will be the first child in most cases.
 	 */
-	if (rstatc->updated_next) {
-		struct cgroup *parent = cgroup_parent(pos);
-		struct cgroup_rstat_cpu *prstatc = cgroup_rstat_cpu(parent, cpu);
-		struct cgroup_rstat_cpu *nrstatc;
-		struct cgroup **nextp;
+	nextp = &cgroup_rstat_cpu(parent, cpu)->updated_children;
+	while (*nextp != pos) {
+		WARN_ON_ONCE(*nextp == parent);
+		nextp = &cgroup_rstat_cpu(*nextp, cpu)->updated_next;
+	}
+
+	*nextp = rstatc->updated_next;
+	rstatc->updated_next = NULL;
+}
+
+/* Flush the CGROUP_RSTAT_* kinds of stats in @bits of @pos on @cpu. */
+static void cgroup_rstat_cpu_flush_one(struct cgroup *pos, int cpu,
+				       unsigned long bits)
+{
+	struct cgroup_subsys_state *css;
+
+	if (bits & BIT(CGROUP_RSTAT_BASE))
+		cgroup_base_stat_flush(pos, cpu);
 
-		nextp = &prstatc->updated_children;
-		while (true) {
-			nrstatc = cgroup_rstat_cpu(*nextp, cpu);
-			if (*nextp == pos)
-				break;
+	rcu_read_lock();
+	list_for_each_entry_rcu(css, &pos->rstat_css_list, rstat_css_node)
+		if (bits & BIT(css->ss->id))
+			css->ss->css_rstat_flush(css, cpu);
+	rcu_read_unlock();
+}
 
-			WARN_ON_ONCE(*nextp == parent);
-			nextp = &nrstatc->updated_next;
+/**
+ * cgroup_rstat_cpu_flush_tree - flush and prune the rstat_cpu updated tree
+ * @root: root of the tree to traverse
+ * @cpu: target cpu
+ * @mask: CGROUP_RSTAT_* kinds of stats to flush
+ *
+ * Walks the updated rstat_cpu tree on @cpu from @root, children before
+ * their parent, and flushes the kinds in @mask pending on each cgroup.
+ * What a child propagates to its parent is flushed further up when the
+ * parent is visited.  Cgroups which are left with neither pending stats
+ * nor updated children are unlinked from the tree, the others stay queued
+ * for flushes of other kinds.  Must be called with the matching
+ * cgroup_rstat_cpu_lock held.
+ */
+static void cgroup_rstat_cpu_flush_tree(struct cgroup *root, int cpu,
+					unsigned long mask)
+{
+	struct cgroup *pos = cgroup_rstat_cpu_first_leaf(root, cpu);
+	struct cgroup_rstat_cpu *rstatc;
+	struct cgroup *parent, *next;
+	unsigned long bits;
+	int bit;
+
+	while (true) {
+		rstatc = cgroup_rstat_cpu(pos, cpu);
+		parent = cgroup_parent(pos);
+		next = rstatc->updated_next;
+
+		bits = rstatc->updated_ss & mask;
+		if (bits) {
+			WRITE_ONCE(rstatc->updated_ss, rstatc->updated_ss & ~bits);
+			cgroup_rstat_cpu_flush_one(pos, cpu, bits);
+			if (pos != root)
+				cgroup_rstat_cpu(parent, cpu)->updated_ss |= bits;
 		}
 
-		*nextp = rstatc->updated_next;
-		rstatc->updated_next = NULL;
+		if (pos != root)
+			for_each_set_bit(bit, &mask, CGROUP_RSTAT_NR)
+				atomic_set(&pos->rstat_pending[bit], 0);
+
+		if (next && !rstatc->updated_ss &&
+		    rstatc->updated_children == pos)
+			cgroup_rstat_cpu_unlink(pos, cpu);
 
-		return pos;
+		if (pos == root)
+			break;
+		pos = next == parent ? parent :
+			cgroup_rstat_cpu_first_leaf(next, cpu);
 	}
+}
 
-	/* only happens for @root */
-	return NULL;
+static void cgroup_rstat_flush_account(u64 start)
+{
+	u64 delta = ktime_get_ns() - start;
+
+	lockdep_assert_held(&cgroup_rstat_lock);
+
+	cgroup_rstat_flush_stats.nr_flushes++;
+	cgroup_rstat_flush_stats.time_ns += delta;
+	if (delta > cgroup_rstat_flush_stats.max_time_ns)
+		cgroup_rstat_flush_stats.max_time_ns = delta;
 }
 
 /* see cgroup_rstat_flush() */
-static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
+static void cgroup_rstat_flush_locked(struct cgroup *cgrp, unsigned long mask,
+				      bool may_sleep)
 	__releases(&cgroup_rstat_lock) __acquires(&cgroup_rstat_lock)
 {
-	int cpu;
+	u64 start = ktime_get_ns();
+	struct cgroup *parent;
+	int pending, bit, cpu;
 
 	lockdep_assert_held(&cgroup_rstat_lock);
 
+	/*
+	 * Everything of @mask queued in @cgrp's subtree gets flushed below,
+	 * take it off the pending counts of @cgrp and its ancestors.  Racing
+	 * updates may be counted but flushed already, which only brings the
+	 * next reader flush forward.
+	 */
+	for_each_set_bit(bit, &mask, CGROUP_RSTAT_NR) {
+		pending = atomic_xchg(&cgrp->rstat_pending[bit], 0);
+		for (parent = cgroup_parent(cgrp); parent;
+		     parent = cgroup_parent(parent))
+			atomic_sub(pending, &parent->rstat_pending[bit]);
+	}
+
 	for_each_possible_cpu(cpu) {
 		raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock,
 						       cpu);
-		struct cgroup *pos = NULL;
 
 		raw_spin_lock(cpu_lock);
-		while ((pos = cgroup_rstat_cpu_pop_updated(pos, cgrp, cpu))) {
-			struct cgroup_subsys_state *css;
-
-			cgroup_base_stat_flush(pos, cpu);
-
-			rcu_read_lock();
-			list_for_each_entry_rcu(css, &pos->rstat_css_list,
-						rstat_css_node)
-				css->ss->css_rstat_flush(css, cpu);
-			rcu_read_unlock();
-		}
+		cgroup_rstat_cpu_flush_tree(cgrp, cpu, mask);
 		raw_spin_unlock(cpu_lock);
 
 		/* if @may_sleep, play nice and yield if necessary */
@@ -173,6 +316,8 @@ static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
 			spin_lock_irq(&cgroup_rstat_lock);
 		}
 	}
+
+	cgroup_rstat_flush_account(start);
 }
 
 /**
@@ -193,7 +338,7 @@ void cgroup_rstat_flush(struct cgroup *cgrp)
 	might_sleep();
 
 	spin_lock_irq(&cgroup_rstat_lock);
-	cgroup_rstat_flush_locked(cgrp, true);
+	cgroup_rstat_flush_locked(cgrp, CGROUP_RSTAT_ALL, true);
 	spin_unlock_irq(&cgroup_rstat_lock);
 }
 
@@ -208,7 +353,7 @@ void cgroup_rstat_flush_irqsafe(struct cgroup *cgrp)
 	unsigned long flags;
 
 	spin_lock_irqsave(&cgroup_rstat_lock, flags);
-	cgroup_rstat_flush_locked(cgrp, false);
+	cgroup_rstat_flush_locked(cgrp, CGROUP_RSTAT_ALL, false);
 	spin_unlock_irqrestore(&cgroup_rstat_lock, flags);
 }
 
@@ -226,7 +371,38 @@ void cgroup_rstat_flush_hold(struct cgroup *cgrp)
 {
 	might_sleep();
 	spin_lock_irq(&cgroup_rstat_lock);
-	cgroup_rstat_flush_locked(cgrp, true);
+	cgroup_rstat_flush_locked(cgrp, CGROUP_RSTAT_ALL, true);
+}
+
+/**
+ * cgroup_rstat_flush_read_hold - flush stats for a reader and hold
+ * @cgrp: target cgroup
+ * @ss: subsystem whose stats are read, %NULL for the base stats
+ *
+ * Variant of cgroup_rstat_flush_hold() for stat file readers.  Only the
+ * stats of @ss are flushed, the cgroups with other pending stats stay
+ * queued for their own readers.  Nothing is flushed while fewer than
+ * cgroup_rstat.flush_threshold cgroup/cpu pairs have updates of @ss queued
+ * in @cgrp's subtree, in which case the reader sees slightly stale values.
+ * Must be paired with cgroup_rstat_flush_release().
+ *
+ * This function may block.
+ */
+void cgroup_rstat_flush_read_hold(struct cgroup *cgrp, struct cgroup_subsys *ss)
+	__acquires(&cgroup_rstat_lock)
+{
+	int bit = ss ? ss->id : CGROUP_RSTAT_BASE;
+
+	might_sleep();
+	spin_lock_irq(&cgroup_rstat_lock);
+
+	if (atomic_read(&cgrp->rstat_pending[bit]) <
+	    READ_ONCE(cgroup_rstat_flush_threshold)) {
+		cgroup_rstat_flush_stats.nr_skipped++;
+		return;
+	}
+
+	cgroup_rstat_flush_locked(cgrp, BIT(bit), true);
 }
 
 /**
@@ -238,6 +414,34 @@ void cgroup_rstat_flush_release(void)
 	spin_unlock_irq(&cgroup_rstat_lock);
 }
 
+/* Return the nr of cgroup/cpu pairs of all kinds queued in @cgrp's subtree */
+static int cgroup_rstat_pending(struct cgroup *cgrp)
+{
+	int bit, pending = 0;
+
+	for (bit = 0; bit < CGROUP_RSTAT_NR; bit++)
+		pending += atomic_read(&cgrp->rstat_pending[bit]);
+	return pending;
+}
+
+/*
+ * Periodically catch up with all pending updates so that readers skipping
+ * the flush below the threshold don't drift arbitrarily far.
+ */
+static void cgroup_rstat_flush_workfn(struct work_struct *work)
+{
+	unsigned int interval = READ_ONCE(cgroup_rstat_flush_interval);
+
+	if (!interval)
+		return;
+
+	if (cgroup_rstat_pending(&cgrp_dfl_root.cgrp))
+		cgroup_rstat_flush(&cgrp_dfl_root.cgrp);
+
+	queue_delayed_work(system_unbound_wq, &cgroup_rstat_flush_work,
+			   msecs_to_jiffies(interval));
+}
+
 int cgroup_rstat_init(struct cgroup *cgrp)
 {
 	int cpu;
@@ -271,7 +475,8 @@ void cgroup_rstat_exit(struct cgroup *cgrp)
 		struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
 
 		if (WARN_ON_ONCE(rstatc->updated_children != cgrp) ||
-		    WARN_ON_ONCE(rstatc->updated_next))
+		    WARN_ON_ONCE(rstatc->updated_next) ||
+		    WARN_ON_ONCE(rstatc->updated_ss))
 			return;
 	}
 
@@ -351,7 +556,8 @@ static void cgroup_base_stat_cputime_account_end(struct cgroup *cgrp,
 						 struct cgroup_rstat_cpu *rstatc)
 {
 	u64_stats_update_end(&rstatc->bsync);
-	cgroup_rstat_updated(cgrp, smp_processor_id());
+	__cgroup_rstat_updated(cgrp, smp_processor_id(),
+			       BIT(CGROUP_RSTAT_BASE));
 	put_cpu_ptr(rstatc);
 }
 
@@ -433,7 +639,7 @@ void cgroup_base_stat_cputime_show(struct seq_file *seq)
 	struct task_cputime cputime;
 
 	if (cgroup_parent(cgrp)) {
-		cgroup_rstat_flush_hold(cgrp);
+		cgroup_rstat_flush_read_hold(cgrp, NULL);
 		usage = cgrp->bstat.cputime.sum_exec_runtime;
 		cputime_adjust(&cgrp->bstat.cputime, &cgrp->prev_cputime,
 			       &utime, &stime);
@@ -454,3 +660,37 @@ void cgroup_base_stat_cputime_show(struct seq_file *seq)
 		   "system_usec %llu\n",
 		   usage, utime, stime);
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int cgroup_rstat_stats_show(struct seq_file *m, void *v)
+{
+	spin_lock_irq(&cgroup_rstat_lock);
+	seq_printf(m, "flushes %llu\n", cgroup_rstat_flush_stats.nr_flushes);
+	seq_printf(m, "skipped %llu\n", cgroup_rstat_flush_stats.nr_skipped);
+	seq_printf(m, "flush_time_ns %llu\n", cgroup_rstat_flush_stats.time_ns);
+	seq_printf(m, "max_flush_time_ns %llu\n",
+		   cgroup_rstat_flush_stats.max_time_ns);
+	spin_unlock_irq(&cgroup_rstat_lock);
+	seq_printf(m, "pending %d\n", cgroup_rstat_pending(&cgrp_dfl_root.cgrp));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cgroup_rstat_stats);
+
+static int __init cgroup_rstat_debugfs_init(void)
+{
+	debugfs_create_file("cgroup_rstat", 0444, NULL, NULL,
+			    &cgroup_rstat_stats_fops);
+	return 0;
+}
+late_initcall(cgroup_rstat_debugfs_init);
+#endif
+
+static int __init cgroup_rstat_flusher_init(void)
+{
+	WRITE_ONCE(cgroup_rstat_flusher_ready, true);
+	if (cgroup_rstat_flush_interval)
+		queue_delayed_work(system_unbound_wq, &cgroup_rstat_flush_work,
+				   msecs_to_jiffies(cgroup_rstat_flush_interval));
+	return 0;
+}
+late_initcall(cgroup_rstat_flusher_init);
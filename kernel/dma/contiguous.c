@@ -50,6 +50,11 @@
 #include <linux/sizes.h>
 #include <linux/dma-map-ops.h>
 #include <linux/cma.h>
+#include <linux/debugfs.h>
+#include <linux/log2.h>
+#include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
 
 #ifdef CONFIG_CMA_SIZE_MBYTES
 #define CMA_SIZE_MBYTES CONFIG_CMA_SIZE_MBYTES
@@ -109,6 +114,40 @@ static int __init early_cma_pernuma(char *p)
 early_param("cma_pernuma", early_cma_pernuma);
 #endif
 
+/*
+ * Allocating from CMA has to migrate the movable pages occupying the range,
+ * which can take a long time under memory pressure.  With
+ * cma_preclean=<size>[,<block size>] a worker keeps <size> worth of blocks of
+ * the default area allocated ahead of time, so that allocations up to the
+ * block size are served without migration.  The worker refills the cache
+ * once it drops below half of its target.
+ */
+static unsigned long preclean_size __read_mostly;
+static unsigned long preclean_block __read_mostly = SZ_8M;
+static unsigned int preclean_target __read_mostly;
+static unsigned int preclean_nr;
+static LIST_HEAD(preclean_list);
+static DEFINE_SPINLOCK(preclean_lock);
+
+static void dma_preclean_fn(struct work_struct *work);
+static DECLARE_WORK(preclean_work, dma_preclean_fn);
+
+static int __init early_cma_preclean(char *p)
+{
+	preclean_size = memparse(p, &p);
+	if (*p == ',')
+		preclean_block = PAGE_ALIGN(memparse(p + 1, &p));
+	return 0;
+}
+early_param("cma_preclean", early_cma_preclean);
+
+/* Allocation latency in log2 microsecond buckets, and other statistics */
+#define CMA_LAT_BUCKETS		24
+
+static atomic_long_t cma_alloc_latency[CMA_LAT_BUCKETS];
+static atomic_long_t cma_alloc_failed;
+static atomic_long_t preclean_hits;
+
 #ifdef CONFIG_CMA_SIZE_PERCENTAGE
 
 static phys_addr_t __init __maybe_unused cma_early_percent_memory(void)
@@ -282,8 +321,73 @@ bool dma_release_from_contiguous(struct device *dev, struct page *pages,
 static struct page *cma_alloc_aligned(struct cma *cma, size_t size, gfp_t gfp)
 {
 	unsigned int align = min(get_order(size), CONFIG_CMA_ALIGNMENT);
+	u64 start = local_clock();
+	struct page *page;
+	unsigned int bucket;
+
+	page = cma_alloc(cma, size >> PAGE_SHIFT, align, gfp & __GFP_NOWARN);
+
+	bucket = ilog2(div_u64(local_clock() - start, NSEC_PER_USEC) | 1);
+	atomic_long_inc(&cma_alloc_latency[min_t(unsigned int, bucket,
+						 CMA_LAT_BUCKETS - 1)]);
+	if (!page)
+		atomic_long_inc(&cma_alloc_failed);
+	return page;
+}
+
+static void dma_preclean_fn(struct work_struct *work)
+{
+	unsigned int align = min(get_order(preclean_block), CONFIG_CMA_ALIGNMENT);
+	struct page *page;
+
+	while (READ_ONCE(preclean_nr) < preclean_target) {
+		page = cma_alloc(dma_contiguous_default_area,
+				 preclean_block >> PAGE_SHIFT, align, true);
+		if (!page)
+			break;
+
+		spin_lock(&preclean_lock);
+		list_add_tail(&page->lru, &preclean_list);
+		preclean_nr++;
+		spin_unlock(&preclean_lock);
+	}
+}
+
+/*
+ * Take a pre-cleaned block for an allocation of @size and give the tail the
+ * allocation does not need back to the area.  The block is aligned to its
+ * size, so it satisfies the alignment cma_alloc_aligned() would use.
+ */
+static struct page *dma_preclean_get(size_t size)
+{
+	unsigned long count = PAGE_ALIGN(size) >> PAGE_SHIFT;
+	unsigned long nr_block = preclean_block >> PAGE_SHIFT;
+	struct page *page;
+	bool refill;
+
+	if (!preclean_target || size > preclean_block)
+		return NULL;
+
+	spin_lock(&preclean_lock);
+	page = list_first_entry_or_null(&preclean_list, struct page, lru);
+	if (page) {
+		list_del_init(&page->lru);
+		preclean_nr--;
+	}
+	refill = preclean_nr < preclean_target / 2;
+	spin_unlock(&preclean_lock);
 
-	return cma_alloc(cma, size >> PAGE_SHIFT, align, gfp & __GFP_NOWARN);
+	if (refill)
+		queue_work(system_unbound_wq, &preclean_work);
+	if (!page)
+		return NULL;
+
+	if (count < nr_block)
+		cma_release(dma_contiguous_default_area,
+			    pfn_to_page(page_to_pfn(page) + count),
+			    nr_block - count);
+	atomic_long_inc(&preclean_hits);
+	return page;
 }
 
 /**
@@ -306,6 +410,7 @@ struct page *dma_alloc_contiguous(struct device *dev, size_t size, gfp_t gfp)
 #ifdef CONFIG_DMA_PERNUMA_CMA
 	int nid = dev_to_node(dev);
 #endif
+	struct page *page;
 
 	/* CMA can be used only in the context which permits sleeping */
 	if (!gfpflags_allow_blocking(gfp))
@@ -318,7 +423,6 @@ struct page *dma_alloc_contiguous(struct device *dev, size_t size, gfp_t gfp)
 #ifdef CONFIG_DMA_PERNUMA_CMA
 	if (nid != NUMA_NO_NODE && !(gfp & (GFP_DMA | GFP_DMA32))) {
 		struct cma *cma = dma_contiguous_pernuma_area[nid];
-		struct page *page;
 
 		if (cma) {
 			page = cma_alloc_aligned(cma, size, gfp);
@@ -330,6 +434,9 @@ struct page *dma_alloc_contiguous(struct device *dev, size_t size, gfp_t gfp)
 	if (!dma_contiguous_default_area)
 		return NULL;
 
+	page = dma_preclean_get(size);
+	if (page)
+		return page;
 	return cma_alloc_aligned(dma_contiguous_default_area, size, gfp);
 }
 
@@ -369,6 +476,39 @@ void dma_free_contiguous(struct device *dev, struct page *page, size_t size)
 	__free_pages(page, get_order(size));
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int dma_contiguous_stats_show(struct seq_file *m, void *p)
+{
+	unsigned int i;
+
+	seq_printf(m, "failed:  %ld\n", atomic_long_read(&cma_alloc_failed));
+	seq_printf(m, "preclean: target %u cached %u block %lu hits %ld\n",
+		   preclean_target, READ_ONCE(preclean_nr), preclean_block,
+		   atomic_long_read(&preclean_hits));
+	seq_puts(m, "latency >= (us)   count\n");
+	for (i = 0; i < CMA_LAT_BUCKETS; i++)
+		seq_printf(m, "%10lu%s %10ld\n", 1UL << i,
+			   i == CMA_LAT_BUCKETS - 1 ? "+" : " ",
+			   atomic_long_read(&cma_alloc_latency[i]));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(dma_contiguous_stats);
+#endif
+
+static int __init dma_contiguous_late_init(void)
+{
+	if (dma_contiguous_default_area && preclean_size && preclean_block) {
+		preclean_target = preclean_size / preclean_block;
+		queue_work(system_unbound_wq, &preclean_work);
+	}
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("dma_contiguous", 0444, NULL, NULL,
+			    &dma_contiguous_stats_fops);
+#endif
+	return 0;
+}
+late_initcall(dma_contiguous_late_init);
+
 /*
  * Support for reserved memory regions defined in device tree
  */
@@ -1289,6 +1289,11 @@ void debug_dma_unmap_page(struct device *dev, dma_addr_t addr,
 	check_unmap(&ref);
 }
 
+bool debug_dma_active(void)
+{
+	return !dma_debug_disabled();
+}
+
 void debug_dma_map_sg(struct device *dev, struct scatterlist *sg,
 		      int nents, int mapped_ents, int direction)
 {
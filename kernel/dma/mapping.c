@@ -13,6 +13,7 @@
 #include <linux/of_device.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/xarray.h>
 #include "debug.h"
 #include "direct.h"
 
@@ -214,6 +215,196 @@ void dma_unmap_sg_attrs(struct device *dev, struct scatterlist *sg,
 }
 EXPORT_SYMBOL(dma_unmap_sg_attrs);
 
+/*
+ * Persistent DMA mappings
+ *
+ * Drivers which do I/O from a long-lived set of pages can map those pages
+ * once with dma_premap_create() and then link each request into the existing
+ * mapping with dma_premap_map_sg(), which only looks up the DMA addresses and
+ * syncs if the device needs it.  With DMA API debugging active, requests are
+ * mapped individually so that ownership of each request is still checked.
+ */
+struct dma_premap {
+	struct device		*dev;
+	enum dma_data_direction	dir;
+	unsigned long		attrs;
+	unsigned int		nr_pages;
+	bool			need_sync;
+	bool			debug;
+	struct xarray		index;		/* pfn -> page index */
+	dma_addr_t		dma_addr[];
+};
+
+static void __dma_premap_destroy(struct dma_premap *pm, unsigned int nr_pages)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_pages; i++)
+		dma_unmap_page_attrs(pm->dev, pm->dma_addr[i], PAGE_SIZE,
+				     pm->dir, pm->attrs | DMA_ATTR_SKIP_CPU_SYNC);
+	xa_destroy(&pm->index);
+	kvfree(pm);
+}
+
+/**
+ * dma_premap_create - map a set of pages for repeated use by a device
+ * @dev: device the pages are mapped for
+ * @pages: pages to map, each may only be given once
+ * @nr_pages: number of entries in @pages
+ * @dir: DMA direction of all requests using the mapping
+ * @attrs: DMA attributes of the mapping
+ *
+ * Returns the mapping, or an ERR_PTR() on failure.  The pages must stay
+ * allocated until the mapping is released with dma_premap_destroy().
+ */
+struct dma_premap *dma_premap_create(struct device *dev, struct page **pages,
+		unsigned int nr_pages, enum dma_data_direction dir,
+		unsigned long attrs)
+{
+	struct dma_premap *pm;
+	unsigned int i;
+	int ret;
+
+	if (!valid_dma_direction(dir) || !nr_pages)
+		return ERR_PTR(-EINVAL);
+
+	pm = kvzalloc(struct_size(pm, dma_addr, nr_pages), GFP_KERNEL);
+	if (!pm)
+		return ERR_PTR(-ENOMEM);
+	pm->dev = dev;
+	pm->dir = dir;
+	pm->attrs = attrs;
+	pm->nr_pages = nr_pages;
+	pm->debug = debug_dma_active();
+	xa_init(&pm->index);
+
+	for (i = 0; i < nr_pages; i++) {
+		pm->dma_addr[i] = dma_map_page_attrs(dev, pages[i], 0, PAGE_SIZE,
+				dir, attrs | DMA_ATTR_SKIP_CPU_SYNC);
+		if (dma_mapping_error(dev, pm->dma_addr[i])) {
+			ret = -ENOMEM;
+			goto out_destroy;
+		}
+		ret = xa_insert(&pm->index, page_to_pfn(pages[i]),
+				xa_mk_value(i), GFP_KERNEL);
+		if (ret) {
+			i++;
+			goto out_destroy;
+		}
+		if (dma_need_sync(dev, pm->dma_addr[i]))
+			pm->need_sync = true;
+	}
+	return pm;
+
+out_destroy:
+	__dma_premap_destroy(pm, i);
+	return ERR_PTR(ret);
+}
+EXPORT_SYMBOL_GPL(dma_premap_create);
+
+/**
+ * dma_premap_destroy - release a mapping created by dma_premap_create()
+ * @pm: mapping to release
+ *
+ * No request may still be linked into @pm.
+ */
+void dma_premap_destroy(struct dma_premap *pm)
+{
+	__dma_premap_destroy(pm, pm->nr_pages);
+}
+EXPORT_SYMBOL_GPL(dma_premap_destroy);
+
+/*
+ * Return the DMA address of @len bytes at @offset into @page, or
+ * DMA_MAPPING_ERROR if the range is not covered by a single contiguous
+ * part of @pm.
+ */
+static dma_addr_t dma_premap_lookup(struct dma_premap *pm, struct page *page,
+		unsigned int offset, unsigned int len)
+{
+	unsigned long pfn = page_to_pfn(page) + (offset >> PAGE_SHIFT);
+	unsigned int i, idx, nr = PFN_UP((offset & ~PAGE_MASK) + len);
+	void *entry;
+
+	entry = xa_load(&pm->index, pfn);
+	if (!xa_is_value(entry))
+		return DMA_MAPPING_ERROR;
+	idx = xa_to_value(entry);
+
+	for (i = 1; i < nr; i++) {
+		if (idx + i >= pm->nr_pages ||
+		    xa_load(&pm->index, pfn + i) != xa_mk_value(idx + i) ||
+		    pm->dma_addr[idx + i] != pm->dma_addr[idx] + i * PAGE_SIZE)
+			return DMA_MAPPING_ERROR;
+	}
+	return pm->dma_addr[idx] + (offset & ~PAGE_MASK);
+}
+
+/**
+ * dma_premap_map_sg - link a request into a persistent mapping
+ * @pm: mapping created by dma_premap_create()
+ * @sg: scatterlist of the request
+ * @nents: number of entries in @sg
+ *
+ * Fills in the DMA addresses of @sg from @pm and transfers ownership of the
+ * buffers to the device.  Returns the number of DMA entries like
+ * dma_map_sg_attrs(), or 0 if @sg is not fully covered by @pm, in which case
+ * the caller has to map the request with dma_map_sg_attrs() instead.
+ */
+int dma_premap_map_sg(struct dma_premap *pm, struct scatterlist *sg, int nents)
+{
+	struct scatterlist *s;
+	dma_addr_t addr;
+	int i;
+
+	if (pm->debug)
+		return dma_map_sg_attrs(pm->dev, sg, nents, pm->dir, pm->attrs);
+
+	for_each_sg(sg, s, nents, i) {
+		addr = dma_premap_lookup(pm, sg_page(s), s->offset, s->length);
+		if (addr == DMA_MAPPING_ERROR)
+			return 0;
+		s->dma_address = addr;
+		sg_dma_len(s) = s->length;
+	}
+
+	if (pm->need_sync) {
+		for_each_sg(sg, s, nents, i)
+			dma_sync_single_for_device(pm->dev, s->dma_address,
+						   s->length, pm->dir);
+	}
+	return nents;
+}
+EXPORT_SYMBOL_GPL(dma_premap_map_sg);
+
+/**
+ * dma_premap_unmap_sg - unlink a request from a persistent mapping
+ * @pm: mapping the request was linked into
+ * @sg: scatterlist passed to dma_premap_map_sg()
+ * @nents: number of entries passed to dma_premap_map_sg()
+ *
+ * Transfers ownership of the buffers back to the CPU.  The mapping itself
+ * stays in place.
+ */
+void dma_premap_unmap_sg(struct dma_premap *pm, struct scatterlist *sg,
+		int nents)
+{
+	struct scatterlist *s;
+	int i;
+
+	if (pm->debug) {
+		dma_unmap_sg_attrs(pm->dev, sg, nents, pm->dir, pm->attrs);
+		return;
+	}
+
+	if (!pm->need_sync || pm->dir == DMA_TO_DEVICE)
+		return;
+	for_each_sg(sg, s, nents, i)
+		dma_sync_single_for_cpu(pm->dev, s->dma_address, s->length,
+					pm->dir);
+}
+EXPORT_SYMBOL_GPL(dma_premap_unmap_sg);
+
 dma_addr_t dma_map_resource(struct device *dev, phys_addr_t phys_addr,
 		size_t size, enum dma_data_direction dir, unsigned long attrs)
 {
@@ -36,8 +36,13 @@
 #include <linux/scatterlist.h>
 #include <linux/mem_encrypt.h>
 #include <linux/set_memory.h>
+#include <linux/slab.h>
+#include <linux/rculist.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #endif
 
 #include <asm/io.h>
@@ -78,16 +83,50 @@ phys_addr_t io_tlb_start, io_tlb_end;
 static unsigned long io_tlb_nslabs;
 
 /*
- * The number of used IO TLB block
+ * The IO TLB pool is split into areas, each with its own lock and search
+ * index, so that CPUs mapping concurrently do not serialise on a single lock.
+ * A CPU searches the area it maps to first and only falls back to the others
+ * when that one is full or contended.
  */
-static unsigned long io_tlb_used;
+struct io_tlb_area {
+	spinlock_t		lock;
+	unsigned int		index;
+	unsigned long		used;
+	atomic_long_t		contended;
+} ____cacheline_aligned_in_smp;
 
 /*
- * This is a free list describing the number of free entries available from
- * each index
+ * A contiguous range of IO TLB slabs. The default pool covers io_tlb_start
+ * to io_tlb_end, additional pools are added at runtime when swiotlb_max= allows
+ * the bounce buffer space to grow.
  */
-static unsigned int *io_tlb_list;
-static unsigned int io_tlb_index;
+struct io_tlb_pool {
+	phys_addr_t		start;
+	phys_addr_t		end;
+	unsigned long		nslabs;
+	/*
+	 * This is a free list describing the number of free entries available
+	 * from each index
+	 */
+	unsigned int		*list;
+	/*
+	 * We need to save away the original address corresponding to a mapped
+	 * entry for the sync operations.
+	 */
+	phys_addr_t		*orig_addr;
+	unsigned int		nareas;
+	unsigned int		area_nslabs;
+	struct io_tlb_area	*areas;
+	struct list_head	node;
+};
+
+static struct io_tlb_pool io_tlb_default_pool;
+
+/*
+ * The number of areas requested on the command line, rounded up to a power of
+ * two. 0 means one area per possible CPU.
+ */
+static unsigned int io_tlb_nareas;
 
 /*
  * Max segment that we can provide which (if pages are contingous) will
@@ -95,17 +134,27 @@ static unsigned int io_tlb_index;
  */
 static unsigned int max_segment;
 
-/*
- * We need to save away the original address corresponding to a mapped entry
- * for the sync operations.
- */
 #define INVALID_PHYS_ADDR (~(phys_addr_t)0)
-static phys_addr_t *io_tlb_orig_addr;
 
 /*
- * Protect the above data structures in the map and unmap calls
+ * Pools added at runtime. They are never removed, so lookups only need RCU
+ * protection against the list insertion.
  */
-static DEFINE_SPINLOCK(io_tlb_lock);
+static LIST_HEAD(io_tlb_pools);
+bool io_tlb_grown;
+
+/* Upper limit of the total number of slabs, set by swiotlb_max= */
+static unsigned long io_tlb_max_nslabs;
+static unsigned long io_tlb_grown_nslabs;
+static bool io_tlb_grow_force;
+
+static void swiotlb_grow_fn(struct work_struct *work);
+static DECLARE_WORK(io_tlb_grow_work, swiotlb_grow_fn);
+
+/* Pools are grown in chunks of the largest page allocator order */
+#define IO_TLB_GROW_ORDER	(MAX_ORDER - 1)
+
+static atomic_long_t io_tlb_failed;
 
 static int late_alloc;
 
@@ -119,6 +168,13 @@ setup_io_tlb_npages(char *str)
 	}
 	if (*str == ',')
 		++str;
+	if (isdigit(*str)) {
+		io_tlb_nareas = simple_strtoul(str, &str, 0);
+		if (io_tlb_nareas)
+			io_tlb_nareas = roundup_pow_of_two(io_tlb_nareas);
+		if (*str == ',')
+			++str;
+	}
 	if (!strcmp(str, "force")) {
 		swiotlb_force = SWIOTLB_FORCE;
 	} else if (!strcmp(str, "noforce")) {
@@ -130,6 +186,13 @@ setup_io_tlb_npages(char *str)
 }
 early_param("swiotlb", setup_io_tlb_npages);
 
+static int __init setup_io_tlb_max(char *str)
+{
+	io_tlb_max_nslabs = memparse(str, &str) >> IO_TLB_SHIFT;
+	return 0;
+}
+early_param("swiotlb_max", setup_io_tlb_max);
+
 static bool no_iotlb_memory;
 
 unsigned long swiotlb_nr_tbl(void)
@@ -196,9 +259,47 @@ void __init swiotlb_update_mem_attributes(void)
 	memset(vaddr, 0, bytes);
 }
 
+/*
+ * Areas must consist of whole IO_TLB_SEGSIZE segments, so the number of areas
+ * is reduced until it evenly divides the pool.
+ */
+static unsigned int swiotlb_nareas(unsigned long nslabs)
+{
+	unsigned int nareas = io_tlb_nareas;
+
+	if (!nareas)
+		nareas = roundup_pow_of_two(num_possible_cpus());
+	while (nareas > 1 && nslabs % (nareas * IO_TLB_SEGSIZE))
+		nareas >>= 1;
+	return nareas;
+}
+
+static void swiotlb_init_pool(struct io_tlb_pool *pool, phys_addr_t start,
+			      unsigned long nslabs)
+{
+	unsigned long i;
+
+	pool->start = start;
+	pool->end = start + (nslabs << IO_TLB_SHIFT);
+	pool->nslabs = nslabs;
+	pool->area_nslabs = nslabs / pool->nareas;
+
+	for (i = 0; i < pool->nareas; i++) {
+		spin_lock_init(&pool->areas[i].lock);
+		pool->areas[i].index = 0;
+		pool->areas[i].used = 0;
+		atomic_long_set(&pool->areas[i].contended, 0);
+	}
+	for (i = 0; i < nslabs; i++) {
+		pool->list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
+		pool->orig_addr[i] = INVALID_PHYS_ADDR;
+	}
+}
+
 int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 {
-	unsigned long i, bytes;
+	struct io_tlb_pool *pool = &io_tlb_default_pool;
+	unsigned long bytes;
 	size_t alloc_size;
 
 	bytes = nslabs << IO_TLB_SHIFT;
@@ -213,22 +314,25 @@ int __init swiotlb_init_with_tbl(char *tlb, unsigned long nslabs, int verbose)
 	 * between io_tlb_start and io_tlb_end.
 	 */
 	alloc_size = PAGE_ALIGN(io_tlb_nslabs * sizeof(int));
-	io_tlb_list = memblock_alloc(alloc_size, PAGE_SIZE);
-	if (!io_tlb_list)
+	pool->list = memblock_alloc(alloc_size, PAGE_SIZE);
+	if (!pool->list)
 		panic("%s: Failed to allocate %zu bytes align=0x%lx\n",
 		      __func__, alloc_size, PAGE_SIZE);
 
 	alloc_size = PAGE_ALIGN(io_tlb_nslabs * sizeof(phys_addr_t));
-	io_tlb_orig_addr = memblock_alloc(alloc_size, PAGE_SIZE);
-	if (!io_tlb_orig_addr)
+	pool->orig_addr = memblock_alloc(alloc_size, PAGE_SIZE);
+	if (!pool->orig_addr)
 		panic("%s: Failed to allocate %zu bytes align=0x%lx\n",
 		      __func__, alloc_size, PAGE_SIZE);
 
-	for (i = 0; i < io_tlb_nslabs; i++) {
-		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
-		io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
-	}
-	io_tlb_index = 0;
+	pool->nareas = swiotlb_nareas(nslabs);
+	alloc_size = array_size(pool->nareas, sizeof(struct io_tlb_area));
+	pool->areas = memblock_alloc(alloc_size, SMP_CACHE_BYTES);
+	if (!pool->areas)
+		panic("%s: Failed to allocate %zu bytes align=0x%x\n",
+		      __func__, alloc_size, SMP_CACHE_BYTES);
+
+	swiotlb_init_pool(pool, io_tlb_start, nslabs);
 
 	if (verbose)
 		swiotlb_print_info();
@@ -327,7 +431,8 @@ static void swiotlb_cleanup(void)
 int
 swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 {
-	unsigned long i, bytes;
+	struct io_tlb_pool *pool = &io_tlb_default_pool;
+	unsigned long bytes;
 
 	bytes = nslabs << IO_TLB_SHIFT;
 
@@ -343,23 +448,25 @@ swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 	 * to find contiguous free memory regions of size up to IO_TLB_SEGSIZE
 	 * between io_tlb_start and io_tlb_end.
 	 */
-	io_tlb_list = (unsigned int *)__get_free_pages(GFP_KERNEL,
+	pool->list = (unsigned int *)__get_free_pages(GFP_KERNEL,
 	                              get_order(io_tlb_nslabs * sizeof(int)));
-	if (!io_tlb_list)
+	if (!pool->list)
 		goto cleanup3;
 
-	io_tlb_orig_addr = (phys_addr_t *)
+	pool->orig_addr = (phys_addr_t *)
 		__get_free_pages(GFP_KERNEL,
 				 get_order(io_tlb_nslabs *
 					   sizeof(phys_addr_t)));
-	if (!io_tlb_orig_addr)
+	if (!pool->orig_addr)
 		goto cleanup4;
 
-	for (i = 0; i < io_tlb_nslabs; i++) {
-		io_tlb_list[i] = IO_TLB_SEGSIZE - OFFSET(i, IO_TLB_SEGSIZE);
-		io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
-	}
-	io_tlb_index = 0;
+	pool->nareas = swiotlb_nareas(nslabs);
+	pool->areas = kcalloc(pool->nareas, sizeof(struct io_tlb_area),
+			      GFP_KERNEL);
+	if (!pool->areas)
+		goto cleanup5;
+
+	swiotlb_init_pool(pool, io_tlb_start, nslabs);
 
 	swiotlb_print_info();
 
@@ -369,10 +476,14 @@ swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 
 	return 0;
 
+cleanup5:
+	free_pages((unsigned long)pool->orig_addr,
+		   get_order(io_tlb_nslabs * sizeof(phys_addr_t)));
+	pool->orig_addr = NULL;
 cleanup4:
-	free_pages((unsigned long)io_tlb_list, get_order(io_tlb_nslabs *
+	free_pages((unsigned long)pool->list, get_order(io_tlb_nslabs *
 	                                                 sizeof(int)));
-	io_tlb_list = NULL;
+	pool->list = NULL;
 cleanup3:
 	swiotlb_cleanup();
 	return -ENOMEM;
@@ -380,24 +491,30 @@ swiotlb_late_init_with_tbl(char *tlb, unsigned long nslabs)
 
 void __init swiotlb_exit(void)
 {
-	if (!io_tlb_orig_addr)
+	struct io_tlb_pool *pool = &io_tlb_default_pool;
+
+	if (!pool->orig_addr)
 		return;
 
 	if (late_alloc) {
-		free_pages((unsigned long)io_tlb_orig_addr,
+		kfree(pool->areas);
+		free_pages((unsigned long)pool->orig_addr,
 			   get_order(io_tlb_nslabs * sizeof(phys_addr_t)));
-		free_pages((unsigned long)io_tlb_list, get_order(io_tlb_nslabs *
-								 sizeof(int)));
+		free_pages((unsigned long)pool->list, get_order(io_tlb_nslabs *
+								sizeof(int)));
 		free_pages((unsigned long)phys_to_virt(io_tlb_start),
 			   get_order(io_tlb_nslabs << IO_TLB_SHIFT));
 	} else {
-		memblock_free_late(__pa(io_tlb_orig_addr),
+		memblock_free_late(__pa(pool->areas),
+				   pool->nareas * sizeof(struct io_tlb_area));
+		memblock_free_late(__pa(pool->orig_addr),
 				   PAGE_ALIGN(io_tlb_nslabs * sizeof(phys_addr_t)));
-		memblock_free_late(__pa(io_tlb_list),
+		memblock_free_late(__pa(pool->list),
 				   PAGE_ALIGN(io_tlb_nslabs * sizeof(int)));
 		memblock_free_late(io_tlb_start,
 				   PAGE_ALIGN(io_tlb_nslabs << IO_TLB_SHIFT));
 	}
+	memset(pool, 0, sizeof(*pool));
 	swiotlb_cleanup();
 }
 
@@ -441,79 +558,107 @@ static void swiotlb_bounce(phys_addr_t orig_addr, phys_addr_t tlb_addr,
 	}
 }
 
-phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
-				   dma_addr_t tbl_dma_addr,
-				   phys_addr_t orig_addr,
-				   size_t mapping_size,
-				   size_t alloc_size,
-				   enum dma_data_direction dir,
-				   unsigned long attrs)
+static unsigned long swiotlb_pool_used(struct io_tlb_pool *pool)
 {
-	unsigned long flags;
-	phys_addr_t tlb_addr;
-	unsigned int nslots, stride, index, wrap;
-	int i;
-	unsigned long mask;
-	unsigned long offset_slots;
-	unsigned long max_slots;
-	unsigned long tmp_io_tlb_used;
+	unsigned long used = 0;
+	unsigned int i;
 
-	if (no_iotlb_memory)
-		panic("Can not allocate SWIOTLB buffer earlier and can't now provide you with the DMA bounce buffer");
+	for (i = 0; i < pool->nareas; i++)
+		used += READ_ONCE(pool->areas[i].used);
+	return used;
+}
 
-	if (mem_encrypt_active())
-		pr_warn_once("Memory encryption is active and system is using DMA bounce buffers\n");
+/* Number of used and total slabs in all pools, for statistics only */
+static unsigned long swiotlb_used(unsigned long *nslabs)
+{
+	struct io_tlb_pool *pool;
+	unsigned long used;
 
-	if (mapping_size > alloc_size) {
-		dev_warn_once(hwdev, "Invalid sizes (mapping: %zd bytes, alloc: %zd bytes)",
-			      mapping_size, alloc_size);
-		return (phys_addr_t)DMA_MAPPING_ERROR;
+	used = swiotlb_pool_used(&io_tlb_default_pool);
+	*nslabs = io_tlb_default_pool.nslabs;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &io_tlb_pools, node) {
+		used += swiotlb_pool_used(pool);
+		*nslabs += pool->nslabs;
 	}
+	rcu_read_unlock();
+	return used;
+}
 
-	mask = dma_get_seg_boundary(hwdev);
+static struct io_tlb_pool *swiotlb_find_pool(phys_addr_t paddr)
+{
+	struct io_tlb_pool *pool, *found = NULL;
 
-	tbl_dma_addr &= mask;
+	if (paddr >= io_tlb_start && paddr < io_tlb_end)
+		return &io_tlb_default_pool;
 
-	offset_slots = ALIGN(tbl_dma_addr, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &io_tlb_pools, node) {
+		if (paddr >= pool->start && paddr < pool->end) {
+			found = pool;
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return found;
+}
 
-	/*
-	 * Carefully handle integer overflow which can occur when mask == ~0UL.
-	 */
-	max_slots = mask + 1
-		    ? ALIGN(mask + 1, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT
-		    : 1UL << (BITS_PER_LONG - IO_TLB_SHIFT);
+bool is_swiotlb_grown_buffer(phys_addr_t paddr)
+{
+	return swiotlb_find_pool(paddr) != NULL;
+}
 
-	/*
-	 * For mappings greater than or equal to a page, we limit the stride
-	 * (and hence alignment) to a page size.
-	 */
-	nslots = ALIGN(alloc_size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
-	if (alloc_size >= PAGE_SIZE)
-		stride = (1 << (PAGE_SHIFT - IO_TLB_SHIFT));
-	else
-		stride = 1;
+static void swiotlb_kick_grow(bool force)
+{
+	if (!io_tlb_max_nslabs)
+		return;
+	if (force)
+		WRITE_ONCE(io_tlb_grow_force, true);
+	schedule_work(&io_tlb_grow_work);
+}
 
-	BUG_ON(!nslots);
+/*
+ * Find @nslots contiguous free slots in one area of @pool and mark them used.
+ * Returns the pool relative index of the first slot, or -1 if the area is
+ * full. With @trylock, a contended area is skipped and *@contended is set.
+ */
+static int swiotlb_area_find_slots(struct io_tlb_pool *pool,
+				   unsigned int area_index, unsigned int nslots,
+				   unsigned int stride,
+				   unsigned long offset_slots,
+				   unsigned long max_slots,
+				   bool trylock, bool *contended)
+{
+	struct io_tlb_area *area = pool->areas + area_index;
+	unsigned int base = area_index * pool->area_nslabs;
+	unsigned int index, wrap;
+	unsigned long flags;
+	int i, count;
 
-	/*
-	 * Find suitable number of IO TLB entries size that will fit this
-	 * request and allocate a buffer from that IO TLB pool.
-	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
+	if (trylock) {
+		if (!spin_trylock_irqsave(&area->lock, flags)) {
+			atomic_long_inc(&area->contended);
+			*contended = true;
+			return -1;
+		}
+	} else {
+		spin_lock_irqsave(&area->lock, flags);
+	}
 
-	if (unlikely(nslots > io_tlb_nslabs - io_tlb_used))
+	if (unlikely(nslots > pool->area_nslabs - area->used))
 		goto not_found;
 
-	index = ALIGN(io_tlb_index, stride);
-	if (index >= io_tlb_nslabs)
+	index = ALIGN(area->index, stride);
+	if (index >= pool->area_nslabs)
 		index = 0;
 	wrap = index;
 
 	do {
-		while (iommu_is_span_boundary(index, nslots, offset_slots,
-					      max_slots)) {
+		while (iommu_is_span_boundary(base + index, nslots,
+					      offset_slots, max_slots)) {
 			index += stride;
-			if (index >= io_tlb_nslabs)
+			if (index >= pool->area_nslabs)
 				index = 0;
 			if (index == wrap)
 				goto not_found;
@@ -524,48 +669,171 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 		 * contiguous buffers, we allocate the buffers from that slot
 		 * and mark the entries as '0' indicating unavailable.
 		 */
-		if (io_tlb_list[index] >= nslots) {
-			int count = 0;
-
-			for (i = index; i < (int) (index + nslots); i++)
-				io_tlb_list[i] = 0;
-			for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE - 1) && io_tlb_list[i]; i--)
-				io_tlb_list[i] = ++count;
-			tlb_addr = io_tlb_start + (index << IO_TLB_SHIFT);
+		if (pool->list[base + index] >= nslots) {
+			count = 0;
+			for (i = base + index; i < (int) (base + index + nslots); i++)
+				pool->list[i] = 0;
+			for (i = base + index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE - 1) && pool->list[i]; i--)
+				pool->list[i] = ++count;
 
 			/*
 			 * Update the indices to avoid searching in the next
 			 * round.
 			 */
-			io_tlb_index = ((index + nslots) < io_tlb_nslabs
-					? (index + nslots) : 0);
-
-			goto found;
+			area->index = ((index + nslots) < pool->area_nslabs
+				       ? (index + nslots) : 0);
+			area->used += nslots;
+			spin_unlock_irqrestore(&area->lock, flags);
+			return base + index;
 		}
 		index += stride;
-		if (index >= io_tlb_nslabs)
+		if (index >= pool->area_nslabs)
 			index = 0;
 	} while (index != wrap);
 
 not_found:
-	tmp_io_tlb_used = io_tlb_used;
+	spin_unlock_irqrestore(&area->lock, flags);
+	return -1;
+}
 
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
-	if (!(attrs & DMA_ATTR_NO_WARN) && printk_ratelimit())
-		dev_warn(hwdev, "swiotlb buffer is full (sz: %zd bytes), total %lu (slots), used %lu (slots)\n",
-			 alloc_size, io_tlb_nslabs, tmp_io_tlb_used);
+/*
+ * Allocate bounce buffer space for @orig_addr from @pool, whose first slab
+ * has the DMA address @tbl_dma_addr. The search starts in the area of the
+ * current CPU and walks the others, first skipping contended areas and then,
+ * only if one was skipped, waiting for them.
+ */
+static phys_addr_t swiotlb_pool_map(struct device *hwdev,
+				    struct io_tlb_pool *pool,
+				    dma_addr_t tbl_dma_addr,
+				    phys_addr_t orig_addr, size_t alloc_size)
+{
+	unsigned int nslots, stride, start, area;
+	unsigned long mask, offset_slots, max_slots;
+	bool contended = false, trylock = true;
+	int i, index;
+
+	mask = dma_get_seg_boundary(hwdev);
+
+	tbl_dma_addr &= mask;
+
+	offset_slots = ALIGN(tbl_dma_addr, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
+
+	/*
+	 * Carefully handle integer overflow which can occur when mask == ~0UL.
+	 */
+	max_slots = mask + 1
+		    ? ALIGN(mask + 1, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT
+		    : 1UL << (BITS_PER_LONG - IO_TLB_SHIFT);
+
+	/*
+	 * For mappings greater than or equal to a page, we limit the stride
+	 * (and hence alignment) to a page size.
+	 */
+	nslots = ALIGN(alloc_size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
+	if (alloc_size >= PAGE_SIZE)
+		stride = (1 << (PAGE_SHIFT - IO_TLB_SHIFT));
+	else
+		stride = 1;
+
+	BUG_ON(!nslots);
+
+	if (unlikely(nslots > pool->area_nslabs))
+		return (phys_addr_t)DMA_MAPPING_ERROR;
+
+	start = raw_smp_processor_id() & (pool->nareas - 1);
+again:
+	area = start;
+	do {
+		index = swiotlb_area_find_slots(pool, area, nslots, stride,
+						offset_slots, max_slots,
+						trylock, &contended);
+		if (index >= 0)
+			goto found;
+		area = (area + 1) & (pool->nareas - 1);
+	} while (area != start);
+
+	if (trylock && contended) {
+		trylock = false;
+		goto again;
+	}
 	return (phys_addr_t)DMA_MAPPING_ERROR;
+
 found:
-	io_tlb_used += nslots;
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	/* Our own area running full is the early sign to grow the pools */
+	if (area != start)
+		swiotlb_kick_grow(false);
 
 	/*
 	 * Save away the mapping from the original address to the DMA address.
-	 * This is needed when we sync the memory.  Then we sync the buffer if
-	 * needed.
+	 * This is needed when we sync the memory.
 	 */
 	for (i = 0; i < nslots; i++)
-		io_tlb_orig_addr[index+i] = orig_addr + (i << IO_TLB_SHIFT);
+		pool->orig_addr[index + i] = orig_addr + (i << IO_TLB_SHIFT);
+
+	return pool->start + ((phys_addr_t)index << IO_TLB_SHIFT);
+}
+
+static phys_addr_t swiotlb_tbl_map(struct device *hwdev,
+				   dma_addr_t tbl_dma_addr,
+				   phys_addr_t orig_addr,
+				   size_t mapping_size,
+				   size_t alloc_size,
+				   enum dma_data_direction dir,
+				   unsigned long attrs, bool grown)
+{
+	struct io_tlb_pool *pool;
+	phys_addr_t tlb_addr;
+	unsigned long used, nslabs;
+
+	if (no_iotlb_memory)
+		panic("Can not allocate SWIOTLB buffer earlier and can't now provide you with the DMA bounce buffer");
+
+	if (mem_encrypt_active())
+		pr_warn_once("Memory encryption is active and system is using DMA bounce buffers\n");
+
+	if (mapping_size > alloc_size) {
+		dev_warn_once(hwdev, "Invalid sizes (mapping: %zd bytes, alloc: %zd bytes)",
+			      mapping_size, alloc_size);
+		return (phys_addr_t)DMA_MAPPING_ERROR;
+	}
+
+	tlb_addr = swiotlb_pool_map(hwdev, &io_tlb_default_pool, tbl_dma_addr,
+				    orig_addr, alloc_size);
+	if (tlb_addr != (phys_addr_t)DMA_MAPPING_ERROR)
+		goto found;
+
+	/*
+	 * The grown pools are only usable by callers which address the bounce
+	 * buffer through the direct mapping, see swiotlb_map().
+	 */
+	if (grown && READ_ONCE(io_tlb_grown)) {
+		rcu_read_lock();
+		list_for_each_entry_rcu(pool, &io_tlb_pools, node) {
+			tbl_dma_addr = phys_to_dma_unencrypted(hwdev, pool->start);
+			if (!dma_capable(hwdev, tbl_dma_addr,
+					 pool->end - pool->start, true))
+				continue;
+			tlb_addr = swiotlb_pool_map(hwdev, pool, tbl_dma_addr,
+						    orig_addr, alloc_size);
+			if (tlb_addr != (phys_addr_t)DMA_MAPPING_ERROR)
+				break;
+		}
+		rcu_read_unlock();
+		if (tlb_addr != (phys_addr_t)DMA_MAPPING_ERROR)
+			goto found;
+	}
+
+	atomic_long_inc(&io_tlb_failed);
+	if (grown)
+		swiotlb_kick_grow(true);
+	if (!(attrs & DMA_ATTR_NO_WARN) && printk_ratelimit()) {
+		used = swiotlb_used(&nslabs);
+		dev_warn(hwdev, "swiotlb buffer is full (sz: %zd bytes), total %lu (slots), used %lu (slots)\n",
+			 alloc_size, nslabs, used);
+	}
+	return (phys_addr_t)DMA_MAPPING_ERROR;
+
+found:
 	if (!(attrs & DMA_ATTR_SKIP_CPU_SYNC) &&
 	    (dir == DMA_TO_DEVICE || dir == DMA_BIDIRECTIONAL))
 		swiotlb_bounce(orig_addr, tlb_addr, mapping_size, DMA_TO_DEVICE);
@@ -573,6 +841,18 @@ phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
 	return tlb_addr;
 }
 
+phys_addr_t swiotlb_tbl_map_single(struct device *hwdev,
+				   dma_addr_t tbl_dma_addr,
+				   phys_addr_t orig_addr,
+				   size_t mapping_size,
+				   size_t alloc_size,
+				   enum dma_data_direction dir,
+				   unsigned long attrs)
+{
+	return swiotlb_tbl_map(hwdev, tbl_dma_addr, orig_addr, mapping_size,
+			       alloc_size, dir, attrs, false);
+}
+
 /*
  * tlb_addr is the physical address of the bounce buffer to unmap.
  */
@@ -580,10 +860,12 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 			      size_t mapping_size, size_t alloc_size,
 			      enum dma_data_direction dir, unsigned long attrs)
 {
+	struct io_tlb_pool *pool = swiotlb_find_pool(tlb_addr);
+	struct io_tlb_area *area;
 	unsigned long flags;
 	int i, count, nslots = ALIGN(alloc_size, 1 << IO_TLB_SHIFT) >> IO_TLB_SHIFT;
-	int index = (tlb_addr - io_tlb_start) >> IO_TLB_SHIFT;
-	phys_addr_t orig_addr = io_tlb_orig_addr[index];
+	int index = (tlb_addr - pool->start) >> IO_TLB_SHIFT;
+	phys_addr_t orig_addr = pool->orig_addr[index];
 
 	/*
 	 * First, sync the memory before unmapping the entry
@@ -599,36 +881,38 @@ void swiotlb_tbl_unmap_single(struct device *hwdev, phys_addr_t tlb_addr,
 	 * While returning the entries to the free list, we merge the entries
 	 * with slots below and above the pool being returned.
 	 */
-	spin_lock_irqsave(&io_tlb_lock, flags);
+	area = pool->areas + index / pool->area_nslabs;
+	spin_lock_irqsave(&area->lock, flags);
 	{
 		count = ((index + nslots) < ALIGN(index + 1, IO_TLB_SEGSIZE) ?
-			 io_tlb_list[index + nslots] : 0);
+			 pool->list[index + nslots] : 0);
 		/*
 		 * Step 1: return the slots to the free list, merging the
 		 * slots with superceeding slots
 		 */
 		for (i = index + nslots - 1; i >= index; i--) {
-			io_tlb_list[i] = ++count;
-			io_tlb_orig_addr[i] = INVALID_PHYS_ADDR;
+			pool->list[i] = ++count;
+			pool->orig_addr[i] = INVALID_PHYS_ADDR;
 		}
 		/*
 		 * Step 2: merge the returned slots with the preceding slots,
 		 * if available (non zero)
 		 */
-		for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE -1) && io_tlb_list[i]; i--)
-			io_tlb_list[i] = ++count;
+		for (i = index - 1; (OFFSET(i, IO_TLB_SEGSIZE) != IO_TLB_SEGSIZE -1) && pool->list[i]; i--)
+			pool->list[i] = ++count;
 
-		io_tlb_used -= nslots;
+		area->used -= nslots;
 	}
-	spin_unlock_irqrestore(&io_tlb_lock, flags);
+	spin_unlock_irqrestore(&area->lock, flags);
 }
 
 void swiotlb_tbl_sync_single(struct device *hwdev, phys_addr_t tlb_addr,
 			     size_t size, enum dma_data_direction dir,
 			     enum dma_sync_target target)
 {
-	int index = (tlb_addr - io_tlb_start) >> IO_TLB_SHIFT;
-	phys_addr_t orig_addr = io_tlb_orig_addr[index];
+	struct io_tlb_pool *pool = swiotlb_find_pool(tlb_addr);
+	int index = (tlb_addr - pool->start) >> IO_TLB_SHIFT;
+	phys_addr_t orig_addr = pool->orig_addr[index];
 
 	if (orig_addr == INVALID_PHYS_ADDR)
 		return;
@@ -667,9 +951,9 @@ dma_addr_t swiotlb_map(struct device *dev, phys_addr_t paddr, size_t size,
 	trace_swiotlb_bounced(dev, phys_to_dma(dev, paddr), size,
 			      swiotlb_force);
 
-	swiotlb_addr = swiotlb_tbl_map_single(dev,
+	swiotlb_addr = swiotlb_tbl_map(dev,
 			phys_to_dma_unencrypted(dev, io_tlb_start),
-			paddr, size, size, dir, attrs);
+			paddr, size, size, dir, attrs, true);
 	if (swiotlb_addr == (phys_addr_t)DMA_MAPPING_ERROR)
 		return DMA_MAPPING_ERROR;
 
@@ -703,15 +987,135 @@ bool is_swiotlb_active(void)
 	return io_tlb_end != 0;
 }
 
+static struct io_tlb_pool *swiotlb_alloc_pool(unsigned long nslabs)
+{
+	gfp_t gfp = GFP_KERNEL | __GFP_NOWARN;
+	struct io_tlb_pool *pool;
+	unsigned int order = get_order(nslabs << IO_TLB_SHIFT);
+	struct page *page;
+	void *vaddr;
+
+	/* Stay in the zone the default pool is allocated from */
+	if (IS_ENABLED(CONFIG_ZONE_DMA32))
+		gfp |= __GFP_DMA32;
+	else if (IS_ENABLED(CONFIG_ZONE_DMA))
+		gfp |= __GFP_DMA;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	pool->nareas = swiotlb_nareas(nslabs);
+	pool->areas = kcalloc(pool->nareas, sizeof(struct io_tlb_area),
+			      GFP_KERNEL);
+	pool->list = kcalloc(nslabs, sizeof(int), GFP_KERNEL);
+	pool->orig_addr = kcalloc(nslabs, sizeof(phys_addr_t), GFP_KERNEL);
+	if (!pool->areas || !pool->list || !pool->orig_addr)
+		goto free_pool;
+
+	page = alloc_pages(gfp, order);
+	if (!page)
+		goto free_pool;
+	vaddr = page_address(page);
+
+	/*
+	 * Memory which failed to change its encryption state can not be
+	 * handed back to the page allocator, leak it.
+	 */
+	if (set_memory_decrypted((unsigned long)vaddr, 1 << order))
+		goto free_pool;
+	memset(vaddr, 0, PAGE_SIZE << order);
+
+	swiotlb_init_pool(pool, page_to_phys(page), nslabs);
+	return pool;
+
+free_pool:
+	kfree(pool->orig_addr);
+	kfree(pool->list);
+	kfree(pool->areas);
+	kfree(pool);
+	return NULL;
+}
+
+/*
+ * Add a pool when a mapping failed, or when three quarters of the bounce
+ * buffer space is in use, as long as swiotlb_max= is not exceeded.
+ */
+static void swiotlb_grow_fn(struct work_struct *work)
+{
+	unsigned long used, nslabs, grow = SLABS_PER_PAGE << IO_TLB_GROW_ORDER;
+	struct io_tlb_pool *pool;
+
+	used = swiotlb_used(&nslabs);
+	if (!xchg(&io_tlb_grow_force, false) && used < nslabs / 4 * 3)
+		return;
+	if (nslabs + grow > io_tlb_max_nslabs)
+		return;
+
+	pool = swiotlb_alloc_pool(grow);
+	if (!pool) {
+		pr_warn_ratelimited("failed to grow by %lu slabs\n", grow);
+		return;
+	}
+
+	list_add_tail_rcu(&pool->node, &io_tlb_pools);
+	io_tlb_grown_nslabs += grow;
+	WRITE_ONCE(io_tlb_grown, true);
+	pr_info("grown by [mem %pa-%pa], %luMB added at runtime\n",
+		&pool->start, &pool->end,
+		(io_tlb_grown_nslabs << IO_TLB_SHIFT) >> 20);
+}
+
 #ifdef CONFIG_DEBUG_FS
 
+static int io_tlb_used_get(void *data, u64 *val)
+{
+	unsigned long nslabs;
+
+	*val = swiotlb_used(&nslabs);
+	return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(fops_io_tlb_used, io_tlb_used_get, NULL, "%llu\n");
+
+static void swiotlb_show_pool(struct seq_file *m, struct io_tlb_pool *pool)
+{
+	unsigned int i;
+
+	seq_printf(m, "pool [mem %pa-%pa] nslabs %lu areas %u\n",
+		   &pool->start, &pool->end, pool->nslabs, pool->nareas);
+	for (i = 0; i < pool->nareas; i++)
+		seq_printf(m, "  area %4u: used %6lu / %6u contended %lu\n", i,
+			   READ_ONCE(pool->areas[i].used), pool->area_nslabs,
+			   atomic_long_read(&pool->areas[i].contended));
+}
+
+static int io_tlb_stats_show(struct seq_file *m, void *p)
+{
+	struct io_tlb_pool *pool;
+
+	seq_printf(m, "failed: %lu\n", atomic_long_read(&io_tlb_failed));
+	seq_printf(m, "grown:  %lu slabs (max total %lu)\n", io_tlb_grown_nslabs,
+		   io_tlb_max_nslabs);
+	if (!io_tlb_default_pool.areas)
+		return 0;
+
+	swiotlb_show_pool(m, &io_tlb_default_pool);
+	rcu_read_lock();
+	list_for_each_entry_rcu(pool, &io_tlb_pools, node)
+		swiotlb_show_pool(m, pool);
+	rcu_read_unlock();
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(io_tlb_stats);
+
 static int __init swiotlb_create_debugfs(void)
 {
 	struct dentry *root;
 
 	root = debugfs_create_dir("swiotlb", NULL);
 	debugfs_create_ulong("io_tlb_nslabs", 0400, root, &io_tlb_nslabs);
-	debugfs_create_ulong("io_tlb_used", 0400, root, &io_tlb_used);
+	debugfs_create_file("io_tlb_used", 0400, root, NULL, &fops_io_tlb_used);
+	debugfs_create_file("io_tlb_stats", 0400, root, NULL,
+			    &io_tlb_stats_fops);
 	return 0;
 }
 
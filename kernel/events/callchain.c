@@ -10,6 +10,8 @@
 
 #include <linux/perf_event.h>
 #include <linux/slab.h>
+#include <linux/siphash.h>
+#include <linux/random.h>
 #include <linux/sched/task_stack.h>
 
 #include "internal.h"
@@ -34,6 +36,28 @@ static atomic_t nr_callchain_events;
 static DEFINE_MUTEX(callchain_mutex);
 static struct callchain_cpus_entries *callchain_cpus_entries;
 
+/*
+ * Stack ids are a keyed hash of the callchain, so the same stack gets the
+ * same id on every CPU. Each CPU remembers in a small direct mapped table
+ * which ids it has already emitted, and to which buffer.
+ */
+#define STACK_ID_SLOTS_BITS	10
+#define STACK_ID_SLOTS		(1 << STACK_ID_SLOTS_BITS)
+
+struct stack_id_slot {
+	u64				id;
+	u64				rb_gen;
+};
+
+struct callchain_stack_ids {
+	struct rcu_head			rcu_head;
+	struct stack_id_slot		*cpu_slots[];
+};
+
+static atomic_t nr_stack_id_events;
+static struct callchain_stack_ids *callchain_stack_ids;
+static siphash_key_t stack_id_key __read_mostly;
+
 
 __weak void perf_callchain_kernel(struct perf_callchain_entry_ctx *entry,
 				  struct pt_regs *regs)
@@ -229,6 +253,163 @@ get_perf_callchain(struct pt_regs *regs, u32 init_nr, bool kernel, bool user,
 	return entry;
 }
 
+static void release_stack_ids_rcu(struct rcu_head *head)
+{
+	struct callchain_stack_ids *ids;
+	int cpu;
+
+	ids = container_of(head, struct callchain_stack_ids, rcu_head);
+
+	for_each_possible_cpu(cpu)
+		kfree(ids->cpu_slots[cpu]);
+
+	kfree(ids);
+}
+
+static int alloc_stack_ids(void)
+{
+	struct callchain_stack_ids *ids;
+	int cpu;
+
+	/* Same as for the callchain buffers, these are accessed from NMI. */
+	ids = kzalloc(offsetof(struct callchain_stack_ids, cpu_slots[nr_cpu_ids]),
+		      GFP_KERNEL);
+	if (!ids)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		ids->cpu_slots[cpu] = kcalloc_node(STACK_ID_SLOTS,
+						   sizeof(struct stack_id_slot),
+						   GFP_KERNEL, cpu_to_node(cpu));
+		if (!ids->cpu_slots[cpu])
+			goto fail;
+	}
+
+	get_random_once(&stack_id_key, sizeof(stack_id_key));
+	rcu_assign_pointer(callchain_stack_ids, ids);
+
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu)
+		kfree(ids->cpu_slots[cpu]);
+	kfree(ids);
+
+	return -ENOMEM;
+}
+
+int get_callchain_stack_ids(void)
+{
+	int err = 0;
+
+	mutex_lock(&callchain_mutex);
+	if (atomic_inc_return(&nr_stack_id_events) == 1) {
+		err = alloc_stack_ids();
+		if (err)
+			atomic_dec(&nr_stack_id_events);
+	}
+	mutex_unlock(&callchain_mutex);
+
+	return err;
+}
+
+void put_callchain_stack_ids(void)
+{
+	struct callchain_stack_ids *ids;
+
+	if (atomic_dec_and_mutex_lock(&nr_stack_id_events, &callchain_mutex)) {
+		ids = callchain_stack_ids;
+		RCU_INIT_POINTER(callchain_stack_ids, NULL);
+		call_rcu(&ids->rcu_head, release_stack_ids_rcu);
+		mutex_unlock(&callchain_mutex);
+	}
+}
+
+static bool perf_callchain_emit_stack_id(struct perf_event *event, u64 id,
+					 struct perf_callchain_entry *entry)
+{
+	struct perf_output_handle handle;
+	struct perf_sample_data sample;
+	struct {
+		struct perf_event_header	header;
+		u64				id;
+		u64				nr;
+	} rec = {
+		.header = {
+			.type = PERF_RECORD_CALLCHAIN,
+			.misc = 0,
+			.size = sizeof(rec) + entry->nr * sizeof(u64),
+		},
+		.id = id,
+		.nr = entry->nr,
+	};
+
+	perf_event_header__init_id(&rec.header, &sample, event);
+
+	if (perf_output_begin(&handle, event, rec.header.size))
+		return false;
+
+	perf_output_put(&handle, rec);
+	perf_output_copy(&handle, entry->ip, entry->nr * sizeof(u64));
+	perf_event__output_id_sample(event, &handle, &sample);
+
+	perf_output_end(&handle);
+
+	return true;
+}
+
+/*
+ * Replace the callchain of a sample with its stack id. Unless this CPU
+ * already did so for the buffer the sample goes to, the id to callchain
+ * mapping is emitted first. Callchains that are no longer than the id
+ * reference itself, that go to an overwrite buffer, or whose mapping could
+ * not be emitted, are left as is.
+ */
+void perf_callchain_stack_id(struct perf_event *event,
+			     struct perf_callchain_entry *entry)
+{
+	/* Inherited events output to the parent's buffer. */
+	struct perf_event *output = event->parent ?: event;
+	struct callchain_stack_ids *ids;
+	struct stack_id_slot *slot;
+	struct perf_buffer *rb;
+	u64 id;
+
+	if (entry->nr <= 2)
+		return;
+
+	rcu_read_lock();
+	ids = rcu_dereference(callchain_stack_ids);
+	rb = rcu_dereference(output->rb);
+	if (unlikely(!ids || !rb))
+		goto out;
+
+	/* Wrapping would overwrite the mapping, which the slot can't tell. */
+	if (rb->overwrite)
+		goto out;
+
+	id = siphash(entry->ip, entry->nr * sizeof(u64), &stack_id_key);
+	slot = &ids->cpu_slots[smp_processor_id()][id & (STACK_ID_SLOTS - 1)];
+
+	/*
+	 * Emit before updating the slot: an NMI that finds the slot updated
+	 * must find the mapping in the buffer already. A torn or stale slot
+	 * only causes the mapping to be emitted again.
+	 */
+	if (READ_ONCE(slot->id) != id || READ_ONCE(slot->rb_gen) != rb->gen) {
+		if (!perf_callchain_emit_stack_id(event, id, entry))
+			goto out;
+		WRITE_ONCE(slot->id, id);
+		WRITE_ONCE(slot->rb_gen, rb->gen);
+	}
+
+	entry->ip[0] = PERF_CONTEXT_STACK_ID;
+	entry->ip[1] = id;
+	entry->nr = 2;
+out:
+	rcu_read_unlock();
+}
+
 /*
  * Used for sysctl_perf_event_max_stack and
  * sysctl_perf_event_max_contexts_per_stack.
@@ -41,6 +41,7 @@
 #include <linux/mm_types.h>
 #include <linux/module.h>
 #include <linux/mman.h>
+#include <linux/pfn_t.h>
 #include <linux/compat.h>
 #include <linux/bpf.h>
 #include <linux/filter.h>
@@ -4828,8 +4829,11 @@ static void _free_event(struct perf_event *event)
 		perf_detach_cgroup(event);
 
 	if (!event->parent) {
-		if (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN)
+		if (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN) {
 			put_callchain_buffers();
+			if (event->attr.stack_id)
+				put_callchain_stack_ids();
+		}
 	}
 
 	perf_event_free_bpf_prog(event);
@@ -5737,6 +5741,80 @@ void perf_event_update_userpage(struct perf_event *event)
 }
 EXPORT_SYMBOL_GPL(perf_event_update_userpage);
 
+/*
+ * Buffers with PMD mappable data pages are mapped VM_PFNMAP, so that their
+ * PMDs and PTEs don't take page references, which the split chunks could
+ * not give out consistently. The buffer, which the mapping pins, keeps the
+ * pages alive instead.
+ */
+static pgprot_t perf_mmap_prot(struct vm_area_struct *vma, pgoff_t pgoff)
+{
+	/* Only the user page is writable, see perf_mmap_fault(). */
+	if (pgoff)
+		return vm_get_page_prot(vma->vm_flags & ~VM_WRITE);
+	return vma->vm_page_prot;
+}
+
+static vm_fault_t perf_mmap_pfn_fault(struct vm_fault *vmf)
+{
+	struct perf_event *event = vmf->vma->vm_file->private_data;
+	vm_fault_t ret = VM_FAULT_SIGBUS;
+	struct perf_buffer *rb;
+	struct page *page;
+
+	if (vmf->pgoff && (vmf->flags & FAULT_FLAG_WRITE))
+		return ret;
+
+	/* Inserting may allocate page tables, so no rcu_read_lock() here. */
+	rb = ring_buffer_get(event);
+	if (!rb)
+		return ret;
+
+	page = perf_mmap_to_page(rb, vmf->pgoff);
+	if (page)
+		ret = vmf_insert_pfn_prot(vmf->vma, vmf->address,
+					  page_to_pfn(page),
+					  perf_mmap_prot(vmf->vma, vmf->pgoff));
+	ring_buffer_put(rb);
+
+	return ret;
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static vm_fault_t perf_mmap_huge_fault(struct vm_fault *vmf,
+				       enum page_entry_size pe_size)
+{
+	struct perf_event *event = vmf->vma->vm_file->private_data;
+	unsigned long haddr = vmf->address & PMD_MASK;
+	vm_fault_t ret = VM_FAULT_FALLBACK;
+	struct perf_buffer *rb;
+	struct page *page;
+	pgoff_t pgoff;
+
+	/* Data pages are never writable, let the 4K path refuse that. */
+	if (pe_size != PE_SIZE_PMD || (vmf->flags & FAULT_FLAG_WRITE))
+		return VM_FAULT_FALLBACK;
+
+	if (haddr < vmf->vma->vm_start || haddr + PMD_SIZE > vmf->vma->vm_end)
+		return VM_FAULT_FALLBACK;
+
+	pgoff = vmf->pgoff - ((vmf->address - haddr) >> PAGE_SHIFT);
+
+	rb = ring_buffer_get(event);
+	if (!rb)
+		return VM_FAULT_FALLBACK;
+
+	page = perf_mmap_to_huge_page(rb, pgoff);
+	if (page)
+		ret = vmf_insert_pfn_pmd_prot(vmf, page_to_pfn_t(page),
+					      perf_mmap_prot(vmf->vma, pgoff),
+					      false);
+	ring_buffer_put(rb);
+
+	return ret;
+}
+#endif
+
 static vm_fault_t perf_mmap_fault(struct vm_fault *vmf)
 {
 	struct perf_event *event = vmf->vma->vm_file->private_data;
@@ -5749,6 +5827,9 @@ static vm_fault_t perf_mmap_fault(struct vm_fault *vmf)
 		return ret;
 	}
 
+	if (vmf->vma->vm_flags & VM_PFNMAP)
+		return perf_mmap_pfn_fault(vmf);
+
 	rcu_read_lock();
 	rb = rcu_dereference(event->rb);
 	if (!rb)
@@ -5831,7 +5912,7 @@ static void ring_buffer_attach(struct perf_event *event,
 	}
 }
 
-static void ring_buffer_wakeup(struct perf_event *event)
+void ring_buffer_wakeup(struct perf_event *event)
 {
 	struct perf_buffer *rb;
 
@@ -6008,7 +6089,11 @@ static const struct vm_operations_struct perf_mmap_vmops = {
 	.open		= perf_mmap_open,
 	.close		= perf_mmap_close, /* non mergeable */
 	.fault		= perf_mmap_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.huge_fault	= perf_mmap_huge_fault,
+#endif
 	.page_mkwrite	= perf_mmap_fault,
+	.pfn_mkwrite	= perf_mmap_fault,
 };
 
 static int perf_mmap(struct file *file, struct vm_area_struct *vma)
@@ -6022,6 +6107,7 @@ static int perf_mmap(struct file *file, struct vm_area_struct *vma)
 	unsigned long nr_pages;
 	long user_extra = 0, extra = 0;
 	int ret = 0, flags = 0;
+	bool huge = false;
 
 	/*
 	 * Don't allow mmap() of inherited per-task counters. This would
@@ -6207,6 +6293,7 @@ static int perf_mmap(struct file *file, struct vm_area_struct *vma)
 		atomic64_add(extra, &vma->vm_mm->pinned_vm);
 
 		atomic_inc(&event->mmap_count);
+		huge = !vma->vm_pgoff && event->rb->huge_pages;
 	} else if (rb) {
 		atomic_dec(&rb->mmap_count);
 	}
@@ -6218,6 +6305,8 @@ static int perf_mmap(struct file *file, struct vm_area_struct *vma)
 	 * vma.
 	 */
 	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_DONTDUMP;
+	if (huge)
+		vma->vm_flags |= VM_PFNMAP | VM_HUGEPAGE;
 	vma->vm_ops = &perf_mmap_vmops;
 
 	if (event->pmu->event_mapped)
@@ -7040,6 +7129,9 @@ void perf_prepare_sample(struct perf_event_header *header,
 		if (!(sample_type & __PERF_SAMPLE_CALLCHAIN_EARLY))
 			data->callchain = perf_callchain(event, regs);
 
+		if (event->attr.stack_id)
+			perf_callchain_stack_id(event, data->callchain);
+
 		size += data->callchain->nr;
 
 		header->size += size * sizeof(u64);
@@ -11318,6 +11410,14 @@ perf_event_alloc(struct perf_event_attr *attr, int cpu,
 			err = get_callchain_buffers(attr->sample_max_stack);
 			if (err)
 				goto err_addr_filters;
+
+			if (attr->stack_id) {
+				err = get_callchain_stack_ids();
+				if (err) {
+					put_callchain_buffers();
+					goto err_addr_filters;
+				}
+			}
 		}
 	}
 
@@ -11332,8 +11432,11 @@ perf_event_alloc(struct perf_event_attr *attr, int cpu,
 
 err_callchain_buffer:
 	if (!event->parent) {
-		if (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN)
+		if (event->attr.sample_type & PERF_SAMPLE_CALLCHAIN) {
 			put_callchain_buffers();
+			if (event->attr.stack_id)
+				put_callchain_stack_ids();
+		}
 	}
 err_addr_filters:
 	kfree(event->addr_filter_ranges);
@@ -11462,6 +11565,15 @@ static int perf_copy_attr(struct perf_event_attr __user *uattr,
 		return -EINVAL;
 #endif
 
+	/*
+	 * Stack ids replace sampled callchains, and their mapping records
+	 * are only ever written forward.
+	 */
+	if (attr->stack_id &&
+	    (!(attr->sample_type & PERF_SAMPLE_CALLCHAIN) ||
+	     attr->write_backward))
+		return -EINVAL;
+
 out:
 	return ret;
 
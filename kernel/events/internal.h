@@ -18,7 +18,9 @@ struct perf_buffer {
 	int				page_order;	/* allocation order  */
 #endif
 	int				nr_pages;	/* nr of data pages  */
+	int				huge_pages;	/* of which PMD mappable */
 	int				overwrite;	/* can overwrite itself */
+	u64				gen;		/* unique buffer id  */
 	int				paused;		/* can write into ring buffer */
 
 	atomic_t			poll;		/* POLL_ for wakeups */
@@ -31,6 +33,12 @@ struct perf_buffer {
 
 	long				watermark;	/* wakeup watermark  */
 	long				aux_watermark;
+
+	/* coalesced wakeups, see perf_output_wakeup_batched() */
+	struct llist_node		wakeup_node;
+	atomic_t			wakeup_queued;
+	unsigned long			wakeup_head;	/* head at the last wakeup */
+
 	/* poll crap */
 	spinlock_t			event_lock;
 	struct list_head		event_list;
@@ -84,6 +92,7 @@ extern int rb_alloc_aux(struct perf_buffer *rb, struct perf_event *event,
 extern void rb_free_aux(struct perf_buffer *rb);
 extern struct perf_buffer *ring_buffer_get(struct perf_event *event);
 extern void ring_buffer_put(struct perf_buffer *rb);
+extern void ring_buffer_wakeup(struct perf_event *event);
 
 static inline bool rb_has_aux(struct perf_buffer *rb)
 {
@@ -95,6 +104,16 @@ void perf_event_aux_event(struct perf_event *event, unsigned long head,
 
 extern struct page *
 perf_mmap_to_page(struct perf_buffer *rb, unsigned long pgoff);
+#if defined(CONFIG_TRANSPARENT_HUGEPAGE) && !defined(CONFIG_PERF_USE_VMALLOC)
+extern struct page *
+perf_mmap_to_huge_page(struct perf_buffer *rb, unsigned long pgoff);
+#else
+static inline struct page *
+perf_mmap_to_huge_page(struct perf_buffer *rb, unsigned long pgoff)
+{
+	return NULL;
+}
+#endif
 
 #ifdef CONFIG_PERF_USE_VMALLOC
 /*
@@ -14,9 +14,42 @@
 #include <linux/circ_buf.h>
 #include <linux/poll.h>
 #include <linux/nospec.h>
+#include <linux/sysctl.h>
+#include <linux/hrtimer.h>
 
 #include "internal.h"
 
+/*
+ * Allocate the data pages of (non vmalloc) buffers as physically contiguous,
+ * PMD sized chunks where possible, so that perf_mmap() can map them with
+ * PMDs rather than one page at a time. That takes a mapping whose data part,
+ * one page past its start, is PMD aligned; any other is mapped with PTEs.
+ */
+static int sysctl_perf_event_huge_buffer __read_mostly;
+
+/*
+ * Coalesce data buffer wakeups of all events on a CPU into a single
+ * notification, issued once this many bytes have been written since the
+ * last one, or once the time limit below has passed. Zero disables it.
+ */
+static unsigned int sysctl_perf_event_wakeup_batch_bytes __read_mostly;
+static unsigned int sysctl_perf_event_wakeup_batch_us __read_mostly = 1000;
+
+struct perf_wakeup_batch {
+	struct llist_head	rbs;		/* buffers with a deferred wakeup */
+	local_t			bytes;		/* written since the last flush */
+	struct irq_work		work;		/* first buffer or byte limit */
+	struct hrtimer		timer;		/* time limit */
+};
+
+static void perf_wakeup_batch_work(struct irq_work *work);
+
+static DEFINE_PER_CPU(struct perf_wakeup_batch, perf_wakeup_batch) = {
+	.work = {
+		.func = perf_wakeup_batch_work,
+	},
+};
+
 static void perf_output_wakeup(struct perf_output_handle *handle)
 {
 	atomic_set(&handle->rb->poll, EPOLLIN);
@@ -25,6 +58,103 @@ static void perf_output_wakeup(struct perf_output_handle *handle)
 	irq_work_queue(&handle->event->pending);
 }
 
+static void perf_wakeup_batch_flush(struct perf_wakeup_batch *batch)
+{
+	struct perf_buffer *rb, *next;
+	struct perf_event *event;
+	struct llist_node *head;
+
+	local_set(&batch->bytes, 0);
+	head = llist_del_all(&batch->rbs);
+	llist_for_each_entry_safe(rb, next, head, wakeup_node) {
+		atomic_set(&rb->wakeup_queued, 0);
+
+		/* Wakes all the events attached to @rb. */
+		rcu_read_lock();
+		event = list_first_or_null_rcu(&rb->event_list,
+					       struct perf_event, rb_entry);
+		if (event)
+			ring_buffer_wakeup(event);
+		rcu_read_unlock();
+
+		ring_buffer_put(rb);
+	}
+}
+
+static enum hrtimer_restart perf_wakeup_batch_timer(struct hrtimer *timer)
+{
+	struct perf_wakeup_batch *batch;
+
+	batch = container_of(timer, struct perf_wakeup_batch, timer);
+	perf_wakeup_batch_flush(batch);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Runs once for the first deferred wakeup of a batch, to arm the time
+ * limit, and once more if the byte limit is reached before it expires.
+ */
+static void perf_wakeup_batch_work(struct irq_work *work)
+{
+	struct perf_wakeup_batch *batch;
+	unsigned int us;
+
+	batch = container_of(work, struct perf_wakeup_batch, work);
+	if (llist_empty(&batch->rbs))
+		return;
+
+	if (local_read(&batch->bytes) >= READ_ONCE(sysctl_perf_event_wakeup_batch_bytes)) {
+		hrtimer_try_to_cancel(&batch->timer);
+		perf_wakeup_batch_flush(batch);
+		return;
+	}
+
+	if (!hrtimer_active(&batch->timer)) {
+		us = READ_ONCE(sysctl_perf_event_wakeup_batch_us);
+		hrtimer_start(&batch->timer, ns_to_ktime((u64)us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL_PINNED_HARD);
+	}
+}
+
+/*
+ * Instead of notifying the consumer of every buffer that crossed its
+ * watermark right away, collect the buffers on a per-CPU list and wake
+ * them all at once when the byte or time limit is reached.
+ */
+static void perf_output_wakeup_batched(struct perf_output_handle *handle,
+				       unsigned long head)
+{
+	unsigned int limit = READ_ONCE(sysctl_perf_event_wakeup_batch_bytes);
+	struct perf_buffer *rb = handle->rb;
+	struct perf_wakeup_batch *batch;
+	unsigned long bytes;
+	bool first = false;
+
+	if (!limit || is_write_backward(handle->event)) {
+		perf_output_wakeup(handle);
+		return;
+	}
+
+	atomic_set(&rb->poll, EPOLLIN);
+
+	batch = this_cpu_ptr(&perf_wakeup_batch);
+	bytes = head - rb->wakeup_head;
+	rb->wakeup_head = head;
+
+	if (!atomic_xchg(&rb->wakeup_queued, 1)) {
+		/* Pinned until perf_wakeup_batch_flush() has woken it. */
+		if (!refcount_inc_not_zero(&rb->refcount)) {
+			atomic_set(&rb->wakeup_queued, 0);
+			return;
+		}
+		first = llist_add(&rb->wakeup_node, &batch->rbs);
+	}
+
+	if (local_add_return(bytes, &batch->bytes) >= limit || first)
+		irq_work_queue(&batch->work);
+}
+
 /*
  * We need to ensure a later event_id doesn't publish a head when a former
  * event isn't done writing. However since we need to deal with NMIs we
@@ -128,7 +258,7 @@ static void perf_output_put_handle(struct perf_output_handle *handle)
 	}
 
 	if (handle->wakeup != local_read(&rb->wakeup))
-		perf_output_wakeup(handle);
+		perf_output_wakeup_batched(handle, head);
 
 out:
 	preempt_enable();
@@ -300,11 +430,16 @@ void perf_output_end(struct perf_output_handle *handle)
 	rcu_read_unlock();
 }
 
+/* Never reused, unlike buffer addresses; see perf_callchain_stack_id() */
+static atomic64_t perf_buffer_gen;
+
 static void
 ring_buffer_init(struct perf_buffer *rb, long watermark, int flags)
 {
 	long max_size = perf_data_size(rb);
 
+	rb->gen = atomic64_inc_return(&perf_buffer_gen);
+
 	if (watermark)
 		rb->watermark = min(max_size, watermark);
 
@@ -798,6 +933,59 @@ static void perf_mmap_free_page(void *addr)
 	__free_page(page);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Fill the data pages from PMD sized allocations for as long as they
+ * succeed. They are split into order-0 pages, so that the 4K fault path
+ * and rb_free() work as for single pages, but stay naturally aligned so
+ * that perf_mmap_huge_fault() can map each chunk with a single PMD.
+ *
+ * Returns the number of data pages allocated.
+ */
+static int perf_mmap_alloc_huge(struct perf_buffer *rb, int nr_pages, int cpu)
+{
+	struct page *page;
+	int i = 0, j, node;
+
+	if (HPAGE_PMD_ORDER >= MAX_ORDER)
+		return 0;
+
+	node = (cpu == -1) ? cpu : cpu_to_node(cpu);
+
+	while (nr_pages - i >= HPAGE_PMD_NR) {
+		page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO |
+					__GFP_NORETRY | __GFP_NOWARN,
+					HPAGE_PMD_ORDER);
+		if (!page)
+			break;
+
+		split_page(page, HPAGE_PMD_ORDER);
+		for (j = 0; j < HPAGE_PMD_NR; j++)
+			rb->data_pages[i++] = page_address(page + j);
+	}
+
+	return i;
+}
+
+/*
+ * Return the first page of the PMD sized chunk of data pages that starts
+ * at @pgoff, or NULL if @pgoff is not the start of one.
+ */
+struct page *perf_mmap_to_huge_page(struct perf_buffer *rb, unsigned long pgoff)
+{
+	if (!pgoff || !IS_ALIGNED(pgoff - 1, HPAGE_PMD_NR) ||
+	    pgoff - 1 + HPAGE_PMD_NR > rb->huge_pages)
+		return NULL;
+
+	return virt_to_page(rb->data_pages[pgoff - 1]);
+}
+#else
+static int perf_mmap_alloc_huge(struct perf_buffer *rb, int nr_pages, int cpu)
+{
+	return 0;
+}
+#endif
+
 struct perf_buffer *rb_alloc(int nr_pages, long watermark, int cpu, int flags)
 {
 	struct perf_buffer *rb;
@@ -818,7 +1006,12 @@ struct perf_buffer *rb_alloc(int nr_pages, long watermark, int cpu, int flags)
 	if (!rb->user_page)
 		goto fail_user_page;
 
-	for (i = 0; i < nr_pages; i++) {
+	i = 0;
+	if (READ_ONCE(sysctl_perf_event_huge_buffer))
+		i = perf_mmap_alloc_huge(rb, nr_pages, cpu);
+	rb->huge_pages = i;
+
+	for (; i < nr_pages; i++) {
 		rb->data_pages[i] = perf_mmap_alloc_page(cpu);
 		if (!rb->data_pages[i])
 			goto fail_data_pages;
@@ -955,3 +1148,48 @@ perf_mmap_to_page(struct perf_buffer *rb, unsigned long pgoff)
 
 	return __perf_mmap_to_page(rb, pgoff);
 }
+
+static struct ctl_table perf_rb_sysctl_table[] = {
+	{
+		.procname	= "perf_event_huge_buffer",
+		.data		= &sysctl_perf_event_huge_buffer,
+		.maxlen		= sizeof(sysctl_perf_event_huge_buffer),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "perf_event_wakeup_batch_bytes",
+		.data		= &sysctl_perf_event_wakeup_batch_bytes,
+		.maxlen		= sizeof(sysctl_perf_event_wakeup_batch_bytes),
+		.mode		= 0644,
+		.proc_handler	= proc_douintvec,
+	},
+	{
+		.procname	= "perf_event_wakeup_batch_us",
+		.data		= &sysctl_perf_event_wakeup_batch_us,
+		.maxlen		= sizeof(sysctl_perf_event_wakeup_batch_us),
+		.mode		= 0644,
+		.proc_handler	= proc_douintvec_minmax,
+		.extra1		= SYSCTL_ONE,
+	},
+	{ }
+};
+
+static int __init perf_rb_init(void)
+{
+	struct perf_wakeup_batch *batch;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		batch = per_cpu_ptr(&perf_wakeup_batch, cpu);
+		hrtimer_init(&batch->timer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_REL_PINNED_HARD);
+		batch->timer.function = perf_wakeup_batch_timer;
+	}
+
+	register_sysctl("kernel", perf_rb_sysctl_table);
+	return 0;
+}
+device_initcall(perf_rb_init);
@@ -9,6 +9,7 @@
 #define pr_fmt(fmt) "genirq: " fmt
 
 #include <linux/irq.h>
+#include <linux/cpu.h>
 #include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/random.h>
@@ -386,6 +387,39 @@ int __irq_set_affinity(unsigned int irq, const struct cpumask *mask, bool force)
 	return ret;
 }
 
+/**
+ * irq_affinity_housekeeping_update - Reapply the affinity of managed interrupts
+ *
+ * Called when the housekeeping CPUs changed at runtime, so that started
+ * managed interrupts are steered away from newly isolated CPUs or back
+ * to the CPUs which became housekeeping ones again.
+ *
+ * Must be called with the CPU hotplug lock held for read.
+ */
+void irq_affinity_housekeeping_update(void)
+{
+	struct irq_desc *desc;
+	unsigned int irq;
+
+	lockdep_assert_cpus_held();
+
+	irq_lock_sparse();
+	for_each_active_irq(irq) {
+		struct irq_data *data;
+
+		desc = irq_to_desc(irq);
+		raw_spin_lock_irq(&desc->lock);
+		data = irq_desc_get_irq_data(desc);
+		if (irqd_affinity_is_managed(data) && desc->action &&
+		    !irqd_is_managed_and_shutdown(data))
+			irq_set_affinity_locked(data,
+						irq_data_get_affinity_mask(data),
+						false);
+		raw_spin_unlock_irq(&desc->lock);
+	}
+	irq_unlock_sparse();
+}
+
 int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m)
 {
 	unsigned long flags;
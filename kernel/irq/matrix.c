@@ -7,14 +7,22 @@
 #include <linux/percpu.h>
 #include <linux/cpu.h>
 #include <linux/irq.h>
+#include <linux/kernel_stat.h>
 
 #define IRQ_MATRIX_SIZE	(BITS_TO_LONGS(IRQ_MATRIX_BITS))
 
+/* Interval at which the per CPU interrupt rate is resampled */
+#define MATRIX_LOAD_PERIOD	(HZ / 10)
+
 struct cpumap {
 	unsigned int		available;
 	unsigned int		allocated;
 	unsigned int		managed;
 	unsigned int		managed_allocated;
+	unsigned int		load_rate;
+	unsigned int		load_irqs;
+	unsigned int		load_allocated;
+	unsigned long		load_stamp;
 	bool			initialized;
 	bool			online;
 	unsigned long		alloc_map[IRQ_MATRIX_SIZE];
@@ -39,6 +47,20 @@ struct irq_matrix {
 #define CREATE_TRACE_POINTS
 #include <trace/events/irq_matrix.h>
 
+static bool matrix_spread_load __read_mostly;
+
+static int __init irq_spread_setup(char *str)
+{
+	if (!strcmp(str, "load"))
+		matrix_spread_load = true;
+	else if (!strcmp(str, "count"))
+		matrix_spread_load = false;
+	else
+		return 0;
+	return 1;
+}
+__setup("irqspread=", irq_spread_setup);
+
 /**
  * irq_alloc_matrix - Allocate a irq_matrix structure and initialize it
  * @matrix_bits:	Number of matrix bits must be <= IRQ_MATRIX_BITS
@@ -86,6 +108,11 @@ void irq_matrix_online(struct irq_matrix *m)
 		cm->available -= cm->managed + m->systembits_inalloc;
 		cm->initialized = true;
 	}
+	/* Start the interrupt rate sampling from here */
+	cm->load_irqs = kstat_cpu_irqs_sum(smp_processor_id());
+	cm->load_allocated = cm->allocated;
+	cm->load_stamp = jiffies;
+
 	m->global_available += cm->available;
 	cm->online = true;
 	m->online_maps++;
@@ -125,11 +152,61 @@ static unsigned int matrix_alloc_area(struct irq_matrix *m, struct cpumap *cm,
 	return area;
 }
 
-/* Find the best CPU which has the lowest vector allocation count */
+/*
+ * Resample the interrupt rate of a CPU from the interrupt statistics, at
+ * most every MATRIX_LOAD_PERIOD, and average it with the previous one so
+ * that short bursts do not dominate. The debugfs reader samples without
+ * holding the vector lock; racing with an allocation can at worst skew a
+ * single sample.
+ */
+static unsigned int matrix_sample_load(struct cpumap *cm, unsigned int cpu)
+{
+	unsigned long stamp = READ_ONCE(cm->load_stamp);
+	unsigned long now = jiffies;
+	unsigned int irqs, rate;
+
+	if (now - stamp >= MATRIX_LOAD_PERIOD) {
+		irqs = kstat_cpu_irqs_sum(cpu);
+		rate = min_t(u64, div64_ul((u64)(irqs - READ_ONCE(cm->load_irqs)) * HZ,
+					   now - stamp), UINT_MAX);
+		WRITE_ONCE(cm->load_rate, (READ_ONCE(cm->load_rate) + rate) / 2);
+		WRITE_ONCE(cm->load_irqs, irqs);
+		WRITE_ONCE(cm->load_allocated, cm->allocated);
+		WRITE_ONCE(cm->load_stamp, now);
+	}
+	return READ_ONCE(cm->load_rate);
+}
+
+/*
+ * Return the load class of a CPU with irqspread=load, 0 otherwise. The
+ * class is the order of magnitude of the interrupt rate, so CPUs with
+ * comparable load are still balanced by vector count. The rate cannot
+ * reflect the vectors placed since it was sampled yet, so each of them
+ * raises the class by one. Otherwise a burst of allocations, e.g. the
+ * MSI-X vectors of a device being probed, would all land on the CPU that
+ * was the least loaded one at the last sample.
+ */
+static unsigned int matrix_load_class(struct cpumap *cm, unsigned int cpu)
+{
+	unsigned int class;
+
+	if (!matrix_spread_load)
+		return 0;
+
+	class = ilog2(matrix_sample_load(cm, cpu) + 1);
+	if (cm->allocated > cm->load_allocated)
+		class += cm->allocated - cm->load_allocated;
+	return class;
+}
+
+/*
+ * Find the best CPU which has the lowest vector allocation count, among
+ * the ones in the lowest load class.
+ */
 static unsigned int matrix_find_best_cpu(struct irq_matrix *m,
 					const struct cpumask *msk)
 {
-	unsigned int cpu, best_cpu, maxavl = 0;
+	unsigned int cpu, best_cpu, maxavl = 0, minload = UINT_MAX, load;
 	struct cpumap *cm;
 
 	best_cpu = UINT_MAX;
@@ -137,20 +214,28 @@ static unsigned int matrix_find_best_cpu(struct irq_matrix *m,
 	for_each_cpu(cpu, msk) {
 		cm = per_cpu_ptr(m->maps, cpu);
 
-		if (!cm->online || cm->available <= maxavl)
+		if (!cm->online || !cm->available)
+			continue;
+
+		load = matrix_load_class(cm, cpu);
+		if (load > minload || (load == minload && cm->available <= maxavl))
 			continue;
 
 		best_cpu = cpu;
 		maxavl = cm->available;
+		minload = load;
 	}
 	return best_cpu;
 }
 
-/* Find the best CPU which has the lowest number of managed IRQs allocated */
+/*
+ * Find the best CPU which has the lowest number of managed IRQs allocated,
+ * among the ones in the lowest load class.
+ */
 static unsigned int matrix_find_best_cpu_managed(struct irq_matrix *m,
 						const struct cpumask *msk)
 {
-	unsigned int cpu, best_cpu, allocated = UINT_MAX;
+	unsigned int cpu, best_cpu, allocated = UINT_MAX, minload = UINT_MAX, load;
 	struct cpumap *cm;
 
 	best_cpu = UINT_MAX;
@@ -158,11 +243,17 @@ static unsigned int matrix_find_best_cpu_managed(struct irq_matrix *m,
 	for_each_cpu(cpu, msk) {
 		cm = per_cpu_ptr(m->maps, cpu);
 
-		if (!cm->online || cm->managed_allocated > allocated)
+		if (!cm->online)
+			continue;
+
+		load = matrix_load_class(cm, cpu);
+		if (load > minload ||
+		    (load == minload && cm->managed_allocated > allocated))
 			continue;
 
 		best_cpu = cpu;
 		allocated = cm->managed_allocated;
+		minload = load;
 	}
 	return best_cpu;
 }
@@ -496,14 +587,18 @@ void irq_matrix_debug_show(struct seq_file *sf, struct irq_matrix *m, int ind)
 	seq_printf(sf, "Total allocated:  %6u\n", m->total_allocated);
 	seq_printf(sf, "System: %u: %*pbl\n", nsys, m->matrix_bits,
 		   m->system_map);
-	seq_printf(sf, "%*s| CPU | avl | man | mac | act | vectors\n", ind, " ");
+	seq_printf(sf, "Spread by:        %s\n",
+		   matrix_spread_load ? "load" : "count");
+	seq_printf(sf, "%*s| CPU | avl | man | mac | act |  irq/s | vectors\n",
+		   ind, " ");
 	cpus_read_lock();
 	for_each_online_cpu(cpu) {
 		struct cpumap *cm = per_cpu_ptr(m->maps, cpu);
 
-		seq_printf(sf, "%*s %4d  %4u  %4u  %4u %4u  %*pbl\n", ind, " ",
+		seq_printf(sf, "%*s %4d  %4u  %4u  %4u %4u  %7u  %*pbl\n", ind, " ",
 			   cpu, cm->available, cm->managed,
 			   cm->managed_allocated, cm->allocated,
+			   matrix_sample_load(cm, cpu),
 			   m->matrix_bits, cm->alloc_map);
 	}
 	cpus_read_unlock();
@@ -6,6 +6,7 @@
 #include <linux/bug.h>
 #include <linux/delay.h>
 #include <linux/export.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
@@ -25,6 +26,10 @@ unsigned int kcsan_udelay_task = CONFIG_KCSAN_UDELAY_TASK;
 unsigned int kcsan_udelay_interrupt = CONFIG_KCSAN_UDELAY_INTERRUPT;
 static long kcsan_skip_watch = CONFIG_KCSAN_SKIP_WATCH;
 static bool kcsan_interrupt_watcher = IS_ENABLED(CONFIG_KCSAN_INTERRUPT_WATCHER);
+static bool kcsan_soak;
+static long kcsan_soak_skip_watch = CONFIG_KCSAN_SKIP_WATCH * 10;
+static unsigned int kcsan_soak_udelay = 1;
+static unsigned int kcsan_soak_site_limit = 64;
 
 #ifdef MODULE_PARAM_PREFIX
 #undef MODULE_PARAM_PREFIX
@@ -35,6 +40,10 @@ module_param_named(udelay_task, kcsan_udelay_task, uint, 0644);
 module_param_named(udelay_interrupt, kcsan_udelay_interrupt, uint, 0644);
 module_param_named(skip_watch, kcsan_skip_watch, long, 0644);
 module_param_named(interrupt_watcher, kcsan_interrupt_watcher, bool, 0444);
+module_param_named(soak, kcsan_soak, bool, 0644);
+module_param_named(soak_skip_watch, kcsan_soak_skip_watch, long, 0644);
+module_param_named(soak_udelay, kcsan_soak_udelay, uint, 0644);
+module_param_named(soak_site_limit, kcsan_soak_site_limit, uint, 0644);
 
 bool kcsan_enabled;
 
@@ -103,6 +112,14 @@ static DEFINE_PER_CPU(long, kcsan_skip);
 /* For kcsan_prandom_u32_max(). */
 static DEFINE_PER_CPU(struct rnd_state, kcsan_rand_state);
 
+/*
+ * Per access site statistics for soak mode, indexed by a hash of the
+ * instruction pointer with linear probing. Entries are claimed with cmpxchg and
+ * never released.
+ */
+struct kcsan_site kcsan_sites[KCSAN_NUM_SITES];
+#define KCSAN_SITES_PROBE 8
+
 static __always_inline atomic_long_t *find_watchpoint(unsigned long addr,
 						      size_t size,
 						      bool expect_write,
@@ -293,13 +310,56 @@ static u32 kcsan_prandom_u32_max(u32 ep_ro)
 
 static inline void reset_kcsan_skip(void)
 {
-	long skip_count = kcsan_skip_watch -
+	long skip_watch = READ_ONCE(kcsan_soak) ? kcsan_soak_skip_watch :
+						  kcsan_skip_watch;
+	long skip_count = skip_watch -
 			  (IS_ENABLED(CONFIG_KCSAN_SKIP_WATCH_RANDOMIZE) ?
-				   kcsan_prandom_u32_max(kcsan_skip_watch) :
+				   kcsan_prandom_u32_max(skip_watch) :
 				   0);
 	this_cpu_write(kcsan_skip, skip_count);
 }
 
+static struct kcsan_site *kcsan_get_site(unsigned long ip)
+{
+	const unsigned long slot = hash_long(ip, KCSAN_SITES_BITS);
+	struct kcsan_site *site;
+	unsigned long cur;
+	int i;
+
+	for (i = 0; i < KCSAN_SITES_PROBE; ++i) {
+		site = &kcsan_sites[(slot + i) & (KCSAN_NUM_SITES - 1)];
+		cur = READ_ONCE(site->ip);
+		if (!cur)
+			cur = cmpxchg_relaxed(&site->ip, 0, ip) ?: ip;
+		if (cur == ip)
+			return site;
+	}
+
+	atomic_long_inc(&kcsan_counters[KCSAN_COUNTER_SITES_OVERFLOW]);
+	return NULL;
+}
+
+/*
+ * Adaptive per-site backoff for soak mode: once a site was due for a
+ * watchpoint soak_site_limit times, it is only watched with probability
+ * soak_site_limit / (times due), so that hot sites do not use up the
+ * watchpoints and stall throughput. Returns true if the access should not be
+ * watched.
+ */
+static bool kcsan_site_backoff(struct kcsan_site *site)
+{
+	const unsigned int limit = READ_ONCE(kcsan_soak_site_limit);
+	const unsigned long due = atomic_long_inc_return(&site->due);
+
+	if (!limit || due <= limit)
+		return false;
+	if (kcsan_prandom_u32_max(min_t(unsigned long, due, U32_MAX)) < limit)
+		return false;
+
+	atomic_long_inc(&site->skipped);
+	return true;
+}
+
 static __always_inline bool kcsan_is_enabled(void)
 {
 	return READ_ONCE(kcsan_enabled) && get_ctx()->disable_count == 0;
@@ -308,7 +368,8 @@ static __always_inline bool kcsan_is_enabled(void)
 /* Introduce delay depending on context and configuration. */
 static void delay_access(int type)
 {
-	unsigned int delay = in_task() ? kcsan_udelay_task : kcsan_udelay_interrupt;
+	unsigned int delay = READ_ONCE(kcsan_soak) ? kcsan_soak_udelay :
+			     in_task() ? kcsan_udelay_task : kcsan_udelay_interrupt;
 	/* For certain access types, skew the random delay to be longer. */
 	unsigned int skew_delay_order =
 		(type & (KCSAN_ACCESS_COMPOUND | KCSAN_ACCESS_ASSERT)) ? 1 : 0;
@@ -401,10 +462,12 @@ static noinline void kcsan_found_watchpoint(const volatile void *ptr,
 }
 
 static noinline void
-kcsan_setup_watchpoint(const volatile void *ptr, size_t size, int type)
+kcsan_setup_watchpoint(const volatile void *ptr, size_t size, int type,
+		       unsigned long ip)
 {
 	const bool is_write = (type & KCSAN_ACCESS_WRITE) != 0;
 	const bool is_assert = (type & KCSAN_ACCESS_ASSERT) != 0;
+	struct kcsan_site *site = NULL;
 	atomic_long_t *watchpoint;
 	union {
 		u8 _1;
@@ -426,6 +489,12 @@ kcsan_setup_watchpoint(const volatile void *ptr, size_t size, int type)
 	if (!kcsan_is_enabled())
 		goto out;
 
+	if (READ_ONCE(kcsan_soak)) {
+		site = kcsan_get_site(ip);
+		if (site && kcsan_site_backoff(site))
+			goto out;
+	}
+
 	/*
 	 * Special atomic rules: unlikely to be true, so we check them here in
 	 * the slow-path, and not in the fast-path in is_atomic(). Call after
@@ -462,6 +531,8 @@ kcsan_setup_watchpoint(const volatile void *ptr, size_t size, int type)
 
 	atomic_long_inc(&kcsan_counters[KCSAN_COUNTER_SETUP_WATCHPOINTS]);
 	atomic_long_inc(&kcsan_counters[KCSAN_COUNTER_USED_WATCHPOINTS]);
+	if (site)
+		atomic_long_inc(&site->setup);
 
 	/*
 	 * Read the current value, to later check and infer a race if the data
@@ -536,6 +607,9 @@ kcsan_setup_watchpoint(const volatile void *ptr, size_t size, int type)
 
 	/* Check if this access raced with another. */
 	if (!consume_watchpoint(watchpoint)) {
+		if (site)
+			atomic_long_inc(&site->consumed);
+
 		/*
 		 * Depending on the access type, map a value_change of MAYBE to
 		 * TRUE (always report) or FALSE (never report).
@@ -628,8 +702,12 @@ static __always_inline void check_access(const volatile void *ptr, size_t size,
 	else {
 		struct kcsan_ctx *ctx = get_ctx(); /* Call only once in fast-path. */
 
+		/*
+		 * check_access() is always inlined, so _RET_IP_ is the
+		 * instrumented access site.
+		 */
 		if (unlikely(should_watch(ptr, size, type, ctx)))
-			kcsan_setup_watchpoint(ptr, size, type);
+			kcsan_setup_watchpoint(ptr, size, type, _RET_IP_);
 		else if (unlikely(ctx->scoped_accesses.prev))
 			kcsan_check_scoped_accesses();
 	}
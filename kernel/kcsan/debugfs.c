@@ -28,6 +28,7 @@ static const char *const counter_names[] = {
 	[KCSAN_COUNTER_RACES_UNKNOWN_ORIGIN]		= "races_unknown_origin",
 	[KCSAN_COUNTER_UNENCODABLE_ACCESSES]		= "unencodable_accesses",
 	[KCSAN_COUNTER_ENCODING_FALSE_POSITIVES]	= "encoding_false_positives",
+	[KCSAN_COUNTER_SITES_OVERFLOW]			= "sites_overflow",
 };
 static_assert(ARRAY_SIZE(counter_names) == KCSAN_COUNTER_COUNT);
 
@@ -261,7 +262,44 @@ static const struct file_operations debugfs_ops =
 	.release = single_release
 };
 
+static int show_sites(struct seq_file *file, void *v)
+{
+	struct kcsan_site *site;
+	unsigned long ip;
+	int i;
+
+	seq_printf(file, "%-48s %12s %12s %12s %12s\n",
+		   "site", "due", "setup", "consumed", "skipped");
+	for (i = 0; i < KCSAN_NUM_SITES; ++i) {
+		site = &kcsan_sites[i];
+		ip = READ_ONCE(site->ip);
+		if (!ip)
+			continue;
+		seq_printf(file, "%-48pS %12ld %12ld %12ld %12ld\n", (void *)ip,
+			   atomic_long_read(&site->due),
+			   atomic_long_read(&site->setup),
+			   atomic_long_read(&site->consumed),
+			   atomic_long_read(&site->skipped));
+	}
+
+	return 0;
+}
+
+static int debugfs_sites_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, show_sites, NULL);
+}
+
+static const struct file_operations debugfs_sites_ops =
+{
+	.read	 = seq_read,
+	.open	 = debugfs_sites_open,
+	.llseek	 = seq_lseek,
+	.release = single_release
+};
+
 void __init kcsan_debugfs_init(void)
 {
 	debugfs_create_file("kcsan", 0644, NULL, NULL, &debugfs_ops);
+	debugfs_create_file("kcsan_sites", 0444, NULL, NULL, &debugfs_sites_ops);
 }
@@ -89,10 +89,31 @@ enum kcsan_counter_id {
 	 */
 	KCSAN_COUNTER_ENCODING_FALSE_POSITIVES,
 
+	/*
+	 * Soak mode could not track an access site, as its slots in the site
+	 * table were taken.
+	 */
+	KCSAN_COUNTER_SITES_OVERFLOW,
+
 	KCSAN_COUNTER_COUNT, /* number of counters */
 };
 extern atomic_long_t kcsan_counters[KCSAN_COUNTER_COUNT];
 
+/*
+ * Per access site statistics, collected in soak mode.
+ */
+struct kcsan_site {
+	unsigned long	ip;		/* access site, 0 if unused */
+	atomic_long_t	due;		/* times a watchpoint was due */
+	atomic_long_t	setup;		/* watchpoints set up */
+	atomic_long_t	consumed;	/* watchpoints consumed by a racing access */
+	atomic_long_t	skipped;	/* watchpoints skipped due to backoff */
+};
+
+#define KCSAN_SITES_BITS 10
+#define KCSAN_NUM_SITES (1 << KCSAN_SITES_BITS)
+extern struct kcsan_site kcsan_sites[KCSAN_NUM_SITES];
+
 /*
  * Returns true if data races in the function symbol that maps to func_addr
  * (offsets are ignored) should *not* be reported.
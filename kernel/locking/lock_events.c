@@ -17,8 +17,13 @@
  * Collect locking event counts
  */
 #include <linux/debugfs.h>
+#include <linux/hash.h>
+#include <linux/seq_file.h>
 #include <linux/sched.h>
 #include <linux/sched/clock.h>
+#include <linux/sched/debug.h>
+#include <linux/spinlock.h>
+#include <linux/stacktrace.h>
 #include <linux/fs.h>
 
 #include "lock_events.h"
@@ -115,6 +120,229 @@ static const struct file_operations fops_lockevent = {
 	.llseek = default_llseek,
 };
 
+/*
+ * Lock wait-time histograms
+ *
+ * When enabled, the mutex, rwsem and qspinlock slowpaths record how long
+ * it took them to acquire the lock, in log2(ns) buckets, against the call
+ * site of the lock function (see lock_wait_site()). The result is shown
+ * in <debugfs>/lock_event_counts/.lock_wait_hist, writing to which resets
+ * the histograms; <debugfs>/lock_event_counts/.lock_wait_enable turns the
+ * recording on and off, as does the "lock_wait_hist" boot parameter.
+ *
+ * Recording is lock-free: call sites are hashed into a fixed size table
+ * and the buckets are plain atomics, so that it can be used from within
+ * the spinlock slowpath, NMIs included. Samples for which no table slot
+ * can be found are only counted as dropped.
+ */
+#define LOCK_WAIT_HASH_BITS	9
+#define LOCK_WAIT_SITES		(1 << LOCK_WAIT_HASH_BITS)
+#define LOCK_WAIT_PROBES	8
+#define LOCK_WAIT_BUCKETS	32	/* [2^i, 2^(i+1)) ns, last one open */
+#define LOCK_WAIT_STACK_DEPTH	8
+
+struct lock_wait_site {
+	unsigned long	ip;
+	unsigned int	type;
+	atomic_t	buckets[LOCK_WAIT_BUCKETS];
+	atomic64_t	total_ns;
+};
+
+static const char * const lock_wait_names[lockwait_num] = {
+	[LOCKWAIT_qspinlock]	= "qspinlock",
+	[LOCKWAIT_mutex]	= "mutex",
+	[LOCKWAIT_rwsem_read]	= "rwsem_read",
+	[LOCKWAIT_rwsem_write]	= "rwsem_write",
+};
+
+static struct lock_wait_site lock_wait_sites[LOCK_WAIT_SITES];
+static atomic_long_t lock_wait_dropped;
+static bool lock_wait_boot_enable __initdata;
+
+DEFINE_STATIC_KEY_FALSE(lockevent_wait_key);
+
+static int __init lock_wait_hist_setup(char *str)
+{
+	lock_wait_boot_enable = true;
+	return 1;
+}
+__setup("lock_wait_hist", lock_wait_hist_setup);
+
+/*
+ * The call site is the first return address past the lock functions
+ * proper: the spinlock API lives in the lock text section, the sleeping
+ * locks in the sched one. Should the lock function have been inlined
+ * into its caller, take the caller of the slowpath instead.
+ */
+static unsigned long lock_wait_site(void)
+{
+#ifdef CONFIG_STACKTRACE
+	unsigned long entries[LOCK_WAIT_STACK_DEPTH];
+	unsigned int i, nr;
+	bool in_lock = false;
+
+	nr = stack_trace_save(entries, ARRAY_SIZE(entries), 0);
+	for (i = 0; i < nr; i++) {
+		if (in_lock_functions(entries[i]) ||
+		    in_sched_functions(entries[i]))
+			in_lock = true;
+		else if (in_lock)
+			return entries[i];
+	}
+
+	/* entries[0] is us, entries[1] is the slowpath */
+	if (nr > 2)
+		return entries[2];
+#endif
+	return _RET_IP_;
+}
+
+void __lockevent_wait_begin(struct lockevent_wait *lw)
+{
+	lw->site = lock_wait_site();
+	lw->start = local_clock();
+}
+
+static struct lock_wait_site *lock_wait_find(unsigned long ip,
+					     enum lock_wait_types type)
+{
+	unsigned long hash = hash_long(ip, LOCK_WAIT_HASH_BITS);
+	int i;
+
+	for (i = 0; i < LOCK_WAIT_PROBES; i++) {
+		struct lock_wait_site *site;
+		unsigned long old;
+
+		site = &lock_wait_sites[(hash + i) & (LOCK_WAIT_SITES - 1)];
+		old = READ_ONCE(site->ip);
+		if (old == ip)
+			return site;
+		if (old)
+			continue;
+
+		old = cmpxchg(&site->ip, 0, ip);
+		if (!old) {
+			WRITE_ONCE(site->type, type);
+			return site;
+		}
+		if (old == ip)
+			return site;
+	}
+
+	return NULL;
+}
+
+void __lockevent_wait_end(struct lockevent_wait *lw, enum lock_wait_types type)
+{
+	u64 delta = local_clock() - lw->start;
+	struct lock_wait_site *site;
+	int bucket;
+
+	site = lock_wait_find(lw->site, type);
+	if (!site) {
+		atomic_long_inc(&lock_wait_dropped);
+		return;
+	}
+
+	bucket = delta ? min(ilog2(delta), LOCK_WAIT_BUCKETS - 1) : 0;
+	atomic_inc(&site->buckets[bucket]);
+	atomic64_add(delta, &site->total_ns);
+}
+
+static int lock_wait_hist_show(struct seq_file *m, void *v)
+{
+	int i, j;
+
+	seq_printf(m, "# enabled: %d dropped: %lu\n",
+		   static_key_enabled(&lockevent_wait_key),
+		   atomic_long_read(&lock_wait_dropped));
+	seq_puts(m, "# <type> <call site> <samples> <avg_ns>, then per bucket <lower bound ns>: <samples>\n");
+
+	for (i = 0; i < LOCK_WAIT_SITES; i++) {
+		struct lock_wait_site *site = &lock_wait_sites[i];
+		unsigned int type = READ_ONCE(site->type);
+		unsigned long ip = READ_ONCE(site->ip);
+		unsigned long samples = 0;
+
+		if (!ip || type >= lockwait_num)
+			continue;
+
+		for (j = 0; j < LOCK_WAIT_BUCKETS; j++)
+			samples += atomic_read(&site->buckets[j]);
+		if (!samples)
+			continue;
+
+		seq_printf(m, "%-11s %pS %lu %llu\n", lock_wait_names[type],
+			   (void *)ip, samples,
+			   div64_u64(atomic64_read(&site->total_ns), samples));
+		for (j = 0; j < LOCK_WAIT_BUCKETS; j++) {
+			unsigned int cnt = atomic_read(&site->buckets[j]);
+
+			if (cnt)
+				seq_printf(m, "\t%llu: %u\n", j ? 1ULL << j : 0,
+					   cnt);
+		}
+	}
+
+	return 0;
+}
+
+static int lock_wait_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lock_wait_hist_show, NULL);
+}
+
+/*
+ * Writing anything resets the histograms. Just like for the event counts,
+ * samples recorded while the reset runs may survive it. The call sites
+ * keep their slots, as lock_wait_find() relies on a claimed slot never
+ * changing its ip or type: a sample racing with the reset then still
+ * lands in the buckets of its own call site.
+ */
+static ssize_t lock_wait_hist_write(struct file *file,
+				    const char __user *user_buf,
+				    size_t count, loff_t *ppos)
+{
+	int i, j;
+
+	for (i = 0; i < LOCK_WAIT_SITES; i++) {
+		struct lock_wait_site *site = &lock_wait_sites[i];
+
+		for (j = 0; j < LOCK_WAIT_BUCKETS; j++)
+			atomic_set(&site->buckets[j], 0);
+		atomic64_set(&site->total_ns, 0);
+	}
+	atomic_long_set(&lock_wait_dropped, 0);
+
+	return count;
+}
+
+static const struct file_operations fops_lock_wait_hist = {
+	.open = lock_wait_hist_open,
+	.read = seq_read,
+	.write = lock_wait_hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int lock_wait_enable_get(void *data, u64 *val)
+{
+	*val = static_key_enabled(&lockevent_wait_key);
+	return 0;
+}
+
+static int lock_wait_enable_set(void *data, u64 val)
+{
+	if (val)
+		static_branch_enable(&lockevent_wait_key);
+	else
+		static_branch_disable(&lockevent_wait_key);
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(fops_lock_wait_enable, lock_wait_enable_get,
+			 lock_wait_enable_set, "%llu\n");
+
 #ifdef CONFIG_PARAVIRT_SPINLOCKS
 #include <asm/paravirt.h>
 
@@ -169,6 +397,17 @@ static int __init init_lockevent_counts(void)
 				 &fops_lockevent))
 		goto fail_undo;
 
+	if (!debugfs_create_file(".lock_wait_hist", 0600, d_counts, NULL,
+				 &fops_lock_wait_hist))
+		goto fail_undo;
+
+	if (!debugfs_create_file_unsafe(".lock_wait_enable", 0600, d_counts,
+					NULL, &fops_lock_wait_enable))
+		goto fail_undo;
+
+	if (lock_wait_boot_enable)
+		static_branch_enable(&lockevent_wait_key);
+
 	return 0;
 fail_undo:
 	debugfs_remove_recursive(d_counts);
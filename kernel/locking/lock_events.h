@@ -16,6 +16,9 @@
 #ifndef __LOCKING_LOCK_EVENTS_H
 #define __LOCKING_LOCK_EVENTS_H
 
+#include <linux/jump_label.h>
+#include <linux/types.h>
+
 enum lock_events {
 
 #include "lock_events_list.h"
@@ -50,11 +53,57 @@ static inline void __lockevent_add(enum lock_events event, int inc)
 
 #define lockevent_add(ev, c)	__lockevent_add(LOCKEVENT_ ##ev, c)
 
+/*
+ * Wait-time histograms of the lock slowpaths, kept per call site of the
+ * lock function. Off unless enabled through debugfs or at boot, as taking
+ * the call site costs a stack walk per contended acquisition.
+ */
+enum lock_wait_types {
+	LOCKWAIT_qspinlock,
+	LOCKWAIT_mutex,
+	LOCKWAIT_rwsem_read,
+	LOCKWAIT_rwsem_write,
+	lockwait_num,
+};
+
+struct lockevent_wait {
+	u64		start;	/* local_clock() at slowpath entry, 0 if off */
+	unsigned long	site;	/* return address into the lock's caller */
+};
+
+DECLARE_STATIC_KEY_FALSE(lockevent_wait_key);
+
+extern void __lockevent_wait_begin(struct lockevent_wait *lw);
+extern void __lockevent_wait_end(struct lockevent_wait *lw,
+				 enum lock_wait_types type);
+
+static __always_inline void lockevent_wait_begin(struct lockevent_wait *lw)
+{
+	lw->start = 0;
+	if (static_branch_unlikely(&lockevent_wait_key))
+		__lockevent_wait_begin(lw);
+}
+
+/*
+ * Record the wait once the lock has been acquired; waits that are given
+ * up on (signals, killed ww_mutex transactions) are not accounted.
+ */
+#define lockevent_wait_end(lw, type)					\
+do {									\
+	if ((lw)->start)						\
+		__lockevent_wait_end(lw, LOCKWAIT_ ## type);		\
+} while (0)
+
 #else  /* CONFIG_LOCK_EVENT_COUNTS */
 
 #define lockevent_inc(ev)
 #define lockevent_add(ev, c)
 #define lockevent_cond_inc(ev, c)
 
+struct lockevent_wait { };
+
+static inline void lockevent_wait_begin(struct lockevent_wait *lw) { }
+#define lockevent_wait_end(lw, type)	do { } while (0)
+
 #endif /* CONFIG_LOCK_EVENT_COUNTS */
 #endif /* __LOCKING_LOCK_EVENTS_H */
@@ -47,6 +47,18 @@ LOCK_EVENT(lock_use_node2)	/* # of locking ops that use 2nd percpu node */
 LOCK_EVENT(lock_use_node3)	/* # of locking ops that use 3rd percpu node */
 LOCK_EVENT(lock_use_node4)	/* # of locking ops that use 4th percpu node */
 LOCK_EVENT(lock_no_node)	/* # of locking ops w/o using percpu node    */
+
+#ifdef CONFIG_NUMA
+/*
+ * Locking events for the NUMA-aware (CNA) qspinlock slowpath; the handoff
+ * counts are kept by the native slowpath too.
+ */
+LOCK_EVENT(lock_node_local)	/* # of MCS handoffs within a NUMA node	     */
+LOCK_EVENT(lock_node_remote)	/* # of MCS handoffs across NUMA nodes	     */
+LOCK_EVENT(cna_splice_new)	/* # of secondary queues created	     */
+LOCK_EVENT(cna_splice_old)	/* # of waiters added to a secondary queue   */
+LOCK_EVENT(cna_flush)		/* # of secondary queue flushes (fairness)   */
+#endif /* CONFIG_NUMA */
 #endif /* CONFIG_QUEUED_SPINLOCKS */
 
 /*
@@ -27,8 +27,10 @@
 #include <linux/moduleparam.h>
 #include <linux/delay.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/percpu-rwsem.h>
 #include <linux/torture.h>
+#include <linux/sched/clock.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Paul E. McKenney <paulmck@linux.ibm.com>");
@@ -48,12 +50,71 @@ torture_param(int, stat_interval, 60,
 torture_param(int, stutter, 5, "Number of jiffies to run/halt test, 0=disable");
 torture_param(int, verbose, 1,
 	     "Enable verbose debugging printk()s");
+torture_param(bool, bench, false,
+	     "Benchmark mode: fixed critical sections, latency percentiles");
+torture_param(int, hold_ns, 1000,
+	     "Critical section length in benchmark mode (ns)");
+torture_param(int, pause_ns, 0,
+	     "Delay between acquisitions in benchmark mode (ns)");
 
 static char *torture_type = "spin_lock";
 module_param(torture_type, charp, 0444);
 MODULE_PARM_DESC(torture_type,
 		 "Type of lock to torture (spin_lock, spin_lock_irq, mutex_lock, ...)");
 
+static cpumask_var_t bind_readers; /* Bind the readers to this set of CPUs. */
+static cpumask_var_t bind_writers; /* Bind the writers to this set of CPUs. */
+
+/* Parse a cpulist module parameter, falling back to all CPUs on error. */
+static int lock_torture_param_set_cpumask(const char *val,
+					  const struct kernel_param *kp)
+{
+	cpumask_var_t *cm_bind = kp->arg;
+	int ret;
+	char *s;
+
+	if (!cpumask_available(*cm_bind) &&
+	    !alloc_cpumask_var(cm_bind, GFP_KERNEL)) {
+		s = "Out of memory";
+		ret = -ENOMEM;
+		goto out_err;
+	}
+	ret = cpulist_parse(val, *cm_bind);
+	if (!ret)
+		return ret;
+	s = "Bad CPU range";
+out_err:
+	pr_warn("%s: %s, all CPUs set\n", kp->name, s);
+	if (cpumask_available(*cm_bind))
+		cpumask_setall(*cm_bind);
+	return ret;
+}
+
+static int lock_torture_param_get_cpumask(char *buffer,
+					  const struct kernel_param *kp)
+{
+	cpumask_var_t *cm_bind = kp->arg;
+
+	if (!cpumask_available(*cm_bind))
+		return sprintf(buffer, "\n");
+	return sprintf(buffer, "%*pbl\n", cpumask_pr_args(*cm_bind));
+}
+
+static bool cpumask_nonempty(cpumask_var_t mask)
+{
+	return cpumask_available(mask) && !cpumask_empty(mask);
+}
+
+static const struct kernel_param_ops lock_torture_bind_ops = {
+	.set = lock_torture_param_set_cpumask,
+	.get = lock_torture_param_get_cpumask,
+};
+
+module_param_cb(bind_readers, &lock_torture_bind_ops, &bind_readers, 0444);
+MODULE_PARM_DESC(bind_readers, "CPUs (cpulist) the readers are bound to");
+module_param_cb(bind_writers, &lock_torture_bind_ops, &bind_writers, 0444);
+MODULE_PARM_DESC(bind_writers, "CPUs (cpulist) the writers are bound to");
+
 static struct task_struct *stats_task;
 static struct task_struct **writer_tasks;
 static struct task_struct **reader_tasks;
@@ -61,11 +122,37 @@ static struct task_struct **reader_tasks;
 static bool lock_is_write_held;
 static bool lock_is_read_held;
 
+/*
+ * Latency histograms for benchmark mode.  Buckets are log-linear: values
+ * below LT_HIST_SUB get a bucket each, above that every power of two is
+ * split into LT_HIST_SUB buckets, which bounds the error of the reported
+ * percentiles to 1/LT_HIST_SUB (12.5%).  Everything above 2^36 ns ends up
+ * in the last bucket.
+ */
+#define LT_HIST_SUB_BITS	3
+#define LT_HIST_SUB		(1 << LT_HIST_SUB_BITS)
+#define LT_HIST_MAX_SHIFT	(36 - LT_HIST_SUB_BITS)
+#define LT_HIST_BUCKETS		((LT_HIST_MAX_SHIFT + 2) * LT_HIST_SUB)
+
+struct lock_torture_hist {
+	unsigned long wait[LT_HIST_BUCKETS];	/* lock call to acquisition */
+	unsigned long hold[LT_HIST_BUCKETS];	/* acquisition to unlock call */
+};
+
 struct lock_stress_stats {
 	long n_lock_fail;
 	long n_lock_acquired;
+	long n_lock_node_local;		/* acquired after a same-node writer */
+	long n_lock_node_remote;	/* acquired after another node's writer */
+	struct lock_torture_hist *hist;	/* benchmark mode only */
 };
 
+/*
+ * NUMA node of the last writer to acquire the lock, used to tell intra-node
+ * from inter-node lock handoffs.  Only accessed with the lock write-held.
+ */
+static int lock_last_node = NUMA_NO_NODE;
+
 /* Forward reference. */
 static void lock_torture_cleanup(void);
 
@@ -94,10 +181,12 @@ struct lock_torture_cxt {
 	struct lock_torture_ops *cur_ops;
 	struct lock_stress_stats *lwsa; /* writer statistics */
 	struct lock_stress_stats *lrsa; /* reader statistics */
+	struct lock_torture_hist *lwha; /* writer latency histograms */
+	struct lock_torture_hist *lrha; /* reader latency histograms */
 };
 static struct lock_torture_cxt cxt = { 0, 0, false,
 				       ATOMIC_INIT(0),
-				       NULL, NULL};
+				       NULL, NULL, NULL, NULL};
 /*
  * Definitions for lock torture testing.
  */
@@ -605,6 +694,72 @@ static struct lock_torture_ops percpu_rwsem_lock_ops = {
 	.name		= "percpu_rwsem_lock"
 };
 
+static unsigned int lock_torture_hist_idx(u64 ns)
+{
+	unsigned int shift;
+
+	if (ns < LT_HIST_SUB)
+		return ns;
+
+	shift = ilog2(ns) - LT_HIST_SUB_BITS;
+	if (shift > LT_HIST_MAX_SHIFT)
+		return LT_HIST_BUCKETS - 1;
+
+	return (shift + 1) * LT_HIST_SUB + ((ns >> shift) & (LT_HIST_SUB - 1));
+}
+
+/* Lower bound of the values accounted to bucket @idx. */
+static u64 lock_torture_hist_val(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < LT_HIST_SUB)
+		return idx;
+
+	shift = idx / LT_HIST_SUB - 1;
+	return (u64)(LT_HIST_SUB + idx % LT_HIST_SUB) << shift;
+}
+
+static u64 lock_torture_now(void)
+{
+	return bench ? local_clock() : 0;
+}
+
+/*
+ * Spin for the given number of nanoseconds; the critical section and the
+ * pause between acquisitions of benchmark mode.
+ */
+static void lock_torture_bench_delay(int ns)
+{
+	if (ns <= 0)
+		return;
+	if (ns >= NSEC_PER_USEC)
+		udelay(ns / NSEC_PER_USEC);
+	ndelay(ns % NSEC_PER_USEC);
+}
+
+/* Called with the lock still held, right before unlocking it. */
+static void lock_torture_hist_record(struct lock_stress_stats *lsp,
+				     u64 start, u64 acquired)
+{
+	if (!lsp->hist)
+		return;
+
+	lsp->hist->wait[lock_torture_hist_idx(acquired - start)]++;
+	lsp->hist->hold[lock_torture_hist_idx(local_clock() - acquired)]++;
+}
+
+static void lock_torture_count_handoff(struct lock_stress_stats *lwsp)
+{
+	int node = numa_node_id();
+
+	if (lock_last_node == node)
+		lwsp->n_lock_node_local++;
+	else
+		lwsp->n_lock_node_remote++;
+	lock_last_node = node;
+}
+
 /*
  * Lock torture writer kthread.  Repeatedly acquires and releases
  * the lock, checking for duplicate acquisitions.
@@ -613,16 +768,21 @@ static int lock_torture_writer(void *arg)
 {
 	struct lock_stress_stats *lwsp = arg;
 	DEFINE_TORTURE_RANDOM(rand);
+	u64 start, acquired;
 
 	VERBOSE_TOROUT_STRING("lock_torture_writer task started");
 	set_user_nice(current, MAX_NICE);
+	if (cpumask_nonempty(bind_writers))
+		set_cpus_allowed_ptr(current, bind_writers);
 
 	do {
-		if ((torture_random(&rand) & 0xfffff) == 0)
+		if (!bench && (torture_random(&rand) & 0xfffff) == 0)
 			schedule_timeout_uninterruptible(1);
 
 		cxt.cur_ops->task_boost(&rand);
+		start = lock_torture_now();
 		cxt.cur_ops->writelock();
+		acquired = lock_torture_now();
 		if (WARN_ON_ONCE(lock_is_write_held))
 			lwsp->n_lock_fail++;
 		lock_is_write_held = true;
@@ -630,9 +790,16 @@ static int lock_torture_writer(void *arg)
 			lwsp->n_lock_fail++; /* rare, but... */
 
 		lwsp->n_lock_acquired++;
-		cxt.cur_ops->write_delay(&rand);
+		lock_torture_count_handoff(lwsp);
+		if (bench)
+			lock_torture_bench_delay(hold_ns);
+		else
+			cxt.cur_ops->write_delay(&rand);
+		lock_torture_hist_record(lwsp, start, acquired);
 		lock_is_write_held = false;
 		cxt.cur_ops->writeunlock();
+		if (bench)
+			lock_torture_bench_delay(pause_ns);
 
 		stutter_wait("lock_torture_writer");
 	} while (!torture_must_stop());
@@ -650,23 +817,34 @@ static int lock_torture_reader(void *arg)
 {
 	struct lock_stress_stats *lrsp = arg;
 	DEFINE_TORTURE_RANDOM(rand);
+	u64 start, acquired;
 
 	VERBOSE_TOROUT_STRING("lock_torture_reader task started");
 	set_user_nice(current, MAX_NICE);
+	if (cpumask_nonempty(bind_readers))
+		set_cpus_allowed_ptr(current, bind_readers);
 
 	do {
-		if ((torture_random(&rand) & 0xfffff) == 0)
+		if (!bench && (torture_random(&rand) & 0xfffff) == 0)
 			schedule_timeout_uninterruptible(1);
 
+		start = lock_torture_now();
 		cxt.cur_ops->readlock();
+		acquired = lock_torture_now();
 		lock_is_read_held = true;
 		if (WARN_ON_ONCE(lock_is_write_held))
 			lrsp->n_lock_fail++; /* rare, but... */
 
 		lrsp->n_lock_acquired++;
-		cxt.cur_ops->read_delay(&rand);
+		if (bench)
+			lock_torture_bench_delay(hold_ns);
+		else
+			cxt.cur_ops->read_delay(&rand);
+		lock_torture_hist_record(lrsp, start, acquired);
 		lock_is_read_held = false;
 		cxt.cur_ops->readunlock();
+		if (bench)
+			lock_torture_bench_delay(pause_ns);
 
 		stutter_wait("lock_torture_reader");
 	} while (!torture_must_stop());
@@ -674,6 +852,48 @@ static int lock_torture_reader(void *arg)
 	return 0;
 }
 
+/*
+ * Print the p50/p99/p99.9/max latencies of one histogram type, summed
+ * over all threads; @hold selects hold rather than wait times.
+ */
+static char *lock_torture_print_percentiles(char *page,
+					    struct lock_stress_stats *statp,
+					    int n_stress, bool write, bool hold)
+{
+	static const unsigned int pct[] = { 5000, 9900, 9990 }; /* 1/10000 */
+	unsigned long long total = 0, sum = 0;
+	u64 val[ARRAY_SIZE(pct) + 1] = { };
+	unsigned int idx, i, p = 0;
+
+	for (idx = 0; idx < LT_HIST_BUCKETS; idx++) {
+		for (i = 0; i < n_stress; i++)
+			total += hold ? statp[i].hist->hold[idx] :
+					statp[i].hist->wait[idx];
+	}
+	if (!total)
+		return page;
+
+	for (idx = 0; idx < LT_HIST_BUCKETS; idx++) {
+		unsigned long cnt = 0;
+
+		for (i = 0; i < n_stress; i++)
+			cnt += hold ? statp[i].hist->hold[idx] :
+				      statp[i].hist->wait[idx];
+		if (!cnt)
+			continue;
+
+		sum += cnt;
+		while (p < ARRAY_SIZE(pct) && sum * 10000 >= total * pct[p])
+			val[p++] = lock_torture_hist_val(idx);
+		val[ARRAY_SIZE(pct)] = lock_torture_hist_val(idx);
+	}
+
+	return page + sprintf(page,
+			      "%s:  %s ns  p50: %llu  p99: %llu  p99.9: %llu  max: %llu\n",
+			      write ? "Writes" : "Reads ", hold ? "Hold" : "Wait",
+			      val[0], val[1], val[2], val[3]);
+}
+
 /*
  * Create an lock-torture-statistics message in the specified buffer.
  */
@@ -683,13 +903,15 @@ static void __torture_print_stats(char *page,
 	bool fail = false;
 	int i, n_stress;
 	long max = 0, min = statp ? statp[0].n_lock_acquired : 0;
-	long long sum = 0;
+	long long sum = 0, local = 0, remote = 0;
 
 	n_stress = write ? cxt.nrealwriters_stress : cxt.nrealreaders_stress;
 	for (i = 0; i < n_stress; i++) {
 		if (statp[i].n_lock_fail)
 			fail = true;
 		sum += statp[i].n_lock_acquired;
+		local += statp[i].n_lock_node_local;
+		remote += statp[i].n_lock_node_remote;
 		if (max < statp[i].n_lock_acquired)
 			max = statp[i].n_lock_acquired;
 		if (min > statp[i].n_lock_acquired)
@@ -701,6 +923,15 @@ static void __torture_print_stats(char *page,
 			sum, max, min,
 			!onoff_interval && max / 2 > min ? "???" : "",
 			fail, fail ? "!!!" : "");
+	if (write && nr_node_ids > 1)
+		page += sprintf(page, "Writes:  Node-local/remote: %lld/%lld\n",
+				local, remote);
+	if (bench) {
+		page = lock_torture_print_percentiles(page, statp, n_stress,
+						      write, false);
+		page = lock_torture_print_percentiles(page, statp, n_stress,
+						      write, true);
+	}
 	if (fail)
 		atomic_inc(&cxt.n_lock_torture_errors);
 }
@@ -770,11 +1001,11 @@ lock_torture_print_module_parms(struct lock_torture_ops *cur_ops,
 				const char *tag)
 {
 	pr_alert("%s" TORTURE_FLAG
-		 "--- %s%s: nwriters_stress=%d nreaders_stress=%d stat_interval=%d verbose=%d shuffle_interval=%d stutter=%d shutdown_secs=%d onoff_interval=%d onoff_holdoff=%d\n",
+		 "--- %s%s: nwriters_stress=%d nreaders_stress=%d stat_interval=%d verbose=%d shuffle_interval=%d stutter=%d shutdown_secs=%d onoff_interval=%d onoff_holdoff=%d bench=%d hold_ns=%d pause_ns=%d\n",
 		 torture_type, tag, cxt.debug_lock ? " [debug]": "",
 		 cxt.nrealwriters_stress, cxt.nrealreaders_stress, stat_interval,
 		 verbose, shuffle_interval, stutter, shutdown_secs,
-		 onoff_interval, onoff_holdoff);
+		 onoff_interval, onoff_holdoff, bench, hold_ns, pause_ns);
 }
 
 static void lock_torture_cleanup(void)
@@ -826,6 +1057,12 @@ static void lock_torture_cleanup(void)
 	cxt.lwsa = NULL;
 	kfree(cxt.lrsa);
 	cxt.lrsa = NULL;
+	vfree(cxt.lwha);
+	cxt.lwha = NULL;
+	vfree(cxt.lrha);
+	cxt.lrha = NULL;
+	free_cpumask_var(bind_readers);
+	free_cpumask_var(bind_writers);
 
 end:
 	torture_cleanup_end();
@@ -911,6 +1148,24 @@ static int __init lock_torture_init(void)
 		for (i = 0; i < cxt.nrealwriters_stress; i++) {
 			cxt.lwsa[i].n_lock_fail = 0;
 			cxt.lwsa[i].n_lock_acquired = 0;
+			cxt.lwsa[i].n_lock_node_local = 0;
+			cxt.lwsa[i].n_lock_node_remote = 0;
+			cxt.lwsa[i].hist = NULL;
+		}
+		lock_last_node = NUMA_NO_NODE;
+
+		if (bench) {
+			cxt.lwha = vzalloc(array_size(cxt.nrealwriters_stress,
+						      sizeof(*cxt.lwha)));
+			if (cxt.lwha == NULL) {
+				VERBOSE_TOROUT_STRING("cxt.lwha: Out of memory");
+				firsterr = -ENOMEM;
+				kfree(cxt.lwsa);
+				cxt.lwsa = NULL;
+				goto unwind;
+			}
+			for (i = 0; i < cxt.nrealwriters_stress; i++)
+				cxt.lwsa[i].hist = &cxt.lwha[i];
 		}
 	}
 
@@ -944,6 +1199,27 @@ static int __init lock_torture_init(void)
 			for (i = 0; i < cxt.nrealreaders_stress; i++) {
 				cxt.lrsa[i].n_lock_fail = 0;
 				cxt.lrsa[i].n_lock_acquired = 0;
+				cxt.lrsa[i].n_lock_node_local = 0;
+				cxt.lrsa[i].n_lock_node_remote = 0;
+				cxt.lrsa[i].hist = NULL;
+			}
+
+			if (bench) {
+				cxt.lrha = vzalloc(array_size(cxt.nrealreaders_stress,
+							      sizeof(*cxt.lrha)));
+				if (cxt.lrha == NULL) {
+					VERBOSE_TOROUT_STRING("cxt.lrha: Out of memory");
+					firsterr = -ENOMEM;
+					kfree(cxt.lwsa);
+					cxt.lwsa = NULL;
+					kfree(cxt.lrsa);
+					cxt.lrsa = NULL;
+					vfree(cxt.lwha);
+					cxt.lwha = NULL;
+					goto unwind;
+				}
+				for (i = 0; i < cxt.nrealreaders_stress; i++)
+					cxt.lrsa[i].hist = &cxt.lrha[i];
 			}
 		}
 	}
@@ -957,7 +1233,9 @@ static int __init lock_torture_init(void)
 		if (firsterr)
 			goto unwind;
 	}
-	if (shuffle_interval > 0) {
+	/* Shuffling would undo the binding of the reader and writer threads. */
+	if (shuffle_interval > 0 && !cpumask_nonempty(bind_readers) &&
+	    !cpumask_nonempty(bind_writers)) {
 		firsterr = torture_shuffle_init(shuffle_interval);
 		if (firsterr)
 			goto unwind;
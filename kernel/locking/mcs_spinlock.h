@@ -45,6 +45,16 @@ do {									\
 	smp_store_release((l), 1)
 #endif
 
+#ifndef arch_mcs_lock_handoff
+/*
+ * As arch_mcs_spin_unlock_contended(), but hand an arbitrary non-zero value
+ * over to the next waiter; the NUMA-aware qspinlock passes its secondary
+ * queue this way.
+ */
+#define arch_mcs_lock_handoff(l, val)					\
+	smp_store_release((l), (val))
+#endif
+
 /*
  * Note: the smp_load_acquire/smp_store_release pair is not
  * sufficient to form a full memory barrier across
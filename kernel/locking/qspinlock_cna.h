@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#include <linux/init.h>
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
+#include <linux/topology.h>
+
+/*
+ * Implement a NUMA-aware version of MCS (aka CNA, or compact NUMA-aware lock).
+ *
+ * In CNA, spinning threads are organized in two queues, a primary queue for
+ * threads running on the same NUMA node as the current lock holder, and a
+ * secondary queue for threads running on other nodes. Schematically, it
+ * looks like this:
+ *
+ *    cna_node
+ *   +----------+     +--------+         +--------+
+ *   |mcs:next  | --> |mcs:next| --> ... |mcs:next| --> NULL  [Primary queue]
+ *   |mcs:locked| -.  +--------+         +--------+
+ *   +----------+  |
+ *                 `----------------------.
+ *                                        v
+ *                 +--------+         +--------+
+ *                 |mcs:next| --> ... |mcs:next|            [Secondary queue]
+ *                 +--------+         +--------+
+ *                     ^                    |
+ *                     `--------------------'
+ *
+ * N.B. locked := 1 if secondary queue is absent. Otherwise, it contains the
+ * encoded pointer to the tail of the secondary queue, which is organized as a
+ * circular list.
+ *
+ * While the lock holder (or the queue head, which spins on the lock word
+ * anyway) waits, it scans the primary queue and moves waiters running on
+ * other nodes to the tail of the secondary queue. At unlock time, the lock
+ * is passed to the next waiter in the primary queue, along with the
+ * secondary queue.
+ *
+ * To bound the unfairness towards remote waiters, the time at which the
+ * secondary queue was created is handed over together with it; once that is
+ * older than numa_spinlock_threshold, the secondary queue is spliced back
+ * in front of the primary queue and the lock goes to the longest waiting
+ * remote waiter. When the primary queue runs empty, the secondary queue is
+ * moved back onto the primary queue as well.
+ *
+ * For more details, see https://arxiv.org/abs/1810.05600.
+ *
+ * Authors: Alex Kogan <alex.kogan@oracle.com>
+ *          Dave Dice <dave.dice@oracle.com>
+ */
+
+struct cna_node {
+	struct mcs_spinlock	mcs;
+	u16			numa_node;	/* preferred node of the queue */
+	u16			real_numa_node;	/* node this qnode lives on */
+	u32			encoded_tail;	/* self */
+	u64			start_time;	/* secondary queue creation */
+};
+
+/*
+ * start_time value telling cna_pass_lock() that the fairness threshold
+ * was hit and the secondary queue must be flushed.
+ */
+#define FLUSH_SECONDARY_QUEUE	1
+
+/* Default and bounds of numa_spinlock_threshold=, in milliseconds. */
+#define CNA_THRESHOLD_DEFAULT_MS	10
+#define CNA_THRESHOLD_MAX_MS		100
+
+static u64 cna_threshold_ns __ro_after_init =
+		CNA_THRESHOLD_DEFAULT_MS * NSEC_PER_MSEC;
+
+/*
+ * Controls the use of the NUMA-aware slowpath: 0 (the default) keeps the
+ * native one, 1 selects CNA and -1 (auto) selects it on machines with more
+ * than one node.
+ */
+static int numa_spinlock_flag __initdata;
+
+static DEFINE_STATIC_KEY_FALSE(cna_lock_key);
+
+void __cna_queued_spin_lock_slowpath(struct qspinlock *lock, u32 val);
+
+static int __init numa_spinlock_setup(char *str)
+{
+	if (!strcmp(str, "auto")) {
+		numa_spinlock_flag = -1;
+		return 1;
+	} else if (!strcmp(str, "on")) {
+		numa_spinlock_flag = 1;
+		return 1;
+	} else if (!strcmp(str, "off")) {
+		numa_spinlock_flag = 0;
+		return 1;
+	}
+
+	return 0;
+}
+__setup("numa_spinlock=", numa_spinlock_setup);
+
+static int __init numa_spinlock_threshold_setup(char *str)
+{
+	unsigned int ms;
+
+	if (kstrtouint(str, 0, &ms) || !ms || ms > CNA_THRESHOLD_MAX_MS)
+		return 0;
+
+	cna_threshold_ns = (u64)ms * NSEC_PER_MSEC;
+	return 1;
+}
+__setup("numa_spinlock_threshold=", numa_spinlock_threshold_setup);
+
+static inline struct cna_node *to_cna_node(struct mcs_spinlock *node)
+{
+	return (struct cna_node *)node;
+}
+
+/*
+ * Count lock handoffs by whether the lock stays on the node of its previous
+ * owner. The native slowpath is accounted too, so the two can be compared
+ * on the same machine by booting with numa_spinlock=off and =on.
+ */
+static __always_inline void cna_count_handoff(struct mcs_spinlock *node,
+					      struct mcs_spinlock *next)
+{
+	bool local = to_cna_node(node)->real_numa_node ==
+		     to_cna_node(next)->real_numa_node;
+
+	lockevent_cond_inc(lock_node_local, local);
+	lockevent_cond_inc(lock_node_remote, !local);
+}
+
+static __always_inline void cna_native_pass_lock(struct mcs_spinlock *node,
+						 struct mcs_spinlock *next)
+{
+	cna_count_handoff(node, next);
+	__mcs_pass_lock(node, next);
+}
+
+static void __init cna_init_nodes_per_cpu(unsigned int cpu)
+{
+	struct mcs_spinlock *base = per_cpu_ptr(&qnodes[0].mcs, cpu);
+	int numa_node = cpu_to_node(cpu);
+	int i;
+
+	for (i = 0; i < MAX_NODES; i++) {
+		struct cna_node *cn = to_cna_node(grab_mcs_node(base, i));
+
+		cn->real_numa_node = numa_node;
+		cn->encoded_tail = encode_tail(cpu, i);
+		/*
+		 * make sure @encoded_tail is not confused with other valid
+		 * values for @locked (0 or 1)
+		 */
+		WARN_ON(cn->encoded_tail <= 1);
+	}
+}
+
+/*
+ * Must run before the secondary CPUs are brought up: native and CNA waiters
+ * cannot be mixed in one queue, as a native waiter would drop the secondary
+ * queue handed to it in @locked on the floor.
+ */
+static int __init cna_init_nodes(void)
+{
+	unsigned int cpu;
+
+	/*
+	 * In CNA, we use the extra space in struct qnode to store the
+	 * NUMA-aware bookkeeping; make sure it fits.
+	 */
+	BUILD_BUG_ON(sizeof(struct cna_node) > sizeof(struct qnode));
+
+	for_each_possible_cpu(cpu)
+		cna_init_nodes_per_cpu(cpu);
+
+	if (numa_spinlock_flag < 0)
+		numa_spinlock_flag = nr_node_ids > 1;
+
+	if (numa_spinlock_flag > 0) {
+		static_branch_enable(&cna_lock_key);
+		pr_info("Enabling CNA spinlock, threshold %llu ms\n",
+			div_u64(cna_threshold_ns, NSEC_PER_MSEC));
+	}
+
+	return 0;
+}
+early_initcall(cna_init_nodes);
+
+static __always_inline bool __cna_slowpath(struct qspinlock *lock, u32 val)
+{
+	if (!static_branch_unlikely(&cna_lock_key))
+		return false;
+
+	__cna_queued_spin_lock_slowpath(lock, val);
+	return true;
+}
+
+static inline void cna_init_node(struct mcs_spinlock *node)
+{
+	struct cna_node *cn = to_cna_node(node);
+
+	cn->numa_node = cn->real_numa_node;
+	cn->start_time = 0;
+}
+
+/*
+ * cna_splice_head -- splice the entire secondary queue onto the head of the
+ * primary queue.
+ *
+ * Returns the new primary head node or NULL on failure.
+ */
+static inline struct mcs_spinlock *
+cna_splice_head(struct qspinlock *lock, u32 val,
+		struct mcs_spinlock *node, struct mcs_spinlock *next)
+{
+	struct mcs_spinlock *head_2nd, *tail_2nd;
+	u32 new;
+
+	tail_2nd = decode_tail(node->locked);
+	head_2nd = tail_2nd->next;
+
+	if (next) {
+		/*
+		 * If the primary queue is not empty, the primary tail doesn't
+		 * need to change and we can simply link the secondary tail to
+		 * the old primary head.
+		 */
+		tail_2nd->next = next;
+	} else {
+		/*
+		 * When the primary queue is empty, the secondary tail becomes
+		 * the primary tail. Clear its next pointer before publishing
+		 * it, so that a new waiter linking itself in behind it is not
+		 * lost; the release orders the two.
+		 */
+		tail_2nd->next = NULL;
+
+		new = to_cna_node(tail_2nd)->encoded_tail | _Q_LOCKED_VAL;
+		if (!atomic_try_cmpxchg_release(&lock->val, &val, new)) {
+			/* Restore the secondary queue's circular list. */
+			tail_2nd->next = head_2nd;
+			return NULL;
+		}
+	}
+
+	/* The primary queue head now is what was the secondary queue head. */
+	return head_2nd;
+}
+
+static inline bool cna_try_clear_tail(struct qspinlock *lock, u32 val,
+				      struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next;
+
+	/*
+	 * We're here because the primary queue is empty; check the secondary
+	 * queue for remote waiters.
+	 */
+	if (node->locked > 1) {
+		/*
+		 * When there are waiters on the secondary queue, try to move
+		 * them back onto the primary queue and let them rip.
+		 */
+		next = cna_splice_head(lock, val, node, NULL);
+		if (next) {
+			cna_count_handoff(node, next);
+			arch_mcs_lock_handoff(&next->locked, 1);
+			return true;
+		}
+
+		return false;
+	}
+
+	/* Both queues are empty. Do what MCS does. */
+	return __try_clear_tail(lock, val, node);
+}
+
+/*
+ * cna_splice_next -- splice the next node from the primary queue onto
+ * the secondary queue.
+ */
+static inline void cna_splice_next(struct mcs_spinlock *node,
+			    struct mcs_spinlock *next,
+			    struct mcs_spinlock *nnext)
+{
+	/* remove 'next' from the main queue */
+	node->next = nnext;
+
+	/* stick `next` on the secondary queue tail */
+	if (node->locked <= 1) { /* if secondary queue is empty */
+		/* create secondary queue */
+		next->next = next;
+
+		/* start the clock on the fairness bound */
+		to_cna_node(node)->start_time = local_clock();
+		lockevent_inc(cna_splice_new);
+	} else {
+		/* add to the tail of the secondary queue */
+		struct mcs_spinlock *tail_2nd = decode_tail(node->locked);
+		struct mcs_spinlock *head_2nd = tail_2nd->next;
+
+		tail_2nd->next = next;
+		next->next = head_2nd;
+		lockevent_inc(cna_splice_old);
+	}
+
+	node->locked = to_cna_node(next)->encoded_tail;
+}
+
+/*
+ * cna_order_queue - check whether the next waiter in the main queue is on
+ * the same NUMA node as the lock holder; if not, and it has a waiter behind
+ * it in the main queue, move the former onto the secondary queue.
+ *
+ * Returns true if there is nothing left to sort for now.
+ */
+static inline bool cna_order_queue(struct mcs_spinlock *node)
+{
+	struct mcs_spinlock *next = READ_ONCE(node->next);
+	struct mcs_spinlock *nnext;
+
+	if (!next)
+		return false;
+
+	if (to_cna_node(next)->numa_node == to_cna_node(node)->numa_node)
+		return true;
+
+	nnext = READ_ONCE(next->next);
+	if (nnext)
+		cna_splice_next(node, next, nnext);
+
+	return false;
+}
+
+static __always_inline bool cna_threshold_reached(struct cna_node *cn)
+{
+	return local_clock() - cn->start_time > cna_threshold_ns;
+}
+
+/* Abuse the pv_wait_head_or_lock() hook to get some work done */
+static __always_inline u32 cna_wait_head_or_lock(struct qspinlock *lock,
+						 struct mcs_spinlock *node)
+{
+	struct cna_node *cn = to_cna_node(node);
+
+	if (node->locked <= 1 || !cna_threshold_reached(cn)) {
+		/*
+		 * Try and put the time otherwise spent spin waiting on
+		 * _Q_LOCKED_PENDING_MASK to use by sorting our lists.
+		 */
+		while (atomic_read(&lock->val) & _Q_LOCKED_PENDING_MASK &&
+		       !cna_order_queue(node))
+			cpu_relax();
+	} else {
+		cn->start_time = FLUSH_SECONDARY_QUEUE;
+	}
+
+	return 0; /* we lied; we didn't wait, go do so now */
+}
+
+static inline void cna_pass_lock(struct mcs_spinlock *node,
+				 struct mcs_spinlock *next)
+{
+	struct cna_node *cn = to_cna_node(node);
+	u32 val = 1;
+
+	if (cn->start_time != FLUSH_SECONDARY_QUEUE) {
+		if (node->locked > 1) {
+			val = node->locked;	/* preserve secondary queue */
+
+			/*
+			 * We have a local waiter, either real or fake one;
+			 * reload @next in case it was changed by
+			 * cna_order_queue().
+			 */
+			next = node->next;
+
+			/*
+			 * Pass over NUMA node id of primary queue, to maintain
+			 * the preference even if the next waiter is on a
+			 * different node; and the creation time of the
+			 * secondary queue, to keep the fairness bound.
+			 */
+			to_cna_node(next)->numa_node = cn->numa_node;
+			to_cna_node(next)->start_time = cn->start_time;
+		}
+	} else {
+		/*
+		 * We decided to flush the secondary queue;
+		 * this can only happen if that queue is not empty.
+		 */
+		WARN_ON(node->locked <= 1);
+		/*
+		 * Splice the secondary queue onto the primary queue and pass
+		 * the lock to the longest waiting remote waiter.
+		 */
+		next = cna_splice_head(NULL, 0, node, next);
+		lockevent_inc(cna_flush);
+	}
+
+	cna_count_handoff(node, next);
+	arch_mcs_lock_handoff(&next->locked, val);
+}
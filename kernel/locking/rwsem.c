@@ -993,9 +993,12 @@ rwsem_down_read_slowpath(struct rw_semaphore *sem, int state)
 {
 	long count, adjustment = -RWSEM_READER_BIAS;
 	struct rwsem_waiter waiter;
+	struct lockevent_wait lw;
 	DEFINE_WAKE_Q(wake_q);
 	bool wake = false;
 
+	lockevent_wait_begin(&lw);
+
 	/*
 	 * Save the current read-owner of rwsem, if available, and the
 	 * reader nonspinnable bit.
@@ -1026,9 +1029,11 @@ rwsem_down_read_slowpath(struct rw_semaphore *sem, int state)
 			raw_spin_unlock_irq(&sem->wait_lock);
 			wake_up_q(&wake_q);
 		}
+		lockevent_wait_end(&lw, rwsem_read);
 		return sem;
 	} else if (rwsem_reader_phase_trylock(sem, waiter.last_rowner)) {
 		/* rwsem_reader_phase_trylock() implies ACQUIRE on success */
+		lockevent_wait_end(&lw, rwsem_read);
 		return sem;
 	}
 
@@ -1052,6 +1057,7 @@ rwsem_down_read_slowpath(struct rw_semaphore *sem, int state)
 			raw_spin_unlock_irq(&sem->wait_lock);
 			rwsem_set_reader_owned(sem);
 			lockevent_inc(rwsem_rlock_fast);
+			lockevent_wait_end(&lw, rwsem_read);
 			return sem;
 		}
 		adjustment += RWSEM_FLAG_WAITERS;
@@ -1102,6 +1108,7 @@ rwsem_down_read_slowpath(struct rw_semaphore *sem, int state)
 
 	__set_current_state(TASK_RUNNING);
 	lockevent_inc(rwsem_rlock);
+	lockevent_wait_end(&lw, rwsem_read);
 	return sem;
 
 out_nolock:
@@ -1140,12 +1147,16 @@ rwsem_down_write_slowpath(struct rw_semaphore *sem, int state)
 	enum writer_wait_state wstate;
 	struct rwsem_waiter waiter;
 	struct rw_semaphore *ret = sem;
+	struct lockevent_wait lw;
 	DEFINE_WAKE_Q(wake_q);
 
+	lockevent_wait_begin(&lw);
+
 	/* do optimistic spinning and steal lock if possible */
 	if (rwsem_can_spin_on_owner(sem, RWSEM_WR_NONSPINNABLE) &&
 	    rwsem_optimistic_spin(sem, true)) {
 		/* rwsem_optimistic_spin() implies ACQUIRE on success */
+		lockevent_wait_end(&lw, rwsem_write);
 		return sem;
 	}
 
@@ -1269,6 +1280,7 @@ rwsem_down_write_slowpath(struct rw_semaphore *sem, int state)
 	rwsem_disable_reader_optspin(sem, disable_rspin);
 	raw_spin_unlock_irq(&sem->wait_lock);
 	lockevent_inc(rwsem_wlock);
+	lockevent_wait_end(&lw, rwsem_write);
 
 	return ret;
 
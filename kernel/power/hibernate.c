@@ -31,6 +31,8 @@
 #include <linux/genhd.h>
 #include <linux/ktime.h>
 #include <linux/security.h>
+#include <linux/crypto.h>
+#include <linux/moduleparam.h>
 #include <trace/events/power.h>
 
 #include "power.h"
@@ -46,6 +48,27 @@ dev_t swsusp_resume_device;
 sector_t swsusp_resume_block;
 __visible int in_suspend __nosavedata;
 
+/*
+ * Compressors usable for the image, with the flag recording each of them in
+ * the image header.  Only built-in ones can be offered, as the image is read
+ * before any modules are loaded.
+ */
+static const struct hib_comp {
+	const char *name;
+	unsigned int flag;
+} hib_comps[] = {
+	{ "lzo",	0 },
+#if IS_BUILTIN(CONFIG_CRYPTO_LZ4)
+	{ "lz4",	SF_COMPRESSION_ALG_LZ4 },
+#endif
+#if IS_BUILTIN(CONFIG_CRYPTO_ZSTD)
+	{ "zstd",	SF_COMPRESSION_ALG_ZSTD },
+#endif
+};
+
+char hib_comp_algo[CRYPTO_MAX_ALG_NAME] = CONFIG_HIBERNATION_DEF_COMP;
+unsigned int hib_comp_threads = 3;
+
 enum {
 	HIBERNATION_INVALID,
 	HIBERNATION_PLATFORM,
@@ -751,7 +774,7 @@ int hibernate(void)
 		if (nocompress)
 			flags |= SF_NOCOMPRESS_MODE;
 		else
-		        flags |= SF_CRC32_MODE;
+		        flags |= SF_CRC32_MODE | hib_comp_flags();
 
 		pm_pr_dbg("Writing hibernation image.\n");
 		error = swsusp_write(flags);
@@ -1290,6 +1313,75 @@ static int __init resume_offset_setup(char *str)
 	return 1;
 }
 
+/**
+ * hib_comp_flags - Image header flags for the selected compressor.
+ */
+unsigned int hib_comp_flags(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hib_comps); i++)
+		if (!strcmp(hib_comp_algo, hib_comps[i].name))
+			return hib_comps[i].flag;
+
+	return 0;
+}
+
+/**
+ * hib_comp_select - Select the compressor an image was written with.
+ * @flags: Flags from the image header.
+ */
+int hib_comp_select(unsigned int flags)
+{
+	unsigned int alg = flags & (SF_COMPRESSION_ALG_LZ4 |
+				    SF_COMPRESSION_ALG_ZSTD);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hib_comps); i++) {
+		if (hib_comps[i].flag == alg) {
+			strscpy(hib_comp_algo, hib_comps[i].name,
+				sizeof(hib_comp_algo));
+			return 0;
+		}
+	}
+
+	pr_err("Image compressor not available (flags %#x)\n", flags);
+	return -EOPNOTSUPP;
+}
+
+static int hib_comp_param_set(const char *val, const struct kernel_param *kp)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hib_comps); i++) {
+		if (sysfs_streq(val, hib_comps[i].name)) {
+			lock_system_sleep();
+			strscpy(hib_comp_algo, hib_comps[i].name,
+				sizeof(hib_comp_algo));
+			unlock_system_sleep();
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static const struct kernel_param_ops hib_comp_param_ops = {
+	.set	= hib_comp_param_set,
+	.get	= param_get_string,
+};
+
+static struct kparam_string hib_comp_param_string = {
+	.maxlen	= sizeof(hib_comp_algo),
+	.string	= hib_comp_algo,
+};
+
+module_param_cb(compressor, &hib_comp_param_ops, &hib_comp_param_string, 0644);
+MODULE_PARM_DESC(compressor, "Compression algorithm for the hibernation image");
+module_param_named(compression_threads, hib_comp_threads, uint, 0644);
+MODULE_PARM_DESC(compression_threads,
+		 "Maximum number of image (de)compression threads");
+
 static int __init hibernate_setup(char *str)
 {
 	if (!strncmp(str, "noresume", 8)) {
@@ -31,6 +31,7 @@
 #include <linux/compiler.h>
 #include <linux/ktime.h>
 #include <linux/set_memory.h>
+#include <linux/sched/clock.h>
 
 #include <linux/uaccess.h>
 #include <asm/mmu_context.h>
@@ -769,28 +770,40 @@ static int memory_bm_find_bit(struct memory_bitmap *bm, unsigned long pfn,
 	return 0;
 }
 
-static void memory_bm_set_bit(struct memory_bitmap *bm, unsigned long pfn)
+/**
+ * memory_bm_find_block - Find the bitmap block covering a given PFN.
+ * @bm: Memory bitmap.
+ * @pfn: PFN to look up.
+ * @addr: Return location for the data of the block.
+ * @bit_nr: Return location for the bit representing @pfn in the block.
+ *
+ * Return the number of PFNs, starting at @pfn, represented by the same block
+ * (and zone), or 0 if @pfn is not covered by @bm.  This allows callers to
+ * process PFN ranges a block at a time instead of looking up every PFN.
+ */
+static unsigned long memory_bm_find_block(struct memory_bitmap *bm,
+					  unsigned long pfn,
+					  unsigned long **addr,
+					  unsigned int *bit_nr)
 {
-	void *addr;
-	unsigned int bit;
-	int error;
+	void *data;
 
-	error = memory_bm_find_bit(bm, pfn, &addr, &bit);
-	BUG_ON(error);
-	set_bit(bit, addr);
+	if (memory_bm_find_bit(bm, pfn, &data, bit_nr))
+		return 0;
+
+	*addr = data;
+	return min(BM_BITS_PER_BLOCK - *bit_nr, bm->cur.zone->end_pfn - pfn);
 }
 
-static int mem_bm_set_bit_check(struct memory_bitmap *bm, unsigned long pfn)
+static void memory_bm_set_bit(struct memory_bitmap *bm, unsigned long pfn)
 {
 	void *addr;
 	unsigned int bit;
 	int error;
 
 	error = memory_bm_find_bit(bm, pfn, &addr, &bit);
-	if (!error)
-		set_bit(bit, addr);
-
-	return error;
+	BUG_ON(error);
+	set_bit(bit, addr);
 }
 
 static void memory_bm_clear_bit(struct memory_bitmap *bm, unsigned long pfn)
@@ -1047,23 +1060,31 @@ static void mark_nosave_pages(struct memory_bitmap *bm)
 		return;
 
 	list_for_each_entry(region, &nosave_regions, list) {
-		unsigned long pfn;
+		unsigned long pfn, nr, i;
+		unsigned long *addr;
+		unsigned int bit;
 
 		pr_debug("Marking nosave pages: [mem %#010llx-%#010llx]\n",
 			 (unsigned long long) region->start_pfn << PAGE_SHIFT,
 			 ((unsigned long long) region->end_pfn << PAGE_SHIFT)
 				- 1);
 
-		for (pfn = region->start_pfn; pfn < region->end_pfn; pfn++)
-			if (pfn_valid(pfn)) {
-				/*
-				 * It is safe to ignore the result of
-				 * mem_bm_set_bit_check() here, since we won't
-				 * touch the PFNs for which the error is
-				 * returned anyway.
-				 */
-				mem_bm_set_bit_check(bm, pfn);
+		for (pfn = region->start_pfn; pfn < region->end_pfn; pfn += nr) {
+			/*
+			 * PFNs not covered by the bitmap are skipped, since we
+			 * won't touch them anyway.
+			 */
+			nr = memory_bm_find_block(bm, pfn, &addr, &bit);
+			if (!nr) {
+				nr = 1;
+				continue;
 			}
+
+			nr = min(nr, region->end_pfn - pfn);
+			for (i = 0; i < nr; i++)
+				if (pfn_valid(pfn + i))
+					__set_bit(bit + i, addr);
+		}
 	}
 }
 
@@ -1189,6 +1210,9 @@ unsigned int snapshot_additional_pages(struct zone *zone)
 	return 2 * rtree;
 }
 
+static unsigned int scan_saveable_pages(struct zone *zone,
+					struct memory_bitmap *bm);
+
 #ifdef CONFIG_HIGHMEM
 /**
  * count_free_highmem_pages - Compute the total number of free highmem pages.
@@ -1213,7 +1237,8 @@ static unsigned int count_free_highmem_pages(void)
  * Determine whether a highmem page should be included in a hibernation image.
  *
  * We should save the page if it isn't Nosave or NosaveFree, or Reserved,
- * and it isn't part of a free chunk of pages.
+ * and it isn't part of a free chunk of pages.  The forbidden and free page
+ * bitmaps are checked by the caller, see scan_saveable_pages().
  */
 static struct page *saveable_highmem_page(struct zone *zone, unsigned long pfn)
 {
@@ -1228,9 +1253,6 @@ static struct page *saveable_highmem_page(struct zone *zone, unsigned long pfn)
 
 	BUG_ON(!PageHighMem(page));
 
-	if (swsusp_page_is_forbidden(page) ||  swsusp_page_is_free(page))
-		return NULL;
-
 	if (PageReserved(page) || PageOffline(page))
 		return NULL;
 
@@ -1248,18 +1270,10 @@ static unsigned int count_highmem_pages(void)
 	struct zone *zone;
 	unsigned int n = 0;
 
-	for_each_populated_zone(zone) {
-		unsigned long pfn, max_zone_pfn;
-
-		if (!is_highmem(zone))
-			continue;
+	for_each_populated_zone(zone)
+		if (is_highmem(zone))
+			n += scan_saveable_pages(zone, NULL);
 
-		mark_free_pages(zone);
-		max_zone_pfn = zone_end_pfn(zone);
-		for (pfn = zone->zone_start_pfn; pfn < max_zone_pfn; pfn++)
-			if (saveable_highmem_page(zone, pfn))
-				n++;
-	}
 	return n;
 }
 #else
@@ -1277,7 +1291,8 @@ static inline void *saveable_highmem_page(struct zone *z, unsigned long p)
  *
  * We should save the page if it isn't Nosave, and is not in the range
  * of pages statically defined as 'unsaveable', and it isn't part of
- * a free chunk of pages.
+ * a free chunk of pages.  The forbidden and free page bitmaps are checked
+ * by the caller, see scan_saveable_pages().
  */
 static struct page *saveable_page(struct zone *zone, unsigned long pfn)
 {
@@ -1292,9 +1307,6 @@ static struct page *saveable_page(struct zone *zone, unsigned long pfn)
 
 	BUG_ON(PageHighMem(page));
 
-	if (swsusp_page_is_forbidden(page) || swsusp_page_is_free(page))
-		return NULL;
-
 	if (PageOffline(page))
 		return NULL;
 
@@ -1314,19 +1326,12 @@ static struct page *saveable_page(struct zone *zone, unsigned long pfn)
 static unsigned int count_data_pages(void)
 {
 	struct zone *zone;
-	unsigned long pfn, max_zone_pfn;
 	unsigned int n = 0;
 
-	for_each_populated_zone(zone) {
-		if (is_highmem(zone))
-			continue;
+	for_each_populated_zone(zone)
+		if (!is_highmem(zone))
+			n += scan_saveable_pages(zone, NULL);
 
-		mark_free_pages(zone);
-		max_zone_pfn = zone_end_pfn(zone);
-		for (pfn = zone->zone_start_pfn; pfn < max_zone_pfn; pfn++)
-			if (saveable_page(zone, pfn))
-				n++;
-	}
 	return n;
 }
 
@@ -1406,21 +1411,78 @@ static inline void copy_data_page(unsigned long dst_pfn, unsigned long src_pfn)
 }
 #endif /* CONFIG_HIGHMEM */
 
+/**
+ * scan_saveable_pages - Find the saveable pages in a zone.
+ * @zone: Memory zone to scan.
+ * @bm: Memory bitmap to mark the saveable pages in (may be NULL).
+ *
+ * Instead of looking up the forbidden and free page bitmaps for every PFN,
+ * walk the zone one bitmap block at a time and skip whole words of page
+ * frames that are all forbidden or free, which covers most of the free memory
+ * of a large machine.  Only the remaining PFNs are checked individually.
+ *
+ * Return the number of saveable pages found.
+ */
+static unsigned int scan_saveable_pages(struct zone *zone,
+					struct memory_bitmap *bm)
+{
+	unsigned long pfn, end_pfn;
+	unsigned int n = 0;
+
+	mark_free_pages(zone);
+	end_pfn = zone_end_pfn(zone);
+	for (pfn = zone->zone_start_pfn; pfn < end_pfn; ) {
+		unsigned long *forbidden, *free, *dst = NULL;
+		unsigned int bit, free_bit, dst_bit = 0;
+		unsigned long nr, i;
+
+		nr = memory_bm_find_block(forbidden_pages_map, pfn,
+					  &forbidden, &bit);
+		nr = min(nr, memory_bm_find_block(free_pages_map, pfn,
+						  &free, &free_bit));
+		if (bm)
+			nr = min(nr, memory_bm_find_block(bm, pfn,
+							  &dst, &dst_bit));
+		/* The bitmaps cover every populated zone. */
+		if (WARN_ON_ONCE(!nr))
+			break;
+
+		nr = min(nr, end_pfn - pfn);
+		for (i = 0; i < nr; i++) {
+			if (bit == free_bit && !((bit + i) % BITS_PER_LONG) &&
+			    i + BITS_PER_LONG <= nr &&
+			    (forbidden[BIT_WORD(bit + i)] |
+			     free[BIT_WORD(bit + i)]) == ~0UL) {
+				i += BITS_PER_LONG - 1;
+				continue;
+			}
+
+			if (test_bit(bit + i, forbidden) ||
+			    test_bit(free_bit + i, free))
+				continue;
+
+			if (!page_is_saveable(zone, pfn + i))
+				continue;
+
+			if (dst)
+				__set_bit(dst_bit + i, dst);
+			n++;
+		}
+		pfn += nr;
+	}
+
+	return n;
+}
+
 static void copy_data_pages(struct memory_bitmap *copy_bm,
 			    struct memory_bitmap *orig_bm)
 {
 	struct zone *zone;
 	unsigned long pfn;
 
-	for_each_populated_zone(zone) {
-		unsigned long max_zone_pfn;
+	for_each_populated_zone(zone)
+		scan_saveable_pages(zone, orig_bm);
 
-		mark_free_pages(zone);
-		max_zone_pfn = zone_end_pfn(zone);
-		for (pfn = zone->zone_start_pfn; pfn < max_zone_pfn; pfn++)
-			if (page_is_saveable(zone, pfn))
-				memory_bm_set_bit(orig_bm, pfn);
-	}
 	memory_bm_position_reset(orig_bm);
 	memory_bm_position_reset(copy_bm);
 	for(;;) {
@@ -1975,12 +2037,19 @@ static int swsusp_alloc(struct memory_bitmap *copy_bm,
 asmlinkage __visible int swsusp_save(void)
 {
 	unsigned int nr_pages, nr_highmem;
+	u64 start, scan, copy;
 
 	pr_info("Creating image:\n");
 
+	/*
+	 * Timekeeping is suspended at this point, so local_clock() is used for
+	 * timing the scan and copy phases.
+	 */
+	start = local_clock();
 	drain_local_pages(NULL);
 	nr_pages = count_data_pages();
 	nr_highmem = count_highmem_pages();
+	scan = local_clock() - start;
 	pr_info("Need to copy %u pages\n", nr_pages + nr_highmem);
 
 	if (!enough_free_mem(nr_pages, nr_highmem)) {
@@ -1998,7 +2067,9 @@ asmlinkage __visible int swsusp_save(void)
 	 * Kill them.
 	 */
 	drain_local_pages(NULL);
+	start = local_clock();
 	copy_data_pages(&copy_bm, &orig_bm);
+	copy = local_clock() - start;
 
 	/*
 	 * End of critical section. From now on, we can write to memory,
@@ -2011,6 +2082,8 @@ asmlinkage __visible int swsusp_save(void)
 	nr_meta_pages = DIV_ROUND_UP(nr_pages * sizeof(long), PAGE_SIZE);
 
 	pr_info("Image created (%d pages copied)\n", nr_pages);
+	pr_info("Image scanned in %llu ms, copied in %llu ms\n",
+		div_u64(scan, NSEC_PER_MSEC), div_u64(copy, NSEC_PER_MSEC));
 
 	return 0;
 }
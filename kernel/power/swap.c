@@ -25,6 +25,7 @@
 #include <linux/pm.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/crypto.h>
 #include <linux/vmalloc.h>
 #include <linux/cpumask.h>
 #include <linux/atomic.h>
@@ -512,23 +513,30 @@ static int swap_writer_finish(struct swap_map_handle *handle,
 }
 
 /* We need to remember how much compressed data we need to read. */
-#define LZO_HEADER	sizeof(size_t)
+#define CMP_HEADER	sizeof(size_t)
 
 /* Number of pages/bytes we'll compress at one time. */
-#define LZO_UNC_PAGES	32
-#define LZO_UNC_SIZE	(LZO_UNC_PAGES * PAGE_SIZE)
+#define UNC_PAGES	32
+#define UNC_SIZE	(UNC_PAGES * PAGE_SIZE)
+
+/*
+ * Worst case expansion of a compressed chunk. LZO has the largest bound of
+ * the supported compressors (LZ4 and zstd both stay well below it), so it
+ * is used for sizing the buffers regardless of the algorithm in use.
+ */
+#define CMP_WORST(n)	lzo1x_worst_compress(n)
 
 /* Number of pages/bytes we need for compressed data (worst case). */
-#define LZO_CMP_PAGES	DIV_ROUND_UP(lzo1x_worst_compress(LZO_UNC_SIZE) + \
-			             LZO_HEADER, PAGE_SIZE)
-#define LZO_CMP_SIZE	(LZO_CMP_PAGES * PAGE_SIZE)
+#define CMP_PAGES	DIV_ROUND_UP(CMP_WORST(UNC_SIZE) + \
+			             CMP_HEADER, PAGE_SIZE)
+#define CMP_SIZE	(CMP_PAGES * PAGE_SIZE)
 
 /* Maximum number of threads for compression/decompression. */
-#define LZO_THREADS	3
+#define CMP_THREADS	16
 
 /* Minimum/maximum number of pages for read buffering. */
-#define LZO_MIN_RD_PAGES	1024
-#define LZO_MAX_RD_PAGES	8192
+#define CMP_MIN_RD_PAGES	1024
+#define CMP_MAX_RD_PAGES	8192
 
 
 /**
@@ -590,8 +598,8 @@ struct crc_data {
 	wait_queue_head_t go;                     /* start crc update */
 	wait_queue_head_t done;                   /* crc update done */
 	u32 *crc32;                               /* points to handle's crc32 */
-	size_t *unc_len[LZO_THREADS];             /* uncompressed lengths */
-	unsigned char *unc[LZO_THREADS];          /* uncompressed data */
+	size_t *unc_len[CMP_THREADS];             /* uncompressed lengths */
+	unsigned char *unc[CMP_THREADS];          /* uncompressed data */
 };
 
 /**
@@ -622,28 +630,31 @@ static int crc32_threadfn(void *data)
 	return 0;
 }
 /**
- * Structure used for LZO data compression.
+ * Structure used for image data compression.
  */
 struct cmp_data {
 	struct task_struct *thr;                  /* thread */
+	struct crypto_comp *cc;                   /* crypto compressor */
 	atomic_t ready;                           /* ready to start flag */
 	atomic_t stop;                            /* ready to stop flag */
 	int ret;                                  /* return code */
+	ktime_t busy;                             /* time spent compressing */
 	wait_queue_head_t go;                     /* start compression */
 	wait_queue_head_t done;                   /* compression done */
 	size_t unc_len;                           /* uncompressed length */
 	size_t cmp_len;                           /* compressed length */
-	unsigned char unc[LZO_UNC_SIZE];          /* uncompressed buffer */
-	unsigned char cmp[LZO_CMP_SIZE];          /* compressed buffer */
-	unsigned char wrk[LZO1X_1_MEM_COMPRESS];  /* compression workspace */
+	unsigned char unc[UNC_SIZE];              /* uncompressed buffer */
+	unsigned char cmp[CMP_SIZE];              /* compressed buffer */
 };
 
 /**
  * Compression function that runs in its own thread.
  */
-static int lzo_compress_threadfn(void *data)
+static int compress_threadfn(void *data)
 {
 	struct cmp_data *d = data;
+	unsigned int cmp_len;
+	ktime_t start;
 
 	while (1) {
 		wait_event(d->go, atomic_read(&d->ready) ||
@@ -657,22 +668,78 @@ static int lzo_compress_threadfn(void *data)
 		}
 		atomic_set(&d->ready, 0);
 
-		d->ret = lzo1x_1_compress(d->unc, d->unc_len,
-		                          d->cmp + LZO_HEADER, &d->cmp_len,
-		                          d->wrk);
+		start = ktime_get();
+		cmp_len = CMP_SIZE - CMP_HEADER;
+		d->ret = crypto_comp_compress(d->cc, d->unc, d->unc_len,
+		                              d->cmp + CMP_HEADER, &cmp_len);
+		d->cmp_len = cmp_len;
+		d->busy = ktime_add(d->busy, ktime_sub(ktime_get(), start));
 		atomic_set(&d->stop, 1);
 		wake_up(&d->done);
 	}
 	return 0;
 }
 
+/*
+ * Time spent by the main thread in each phase of the compressed image
+ * pipeline, plus the total time the (de)compression threads were busy.
+ * Comparing these tells whether the compressor or the storage is the
+ * bottleneck for a given hibernate.compressor choice.
+ */
+struct cmp_stats {
+	ktime_t copy;                             /* snapshot page copies */
+	ktime_t cmp;                              /* waiting for (de)compression */
+	ktime_t io;                               /* swap I/O submit and wait */
+	ktime_t crc;                              /* waiting for CRC32 */
+	ktime_t busy;                             /* (de)compression thread time */
+	u64 unc_bytes;                            /* uncompressed bytes */
+	u64 cmp_bytes;                            /* compressed bytes */
+};
+
+/*
+ * Leave one CPU for the I/O and CRC32 work, and honour the
+ * hibernate.compression_threads limit.
+ */
+static unsigned int cmp_nr_threads(void)
+{
+	unsigned int max = clamp_val(hib_comp_threads, 1, CMP_THREADS);
+
+	return clamp_val(num_online_cpus() - 1, 1, max);
+}
+
+/* Charge the time since *@t to @phase and restart the clock. */
+static inline void cmp_stats_add(ktime_t *phase, ktime_t *t)
+{
+	ktime_t now = ktime_get();
+
+	*phase = ktime_add(*phase, ktime_sub(now, *t));
+	*t = now;
+}
+
+static void cmp_stats_show(struct cmp_stats *st, bool load)
+{
+	const char *msg = load ? "Image loading" : "Image saving";
+	u64 ratio = 0;
+
+	if (st->cmp_bytes)
+		ratio = div64_u64(st->unc_bytes * 100, st->cmp_bytes);
+
+	pr_info("%s (%s): copy %lld ms, %scompress wait %lld ms, I/O %lld ms, CRC32 wait %lld ms\n",
+		msg, hib_comp_algo, ktime_to_ms(st->copy), load ? "de" : "",
+		ktime_to_ms(st->cmp), ktime_to_ms(st->io),
+		ktime_to_ms(st->crc));
+	pr_info("%s (%s): threads busy %lld ms, ratio %llu.%02llu (%llu -> %llu bytes)\n",
+		msg, hib_comp_algo, ktime_to_ms(st->busy),
+		ratio / 100, ratio % 100, st->unc_bytes, st->cmp_bytes);
+}
+
 /**
- * save_image_lzo - Save the suspend image data compressed with LZO.
+ * save_compressed_image - Save the suspend image data compressed.
  * @handle: Swap map handle to use for saving the image.
  * @snapshot: Image to read data from.
  * @nr_to_write: Number of pages to save.
  */
-static int save_image_lzo(struct swap_map_handle *handle,
+static int save_compressed_image(struct swap_map_handle *handle,
                           struct snapshot_handle *snapshot,
                           unsigned int nr_to_write)
 {
@@ -688,6 +755,8 @@ static int save_image_lzo(struct swap_map_handle *handle,
 	unsigned char *page = NULL;
 	struct cmp_data *data = NULL;
 	struct crc_data *crc = NULL;
+	struct cmp_stats st = { 0 };
+	ktime_t t;
 
 	hib_init_batch(&hb);
 
@@ -695,19 +764,18 @@ static int save_image_lzo(struct swap_map_handle *handle,
 	 * We'll limit the number of threads for compression to limit memory
 	 * footprint.
 	 */
-	nr_threads = num_online_cpus() - 1;
-	nr_threads = clamp_val(nr_threads, 1, LZO_THREADS);
+	nr_threads = cmp_nr_threads();
 
 	page = (void *)__get_free_page(GFP_NOIO | __GFP_HIGH);
 	if (!page) {
-		pr_err("Failed to allocate LZO page\n");
+		pr_err("Failed to allocate compression page\n");
 		ret = -ENOMEM;
 		goto out_clean;
 	}
 
 	data = vmalloc(array_size(nr_threads, sizeof(*data)));
 	if (!data) {
-		pr_err("Failed to allocate LZO data\n");
+		pr_err("Failed to allocate compression data\n");
 		ret = -ENOMEM;
 		goto out_clean;
 	}
@@ -729,7 +797,16 @@ static int save_image_lzo(struct swap_map_handle *handle,
 		init_waitqueue_head(&data[thr].go);
 		init_waitqueue_head(&data[thr].done);
 
-		data[thr].thr = kthread_run(lzo_compress_threadfn,
+		data[thr].cc = crypto_alloc_comp(hib_comp_algo, 0, 0);
+		if (IS_ERR(data[thr].cc)) {
+			ret = PTR_ERR(data[thr].cc);
+			data[thr].cc = NULL;
+			pr_err("Could not allocate %s compressor (%d)\n",
+			       hib_comp_algo, ret);
+			goto out_clean;
+		}
+
+		data[thr].thr = kthread_run(compress_threadfn,
 		                            &data[thr],
 		                            "image_compress/%u", thr);
 		if (IS_ERR(data[thr].thr)) {
@@ -767,7 +844,8 @@ static int save_image_lzo(struct swap_map_handle *handle,
 	 */
 	handle->reqd_free_pages = reqd_free_pages();
 
-	pr_info("Using %u thread(s) for compression\n", nr_threads);
+	pr_info("Using %u thread(s) for %s compression\n",
+		nr_threads, hib_comp_algo);
 	pr_info("Compressing and saving image data (%u pages)...\n",
 		nr_to_write);
 	m = nr_to_write / 10;
@@ -775,9 +853,10 @@ static int save_image_lzo(struct swap_map_handle *handle,
 		m = 1;
 	nr_pages = 0;
 	start = ktime_get();
+	t = start;
 	for (;;) {
 		for (thr = 0; thr < nr_threads; thr++) {
-			for (off = 0; off < LZO_UNC_SIZE; off += PAGE_SIZE) {
+			for (off = 0; off < UNC_SIZE; off += PAGE_SIZE) {
 				ret = snapshot_read_next(snapshot);
 				if (ret < 0)
 					goto out_finish;
@@ -797,10 +876,12 @@ static int save_image_lzo(struct swap_map_handle *handle,
 				break;
 
 			data[thr].unc_len = off;
+			st.unc_bytes += off;
 
 			atomic_set(&data[thr].ready, 1);
 			wake_up(&data[thr].go);
 		}
+		cmp_stats_add(&st.copy, &t);
 
 		if (!thr)
 			break;
@@ -813,23 +894,27 @@ static int save_image_lzo(struct swap_map_handle *handle,
 			wait_event(data[thr].done,
 			           atomic_read(&data[thr].stop));
 			atomic_set(&data[thr].stop, 0);
+			cmp_stats_add(&st.cmp, &t);
 
 			ret = data[thr].ret;
 
 			if (ret < 0) {
-				pr_err("LZO compression failed\n");
+				pr_err("%s compression failed\n",
+				       hib_comp_algo);
 				goto out_finish;
 			}
 
 			if (unlikely(!data[thr].cmp_len ||
 			             data[thr].cmp_len >
-			             lzo1x_worst_compress(data[thr].unc_len))) {
-				pr_err("Invalid LZO compressed length\n");
+			             CMP_WORST(data[thr].unc_len))) {
+				pr_err("Invalid %s compressed length\n",
+				       hib_comp_algo);
 				ret = -1;
 				goto out_finish;
 			}
 
 			*(size_t *)data[thr].cmp = data[thr].cmp_len;
+			st.cmp_bytes += data[thr].cmp_len;
 
 			/*
 			 * Given we are writing one page at a time to disk, we
@@ -840,7 +925,7 @@ static int save_image_lzo(struct swap_map_handle *handle,
 			 * read it.
 			 */
 			for (off = 0;
-			     off < LZO_HEADER + data[thr].cmp_len;
+			     off < CMP_HEADER + data[thr].cmp_len;
 			     off += PAGE_SIZE) {
 				memcpy(page, data[thr].cmp + off, PAGE_SIZE);
 
@@ -848,20 +933,26 @@ static int save_image_lzo(struct swap_map_handle *handle,
 				if (ret)
 					goto out_finish;
 			}
+			cmp_stats_add(&st.io, &t);
 		}
 
 		wait_event(crc->done, atomic_read(&crc->stop));
 		atomic_set(&crc->stop, 0);
+		cmp_stats_add(&st.crc, &t);
 	}
 
 out_finish:
 	err2 = hib_wait_io(&hb);
 	stop = ktime_get();
+	cmp_stats_add(&st.io, &t);
 	if (!ret)
 		ret = err2;
 	if (!ret)
 		pr_info("Image saving done\n");
 	swsusp_show_speed(start, stop, nr_to_write, "Wrote");
+	for (thr = 0; thr < nr_threads; thr++)
+		st.busy = ktime_add(st.busy, data[thr].busy);
+	cmp_stats_show(&st, false);
 out_clean:
 	hib_finish_batch(&hb);
 	if (crc) {
@@ -870,9 +961,12 @@ static int save_image_lzo(struct swap_map_handle *handle,
 		kfree(crc);
 	}
 	if (data) {
-		for (thr = 0; thr < nr_threads; thr++)
+		for (thr = 0; thr < nr_threads; thr++) {
 			if (data[thr].thr)
 				kthread_stop(data[thr].thr);
+			if (data[thr].cc)
+				crypto_free_comp(data[thr].cc);
+		}
 		vfree(data);
 	}
 	if (page) free_page((unsigned long)page);
@@ -942,7 +1036,7 @@ int swsusp_write(unsigned int flags)
 	if (!error) {
 		error = (flags & SF_NOCOMPRESS_MODE) ?
 			save_image(&handle, &snapshot, pages - 1) :
-			save_image_lzo(&handle, &snapshot, pages - 1);
+			save_compressed_image(&handle, &snapshot, pages - 1);
 	}
 out_finish:
 	error = swap_writer_finish(&handle, flags, error);
@@ -1109,27 +1203,31 @@ static int load_image(struct swap_map_handle *handle,
 }
 
 /**
- * Structure used for LZO data decompression.
+ * Structure used for image data decompression.
  */
 struct dec_data {
 	struct task_struct *thr;                  /* thread */
+	struct crypto_comp *cc;                   /* crypto compressor */
 	atomic_t ready;                           /* ready to start flag */
 	atomic_t stop;                            /* ready to stop flag */
 	int ret;                                  /* return code */
+	ktime_t busy;                             /* time spent decompressing */
 	wait_queue_head_t go;                     /* start decompression */
 	wait_queue_head_t done;                   /* decompression done */
 	size_t unc_len;                           /* uncompressed length */
 	size_t cmp_len;                           /* compressed length */
-	unsigned char unc[LZO_UNC_SIZE];          /* uncompressed buffer */
-	unsigned char cmp[LZO_CMP_SIZE];          /* compressed buffer */
+	unsigned char unc[UNC_SIZE];              /* uncompressed buffer */
+	unsigned char cmp[CMP_SIZE];              /* compressed buffer */
 };
 
 /**
  * Deompression function that runs in its own thread.
  */
-static int lzo_decompress_threadfn(void *data)
+static int decompress_threadfn(void *data)
 {
 	struct dec_data *d = data;
+	unsigned int unc_len;
+	ktime_t start;
 
 	while (1) {
 		wait_event(d->go, atomic_read(&d->ready) ||
@@ -1143,12 +1241,15 @@ static int lzo_decompress_threadfn(void *data)
 		}
 		atomic_set(&d->ready, 0);
 
-		d->unc_len = LZO_UNC_SIZE;
-		d->ret = lzo1x_decompress_safe(d->cmp + LZO_HEADER, d->cmp_len,
-		                               d->unc, &d->unc_len);
+		start = ktime_get();
+		unc_len = UNC_SIZE;
+		d->ret = crypto_comp_decompress(d->cc, d->cmp + CMP_HEADER,
+		                                d->cmp_len, d->unc, &unc_len);
+		d->unc_len = unc_len;
 		if (clean_pages_on_decompress)
 			flush_icache_range((unsigned long)d->unc,
 					   (unsigned long)d->unc + d->unc_len);
+		d->busy = ktime_add(d->busy, ktime_sub(ktime_get(), start));
 
 		atomic_set(&d->stop, 1);
 		wake_up(&d->done);
@@ -1157,12 +1258,12 @@ static int lzo_decompress_threadfn(void *data)
 }
 
 /**
- * load_image_lzo - Load compressed image data and decompress them with LZO.
+ * load_compressed_image - Load compressed image data and decompress them.
  * @handle: Swap map handle to use for loading data.
  * @snapshot: Image to copy uncompressed data into.
  * @nr_to_read: Number of pages to load.
  */
-static int load_image_lzo(struct swap_map_handle *handle,
+static int load_compressed_image(struct swap_map_handle *handle,
                           struct snapshot_handle *snapshot,
                           unsigned int nr_to_read)
 {
@@ -1181,6 +1282,8 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	unsigned char **page = NULL;
 	struct dec_data *data = NULL;
 	struct crc_data *crc = NULL;
+	struct cmp_stats st = { 0 };
+	ktime_t t;
 
 	hib_init_batch(&hb);
 
@@ -1188,19 +1291,18 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	 * We'll limit the number of threads for decompression to limit memory
 	 * footprint.
 	 */
-	nr_threads = num_online_cpus() - 1;
-	nr_threads = clamp_val(nr_threads, 1, LZO_THREADS);
+	nr_threads = cmp_nr_threads();
 
-	page = vmalloc(array_size(LZO_MAX_RD_PAGES, sizeof(*page)));
+	page = vmalloc(array_size(CMP_MAX_RD_PAGES, sizeof(*page)));
 	if (!page) {
-		pr_err("Failed to allocate LZO page\n");
+		pr_err("Failed to allocate compression page\n");
 		ret = -ENOMEM;
 		goto out_clean;
 	}
 
 	data = vmalloc(array_size(nr_threads, sizeof(*data)));
 	if (!data) {
-		pr_err("Failed to allocate LZO data\n");
+		pr_err("Failed to allocate compression data\n");
 		ret = -ENOMEM;
 		goto out_clean;
 	}
@@ -1224,7 +1326,16 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		init_waitqueue_head(&data[thr].go);
 		init_waitqueue_head(&data[thr].done);
 
-		data[thr].thr = kthread_run(lzo_decompress_threadfn,
+		data[thr].cc = crypto_alloc_comp(hib_comp_algo, 0, 0);
+		if (IS_ERR(data[thr].cc)) {
+			ret = PTR_ERR(data[thr].cc);
+			data[thr].cc = NULL;
+			pr_err("Could not allocate %s decompressor (%d)\n",
+			       hib_comp_algo, ret);
+			goto out_clean;
+		}
+
+		data[thr].thr = kthread_run(decompress_threadfn,
 		                            &data[thr],
 		                            "image_decompress/%u", thr);
 		if (IS_ERR(data[thr].thr)) {
@@ -1265,18 +1376,18 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	 */
 	if (low_free_pages() > snapshot_get_image_size())
 		read_pages = (low_free_pages() - snapshot_get_image_size()) / 2;
-	read_pages = clamp_val(read_pages, LZO_MIN_RD_PAGES, LZO_MAX_RD_PAGES);
+	read_pages = clamp_val(read_pages, CMP_MIN_RD_PAGES, CMP_MAX_RD_PAGES);
 
 	for (i = 0; i < read_pages; i++) {
-		page[i] = (void *)__get_free_page(i < LZO_CMP_PAGES ?
+		page[i] = (void *)__get_free_page(i < CMP_PAGES ?
 						  GFP_NOIO | __GFP_HIGH :
 						  GFP_NOIO | __GFP_NOWARN |
 						  __GFP_NORETRY);
 
 		if (!page[i]) {
-			if (i < LZO_CMP_PAGES) {
+			if (i < CMP_PAGES) {
 				ring_size = i;
-				pr_err("Failed to allocate LZO pages\n");
+				pr_err("Failed to allocate compression pages\n");
 				ret = -ENOMEM;
 				goto out_clean;
 			} else {
@@ -1286,7 +1397,8 @@ static int load_image_lzo(struct swap_map_handle *handle,
 	}
 	want = ring_size = i;
 
-	pr_info("Using %u thread(s) for decompression\n", nr_threads);
+	pr_info("Using %u thread(s) for %s decompression\n",
+		nr_threads, hib_comp_algo);
 	pr_info("Loading and decompressing image data (%u pages)...\n",
 		nr_to_read);
 	m = nr_to_read / 10;
@@ -1294,6 +1406,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		m = 1;
 	nr_pages = 0;
 	start = ktime_get();
+	t = start;
 
 	ret = snapshot_write_next(snapshot);
 	if (ret <= 0)
@@ -1336,24 +1449,27 @@ static int load_image_lzo(struct swap_map_handle *handle,
 			if (eof)
 				eof = 2;
 		}
+		cmp_stats_add(&st.io, &t);
 
 		if (crc->run_threads) {
 			wait_event(crc->done, atomic_read(&crc->stop));
 			atomic_set(&crc->stop, 0);
 			crc->run_threads = 0;
 		}
+		cmp_stats_add(&st.crc, &t);
 
 		for (thr = 0; have && thr < nr_threads; thr++) {
 			data[thr].cmp_len = *(size_t *)page[pg];
 			if (unlikely(!data[thr].cmp_len ||
 			             data[thr].cmp_len >
-			             lzo1x_worst_compress(LZO_UNC_SIZE))) {
-				pr_err("Invalid LZO compressed length\n");
+			             CMP_WORST(UNC_SIZE))) {
+				pr_err("Invalid %s compressed length\n",
+				       hib_comp_algo);
 				ret = -1;
 				goto out_finish;
 			}
 
-			need = DIV_ROUND_UP(data[thr].cmp_len + LZO_HEADER,
+			need = DIV_ROUND_UP(data[thr].cmp_len + CMP_HEADER,
 			                    PAGE_SIZE);
 			if (need > have) {
 				if (eof > 1) {
@@ -1364,7 +1480,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 			}
 
 			for (off = 0;
-			     off < LZO_HEADER + data[thr].cmp_len;
+			     off < CMP_HEADER + data[thr].cmp_len;
 			     off += PAGE_SIZE) {
 				memcpy(data[thr].cmp + off,
 				       page[pg], PAGE_SIZE);
@@ -1374,14 +1490,17 @@ static int load_image_lzo(struct swap_map_handle *handle,
 					pg = 0;
 			}
 
+			st.cmp_bytes += data[thr].cmp_len;
+
 			atomic_set(&data[thr].ready, 1);
 			wake_up(&data[thr].go);
 		}
+		cmp_stats_add(&st.copy, &t);
 
 		/*
 		 * Wait for more data while we are decompressing.
 		 */
-		if (have < LZO_CMP_PAGES && asked) {
+		if (have < CMP_PAGES && asked) {
 			ret = hib_wait_io(&hb);
 			if (ret)
 				goto out_finish;
@@ -1390,26 +1509,31 @@ static int load_image_lzo(struct swap_map_handle *handle,
 			if (eof)
 				eof = 2;
 		}
+		cmp_stats_add(&st.io, &t);
 
 		for (run_threads = thr, thr = 0; thr < run_threads; thr++) {
 			wait_event(data[thr].done,
 			           atomic_read(&data[thr].stop));
 			atomic_set(&data[thr].stop, 0);
+			cmp_stats_add(&st.cmp, &t);
 
 			ret = data[thr].ret;
 
 			if (ret < 0) {
-				pr_err("LZO decompression failed\n");
+				pr_err("%s decompression failed\n",
+				       hib_comp_algo);
 				goto out_finish;
 			}
 
 			if (unlikely(!data[thr].unc_len ||
-			             data[thr].unc_len > LZO_UNC_SIZE ||
+			             data[thr].unc_len > UNC_SIZE ||
 			             data[thr].unc_len & (PAGE_SIZE - 1))) {
-				pr_err("Invalid LZO uncompressed length\n");
+				pr_err("Invalid %s uncompressed length\n",
+				       hib_comp_algo);
 				ret = -1;
 				goto out_finish;
 			}
+			st.unc_bytes += data[thr].unc_len;
 
 			for (off = 0;
 			     off < data[thr].unc_len; off += PAGE_SIZE) {
@@ -1429,6 +1553,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 					goto out_finish;
 				}
 			}
+			cmp_stats_add(&st.copy, &t);
 		}
 
 		crc->run_threads = thr;
@@ -1442,6 +1567,7 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		atomic_set(&crc->stop, 0);
 	}
 	stop = ktime_get();
+	cmp_stats_add(&st.crc, &t);
 	if (!ret) {
 		pr_info("Image loading done\n");
 		snapshot_write_finalize(snapshot);
@@ -1457,6 +1583,9 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		}
 	}
 	swsusp_show_speed(start, stop, nr_to_read, "Read");
+	for (thr = 0; thr < nr_threads; thr++)
+		st.busy = ktime_add(st.busy, data[thr].busy);
+	cmp_stats_show(&st, true);
 out_clean:
 	hib_finish_batch(&hb);
 	for (i = 0; i < ring_size; i++)
@@ -1467,9 +1596,12 @@ static int load_image_lzo(struct swap_map_handle *handle,
 		kfree(crc);
 	}
 	if (data) {
-		for (thr = 0; thr < nr_threads; thr++)
+		for (thr = 0; thr < nr_threads; thr++) {
 			if (data[thr].thr)
 				kthread_stop(data[thr].thr);
+			if (data[thr].cc)
+				crypto_free_comp(data[thr].cc);
+		}
 		vfree(data);
 	}
 	vfree(page);
@@ -1500,10 +1632,12 @@ int swsusp_read(unsigned int *flags_p)
 		goto end;
 	if (!error)
 		error = swap_read_page(&handle, header, NULL);
+	if (!error && !(*flags_p & SF_NOCOMPRESS_MODE))
+		error = hib_comp_select(*flags_p);
 	if (!error) {
 		error = (*flags_p & SF_NOCOMPRESS_MODE) ?
 			load_image(&handle, &snapshot, header->pages - 1) :
-			load_image_lzo(&handle, &snapshot, header->pages - 1);
+			load_compressed_image(&handle, &snapshot, header->pages - 1);
 	}
 	swap_reader_finish(&handle);
 end:
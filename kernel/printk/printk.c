@@ -42,6 +42,7 @@
 #include <linux/rculist.h>
 #include <linux/poll.h>
 #include <linux/irq_work.h>
+#include <linux/kthread.h>
 #include <linux/ctype.h>
 #include <linux/uio.h>
 #include <linux/sched/clock.h>
@@ -211,9 +212,6 @@ int devkmsg_sysctl_set_loglvl(struct ctl_table *table, int write,
 	return 0;
 }
 
-/* Number of registered extended console drivers. */
-static int nr_ext_console_drivers;
-
 /*
  * Helper macros to handle lockdep when locking/unlocking console_sem. We use
  * macros instead of functions so that _RET_IP_ contains useful information.
@@ -267,9 +265,123 @@ static void __up_console_sem(unsigned long ip)
 static int console_locked, console_suspended;
 
 /*
- * If exclusive_console is non-NULL then only this console is to be printed to.
+ * Set once the per-console printing kthreads have been started. Until then,
+ * and whenever a kthread could not be created, printk() prints directly to
+ * the consoles from the calling context.
+ */
+static bool printk_kthreads_available;
+
+/*
+ * Tracks whether the printing kthreads are blocked via console_lock(). A
+ * value of true implies that the console is locked via console_lock() or
+ * that the console is suspended. Writing requires holding @console_sem.
+ */
+static bool console_kthreads_blocked;
+
+/*
+ * Block all printing kthreads from a schedulable context.
+ *
+ * Requires holding @console_sem.
+ */
+static void console_kthreads_block(void)
+{
+	struct console *con;
+
+	for_each_console(con) {
+		mutex_lock(&con->lock);
+		con->blocked = true;
+		mutex_unlock(&con->lock);
+	}
+
+	console_kthreads_blocked = true;
+}
+
+/*
+ * Unblock all printing kthreads from a schedulable context.
+ *
+ * Requires holding @console_sem.
+ */
+static void console_kthreads_unblock(void)
+{
+	struct console *con;
+
+	for_each_console(con) {
+		mutex_lock(&con->lock);
+		con->blocked = false;
+		mutex_unlock(&con->lock);
+	}
+
+	console_kthreads_blocked = false;
+}
+
+/*
+ * Counts the printing kthreads currently inside a console driver. A value
+ * of -1 means console_trylock() has blocked them from atomic context, which
+ * only succeeds while none of them is printing.
+ */
+static atomic_t console_kthreads_active = ATOMIC_INIT(0);
+
+#define console_kthreads_atomic_tryblock() \
+	(atomic_cmpxchg(&console_kthreads_active, 0, -1) == 0)
+#define console_kthreads_atomic_unblock() \
+	atomic_cmpxchg(&console_kthreads_active, -1, 0)
+#define console_kthreads_atomically_blocked() \
+	(atomic_read(&console_kthreads_active) == -1)
+
+#define console_kthread_printing_tryenter() \
+	atomic_inc_unless_negative(&console_kthreads_active)
+#define console_kthread_printing_exit() \
+	atomic_dec(&console_kthreads_active)
+
+/* An oops is in progress or the kernel panics. */
+static inline bool console_emergency(void)
+{
+	return (oops_in_progress ||
+		atomic_read(&panic_cpu) != PANIC_CPU_INVALID);
+}
+
+/*
+ * Set when console_trylock() took the console_lock in an emergency without
+ * blocking the printing kthreads, see console_kthreads_atomic_tryforce().
+ * Writing requires holding @console_sem.
  */
-static struct console *exclusive_console;
+static bool console_kthreads_bypassed;
+
+/*
+ * Block the printing kthreads from atomic context. In an emergency, don't
+ * depend on a printing kthread leaving its console driver: it may never
+ * do so, e.g. when the oops happened in that very driver, and kdump does
+ * not get to console_flush_on_panic(). Go ahead without blocking it
+ * instead. The kthreads don't enter the drivers during an emergency, so
+ * at most the record being printed by one of them may get interleaved.
+ *
+ * Requires holding @console_sem.
+ */
+static bool console_kthreads_atomic_tryforce(void)
+{
+	if (console_kthreads_atomic_tryblock())
+		return true;
+	if (!console_emergency())
+		return false;
+	console_kthreads_bypassed = true;
+	return true;
+}
+
+/*
+ * Direct console printing is used while the printing kthreads are not
+ * available, and in emergencies: once the system is going down, an oops
+ * is in progress or the kernel panics, the kthreads cannot be relied upon
+ * to get scheduled.
+ */
+static inline bool allow_direct_printing(void)
+{
+	return (!printk_kthreads_available ||
+		system_state > SYSTEM_RUNNING ||
+		console_emergency());
+}
+
+static void printk_start_kthread(struct console *con);
+static void printk_stop_kthread(struct console *con);
 
 /*
  *	Array of consoles built from command line options (console=)
@@ -397,11 +509,6 @@ static u64 syslog_seq;
 static size_t syslog_partial;
 static bool syslog_time;
 
-/* the next printk record to write to the console */
-static u64 console_seq;
-static u64 exclusive_console_stop_seq;
-static unsigned long console_dropped;
-
 /* the next printk record to read after the last 'clear' command */
 static u64 clear_seq;
 
@@ -1843,50 +1950,6 @@ static int console_trylock_spinning(void)
 	return 1;
 }
 
-/*
- * Call the console drivers, asking them to write out
- * log_buf[start] to log_buf[end - 1].
- * The console_lock must be held.
- */
-static void call_console_drivers(const char *ext_text, size_t ext_len,
-				 const char *text, size_t len)
-{
-	static char dropped_text[64];
-	size_t dropped_len = 0;
-	struct console *con;
-
-	trace_console_rcuidle(text, len);
-
-	if (!console_drivers)
-		return;
-
-	if (console_dropped) {
-		dropped_len = snprintf(dropped_text, sizeof(dropped_text),
-				       "** %lu printk messages dropped **\n",
-				       console_dropped);
-		console_dropped = 0;
-	}
-
-	for_each_console(con) {
-		if (exclusive_console && con != exclusive_console)
-			continue;
-		if (!(con->flags & CON_ENABLED))
-			continue;
-		if (!con->write)
-			continue;
-		if (!cpu_online(smp_processor_id()) &&
-		    !(con->flags & CON_ANYTIME))
-			continue;
-		if (con->flags & CON_EXTENDED)
-			con->write(con, ext_text, ext_len);
-		else {
-			if (dropped_len)
-				con->write(con, dropped_text, dropped_len);
-			con->write(con, text, len);
-		}
-	}
-}
-
 int printk_delay_msec __read_mostly;
 
 static inline void printk_delay(void)
@@ -2011,8 +2074,12 @@ asmlinkage int vprintk_emit(int facility, int level,
 	printed_len = vprintk_store(facility, level, dev_info, fmt, args);
 	logbuf_unlock_irqrestore(flags);
 
-	/* If called from the scheduler, we can not call up(). */
-	if (!in_sched) {
+	/*
+	 * If called from the scheduler, we can not call up(). Otherwise
+	 * only print from this context while the printing kthreads cannot
+	 * be relied upon; they are woken below.
+	 */
+	if (!in_sched && allow_direct_printing()) {
 		/*
 		 * Disable preemption to avoid being preempted while holding
 		 * console_sem which would prevent anyone from printing to
@@ -2052,10 +2119,12 @@ EXPORT_SYMBOL_GPL(vprintk_default);
  *
  * This is printk(). It can be called from any context. We want it to work.
  *
- * We try to grab the console_lock. If we succeed, it's easy - we log the
- * output and call the console drivers.  If we fail to get the semaphore, we
- * place the output into the log buffer and return. The current holder of
- * the console_sem will notice the new output in console_unlock(); and will
+ * The output is placed into the log buffer and the per-console printing
+ * kthreads are woken to send it to the consoles at their own pace. Before
+ * the kthreads are running, and in emergencies such as a panic, we instead
+ * try to grab the console_lock. If we succeed, we call the console drivers
+ * ourselves. If we fail to get the semaphore, the current holder of the
+ * console_sem will notice the new output in console_unlock(); and will
  * send it to the consoles before releasing the lock.
  *
  * One effect of this deferred printing is that code which calls printk() and
@@ -2088,11 +2157,9 @@ EXPORT_SYMBOL(printk);
 
 #define prb_read_valid(rb, seq, r)	false
 #define prb_first_valid_seq(rb)		0
+#define prb_next_seq(rb)		0
 
 static u64 syslog_seq;
-static u64 console_seq;
-static u64 exclusive_console_stop_seq;
-static unsigned long console_dropped;
 
 static size_t record_print_text(const struct printk_record *r,
 				bool syslog, bool time)
@@ -2109,8 +2176,6 @@ static ssize_t msg_print_ext_body(char *buf, size_t size,
 				  struct dev_printk_info *dev_info) { return 0; }
 static void console_lock_spinning_enable(void) { }
 static int console_lock_spinning_disable_and_check(void) { return 0; }
-static void call_console_drivers(const char *ext_text, size_t ext_len,
-				 const char *text, size_t len) {}
 static bool suppress_message_printing(int level) { return false; }
 
 #endif /* CONFIG_PRINTK */
@@ -2306,6 +2371,7 @@ static int console_cpu_notify(unsigned int cpu)
  *
  * Acquires a lock which guarantees that the caller has
  * exclusive access to the console system and the console_drivers list.
+ * The printing kthreads are blocked for as long as the lock is held.
  *
  * Can sleep, returns nothing.
  */
@@ -2316,6 +2382,7 @@ void console_lock(void)
 	down_console_sem();
 	if (console_suspended)
 		return;
+	console_kthreads_block();
 	console_locked = 1;
 	console_may_schedule = 1;
 }
@@ -2325,7 +2392,9 @@ EXPORT_SYMBOL(console_lock);
  * console_trylock - try to lock the console system for exclusive use.
  *
  * Try to acquire a lock which guarantees that the caller has exclusive
- * access to the console system and the console_drivers list.
+ * access to the console system and the console_drivers list. This fails
+ * as well if a printing kthread is currently inside a console driver,
+ * unless an oops is in progress or the kernel panics.
  *
  * returns 1 on success, and 0 on failure to acquire the lock.
  */
@@ -2337,6 +2406,10 @@ int console_trylock(void)
 		up_console_sem();
 		return 0;
 	}
+	if (!console_kthreads_atomic_tryforce()) {
+		up_console_sem();
+		return 0;
+	}
 	console_locked = 1;
 	console_may_schedule = 0;
 	return 1;
@@ -2349,32 +2422,251 @@ int is_console_locked(void)
 }
 EXPORT_SYMBOL(is_console_locked);
 
+static inline bool __console_is_usable(short flags)
+{
+	if (!(flags & CON_ENABLED))
+		return false;
+
+	/*
+	 * Console drivers may assume that per-cpu resources have been
+	 * allocated. So unless they're explicitly marked as being able to
+	 * cope (CON_ANYTIME) don't call them until this CPU is officially up.
+	 */
+	if (!cpu_online(raw_smp_processor_id()) &&
+	    !(flags & CON_ANYTIME))
+		return false;
+
+	return true;
+}
+
 /*
- * Check if we have any console that is capable of printing while cpu is
- * booting or shutting down. Requires console_sem.
+ * Check if the given console is currently capable and allowed to print
+ * records.
+ *
+ * Requires holding the console_lock, or the console's lock with the
+ * printing kthreads not blocked.
  */
-static int have_callable_console(void)
+static inline bool console_is_usable(struct console *con)
 {
-	struct console *con;
+	if (!con->write)
+		return false;
 
-	for_each_console(con)
-		if ((con->flags & CON_ENABLED) &&
-				(con->flags & CON_ANYTIME))
-			return 1;
+	return __console_is_usable(con->flags);
+}
 
-	return 0;
+static void __console_unlock(void)
+{
+	console_locked = 0;
+
+	/*
+	 * Depending on whether console_lock() or console_trylock() was used,
+	 * appropriately allow the printing kthreads to continue.
+	 */
+	if (console_kthreads_blocked)
+		console_kthreads_unblock();
+	else if (console_kthreads_bypassed)
+		console_kthreads_bypassed = false;
+	else
+		console_kthreads_atomic_unblock();
+
+	/*
+	 * New records may have arrived while the console was locked.
+	 * Wake the printing kthreads to print them.
+	 */
+	wake_up_klogd();
+
+	up_console_sem();
 }
 
+#define DROPPED_TEXT_MAX	64
+
 /*
- * Can we actually use the console at this time on this cpu?
+ * Write out one formatted record to @con, preceded by a notice about any
+ * records that were lost since the last one written to this console.
+ */
+static void call_console_driver(struct console *con, const char *text,
+				size_t len, char *dropped_text)
+{
+	size_t dropped_len;
+
+	trace_console_rcuidle(text, len);
+
+	if (con->dropped) {
+		if (dropped_text) {
+			dropped_len = snprintf(dropped_text, DROPPED_TEXT_MAX,
+					       "** %lu printk messages dropped **\n",
+					       con->dropped);
+			con->write(con, dropped_text, dropped_len);
+		}
+		con->dropped = 0;
+	}
+
+	con->write(con, text, len);
+}
+
+/*
+ * Print one record for the given console. The record printed is whatever
+ * record is the next available record for the given console.
+ *
+ * @text is a buffer of size LOG_LINE_MAX + PREFIX_MAX.
+ *
+ * If extended messages should be printed, @ext_text is a buffer of size
+ * CONSOLE_EXT_LOG_MAX. Otherwise @ext_text must be NULL.
+ *
+ * If dropped messages should be printed, @dropped_text is a buffer of size
+ * DROPPED_TEXT_MAX. Otherwise @dropped_text must be NULL.
+ *
+ * @handover will be set to true if a printk waiter has taken over the
+ * console_lock, in which case the caller is no longer holding the
+ * console_lock. Otherwise it is set to false. A NULL @handover means the
+ * caller is a printing kthread, which does not hold the console_lock and
+ * calls the console driver with interrupts enabled.
  *
- * Console drivers may assume that per-cpu resources have been allocated. So
- * unless they're explicitly marked as being able to cope (CON_ANYTIME) don't
- * call them until this CPU is officially up.
+ * Returns false if the given console has no next record to print,
+ * otherwise true.
  */
-static inline int can_use_console(void)
+static bool console_emit_next_record(struct console *con, char *text,
+				     char *ext_text, char *dropped_text,
+				     bool *handover)
 {
-	return cpu_online(raw_smp_processor_id()) || have_callable_console();
+	struct printk_info info;
+	struct printk_record r;
+	unsigned long flags;
+	char *write_text;
+	size_t len;
+
+	prb_rec_init_rd(&r, &info, text, LOG_LINE_MAX + PREFIX_MAX);
+
+	if (handover)
+		*handover = false;
+
+	logbuf_lock_irqsave(flags);
+	if (!prb_read_valid(prb, con->seq, &r)) {
+		logbuf_unlock_irqrestore(flags);
+		return false;
+	}
+
+	if (con->seq != r.info->seq) {
+		con->dropped += r.info->seq - con->seq;
+		con->seq = r.info->seq;
+	}
+
+	/* Skip records that have a level above the console loglevel. */
+	if (suppress_message_printing(r.info->level)) {
+		con->seq++;
+		logbuf_unlock_irqrestore(flags);
+		return true;
+	}
+
+	if (ext_text) {
+		write_text = ext_text;
+		len = info_print_ext_header(ext_text, CONSOLE_EXT_LOG_MAX,
+					    r.info);
+		len += msg_print_ext_body(ext_text + len,
+					  CONSOLE_EXT_LOG_MAX - len,
+					  &r.text_buf[0], r.info->text_len,
+					  &r.info->dev_info);
+	} else {
+		write_text = text;
+		len = record_print_text(&r,
+				console_msg_format & MSG_FORMAT_SYSLOG,
+				printk_time);
+	}
+	con->seq++;
+	logbuf_unlock_irqrestore(flags);
+
+	if (!handover) {
+		call_console_driver(con, write_text, len, dropped_text);
+		return true;
+	}
+
+	printk_safe_enter_irqsave(flags);
+
+	/*
+	 * While actively printing out messages, if another printk()
+	 * were to occur on another CPU, it may wait for this one to
+	 * finish. This task can not be preempted if there is a
+	 * waiter waiting to take over.
+	 */
+	console_lock_spinning_enable();
+
+	stop_critical_timings();	/* don't trace print latency */
+	call_console_driver(con, write_text, len, dropped_text);
+	start_critical_timings();
+
+	*handover = console_lock_spinning_disable_and_check();
+
+	printk_safe_exit_irqrestore(flags);
+
+	return true;
+}
+
+/*
+ * Print out all remaining records to all consoles.
+ *
+ * @do_cond_resched is set by the caller. It can be true only in schedulable
+ * context.
+ *
+ * @next_seq is set to the sequence number after the last available record.
+ * The value is valid only when this function returns true.
+ *
+ * @handover will be set to true if a printk waiter has taken over the
+ * console_lock, in which case the caller is no longer holding the
+ * console_lock.
+ *
+ * Returns true when there was at least one usable console and all records
+ * available at the time have been printed. Requires the console_lock.
+ */
+static bool console_flush_all(bool do_cond_resched, u64 *next_seq,
+			      bool *handover)
+{
+	static char dropped_text[DROPPED_TEXT_MAX];
+	static char ext_text[CONSOLE_EXT_LOG_MAX];
+	static char text[LOG_LINE_MAX + PREFIX_MAX];
+	bool any_usable = false;
+	struct console *con;
+	bool any_progress;
+
+	*next_seq = 0;
+	*handover = false;
+
+	do {
+		any_progress = false;
+
+		for_each_console(con) {
+			bool progress;
+
+			if (!console_is_usable(con))
+				continue;
+			any_usable = true;
+
+			if (con->flags & CON_EXTENDED) {
+				/* Extended consoles do not print "dropped messages". */
+				progress = console_emit_next_record(con, &text[0],
+								    &ext_text[0], NULL,
+								    handover);
+			} else {
+				progress = console_emit_next_record(con, &text[0],
+								    NULL, &dropped_text[0],
+								    handover);
+			}
+			if (*handover)
+				return false;
+
+			/* Track the next of the highest seq flushed. */
+			if (con->seq > *next_seq)
+				*next_seq = con->seq;
+
+			if (!progress)
+				continue;
+			any_progress = true;
+
+			if (do_cond_resched)
+				cond_resched();
+		}
+	} while (any_progress);
+
+	return any_usable;
 }
 
 /**
@@ -2384,8 +2676,9 @@ static inline int can_use_console(void)
  * and the console driver list.
  *
  * While the console_lock was held, console output may have been buffered
- * by printk().  If this is the case, console_unlock(); emits
- * the output prior to releasing the lock.
+ * by printk(). Normally the printing kthreads are woken to emit it; only
+ * while they are unavailable, or in an emergency, console_unlock(); emits
+ * the output itself prior to releasing the lock.
  *
  * If there is output waiting, we wake /dev/kmsg and syslog() users.
  *
@@ -2393,20 +2686,16 @@ static inline int can_use_console(void)
  */
 void console_unlock(void)
 {
-	static char ext_text[CONSOLE_EXT_LOG_MAX];
-	static char text[LOG_LINE_MAX + PREFIX_MAX];
-	unsigned long flags;
-	bool do_cond_resched, retry;
-	struct printk_info info;
-	struct printk_record r;
+	bool do_cond_resched;
+	bool handover;
+	bool flushed;
+	u64 next_seq;
 
 	if (console_suspended) {
 		up_console_sem();
 		return;
 	}
 
-	prb_rec_init_rd(&r, &info, text, sizeof(text));
-
 	/*
 	 * Console drivers are called with interrupts disabled, so
 	 * @console_may_schedule should be cleared before; however, we may
@@ -2425,96 +2714,20 @@ void console_unlock(void)
 again:
 	console_may_schedule = 0;
 
-	/*
-	 * We released the console_sem lock, so we need to recheck if
-	 * cpu is online and (if not) is there at least one CON_ANYTIME
-	 * console.
-	 */
-	if (!can_use_console()) {
-		console_locked = 0;
-		up_console_sem();
+	if (!allow_direct_printing()) {
+		__console_unlock();
 		return;
 	}
 
-	for (;;) {
-		size_t ext_len = 0;
-		size_t len;
-
-		printk_safe_enter_irqsave(flags);
-		raw_spin_lock(&logbuf_lock);
-skip:
-		if (!prb_read_valid(prb, console_seq, &r))
-			break;
-
-		if (console_seq != r.info->seq) {
-			console_dropped += r.info->seq - console_seq;
-			console_seq = r.info->seq;
-		}
-
-		if (suppress_message_printing(r.info->level)) {
-			/*
-			 * Skip record we have buffered and already printed
-			 * directly to the console when we received it, and
-			 * record that has level above the console loglevel.
-			 */
-			console_seq++;
-			goto skip;
-		}
-
-		/* Output to all consoles once old messages replayed. */
-		if (unlikely(exclusive_console &&
-			     console_seq >= exclusive_console_stop_seq)) {
-			exclusive_console = NULL;
-		}
-
-		/*
-		 * Handle extended console text first because later
-		 * record_print_text() will modify the record buffer in-place.
-		 */
-		if (nr_ext_console_drivers) {
-			ext_len = info_print_ext_header(ext_text,
-						sizeof(ext_text),
-						r.info);
-			ext_len += msg_print_ext_body(ext_text + ext_len,
-						sizeof(ext_text) - ext_len,
-						&r.text_buf[0],
-						r.info->text_len,
-						&r.info->dev_info);
-		}
-		len = record_print_text(&r,
-				console_msg_format & MSG_FORMAT_SYSLOG,
-				printk_time);
-		console_seq++;
-		raw_spin_unlock(&logbuf_lock);
-
-		/*
-		 * While actively printing out messages, if another printk()
-		 * were to occur on another CPU, it may wait for this one to
-		 * finish. This task can not be preempted if there is a
-		 * waiter waiting to take over.
-		 */
-		console_lock_spinning_enable();
-
-		stop_critical_timings();	/* don't trace print latency */
-		call_console_drivers(ext_text, ext_len, text, len);
-		start_critical_timings();
-
-		if (console_lock_spinning_disable_and_check()) {
-			printk_safe_exit_irqrestore(flags);
-			return;
-		}
-
-		printk_safe_exit_irqrestore(flags);
-
-		if (do_cond_resched)
-			cond_resched();
-	}
-
-	console_locked = 0;
+	flushed = console_flush_all(do_cond_resched, &next_seq, &handover);
+	if (handover)
+		return;
 
-	raw_spin_unlock(&logbuf_lock);
+	__console_unlock();
 
-	up_console_sem();
+	/* Were there any consoles available for flushing? */
+	if (!flushed)
+		return;
 
 	/*
 	 * Someone could have filled up the buffer again, so re-check if there's
@@ -2522,12 +2735,7 @@ void console_unlock(void)
 	 * there's a new owner and the console_unlock() from them will do the
 	 * flush, no worries.
 	 */
-	raw_spin_lock(&logbuf_lock);
-	retry = prb_read_valid(prb, console_seq, NULL);
-	raw_spin_unlock(&logbuf_lock);
-	printk_safe_exit_irqrestore(flags);
-
-	if (retry && console_trylock())
+	if (prb_read_valid(prb, next_seq, NULL) && console_trylock())
 		goto again;
 }
 EXPORT_SYMBOL(console_unlock);
@@ -2559,6 +2767,10 @@ void console_unblank(void)
 	if (oops_in_progress) {
 		if (down_trylock_console_sem() != 0)
 			return;
+		if (!console_kthreads_atomic_tryforce()) {
+			up_console_sem();
+			return;
+		}
 	} else
 		console_lock();
 
@@ -2574,7 +2786,9 @@ void console_unblank(void)
  * console_flush_on_panic - flush console content on panic
  * @mode: flush all messages in buffer or just the pending ones
  *
- * Immediately output all pending messages no matter what.
+ * Immediately output all pending messages no matter what. This is the
+ * emergency path: the consoles are written directly from the panic CPU,
+ * ignoring any printing kthread that was stopped in the middle of a record.
  */
 void console_flush_on_panic(enum con_flush_mode mode)
 {
@@ -2589,10 +2803,14 @@ void console_flush_on_panic(enum con_flush_mode mode)
 	console_may_schedule = 0;
 
 	if (mode == CONSOLE_REPLAY_ALL) {
+		struct console *c;
 		unsigned long flags;
+		u64 seq;
 
 		logbuf_lock_irqsave(flags);
-		console_seq = prb_first_valid_seq(prb);
+		seq = prb_first_valid_seq(prb);
+		for_each_console(c)
+			c->seq = seq;
 		logbuf_unlock_irqrestore(flags);
 	}
 	console_unlock();
@@ -2797,6 +3015,11 @@ void register_console(struct console *newcon)
 	if (bcon && ((newcon->flags & (CON_CONSDEV | CON_BOOT)) == CON_CONSDEV))
 		newcon->flags &= ~CON_PRINTBUFFER;
 
+	newcon->dropped = 0;
+	newcon->thread = NULL;
+	newcon->blocked = true;
+	mutex_init(&newcon->lock);
+
 	/*
 	 *	Put this console in the list - keep the
 	 *	preferred driver at the head of the list.
@@ -2814,29 +3037,39 @@ void register_console(struct console *newcon)
 		console_drivers->next = newcon;
 	}
 
-	if (newcon->flags & CON_EXTENDED)
-		nr_ext_console_drivers++;
-
+	/*
+	 * Each console prints at its own pace, so replaying the log buffer
+	 * only affects the just-registered console. Its kthread, or
+	 * console_unlock(); while printing directly, prints out the
+	 * buffered messages for us.
+	 */
+	logbuf_lock_irqsave(flags);
 	if (newcon->flags & CON_PRINTBUFFER) {
+		newcon->seq = syslog_seq;
+	} else {
+		/* Begin with next message. */
+		newcon->seq = prb_next_seq(prb);
+
 		/*
-		 * console_unlock(); will print out the buffered messages
-		 * for us.
-		 */
-		logbuf_lock_irqsave(flags);
-		/*
-		 * We're about to replay the log buffer.  Only do this to the
-		 * just-registered console to avoid excessive message spam to
-		 * the already-registered consoles.
-		 *
-		 * Set exclusive_console with disabled interrupts to reduce
-		 * race window with eventual console_flush_on_panic() that
-		 * ignores console_lock.
+		 * If a real console replaces the boot consoles, start where
+		 * the furthest behind one left off. The boot consoles are
+		 * unregistered below and must not take unprinted messages
+		 * with them.
 		 */
-		exclusive_console = newcon;
-		exclusive_console_stop_seq = console_seq;
-		console_seq = syslog_seq;
-		logbuf_unlock_irqrestore(flags);
+		if (bcon) {
+			for_each_console(bcon) {
+				if ((bcon->flags & (CON_BOOT | CON_ENABLED)) ==
+				    (CON_BOOT | CON_ENABLED) &&
+				    bcon->seq < newcon->seq)
+					newcon->seq = bcon->seq;
+			}
+		}
 	}
+	logbuf_unlock_irqrestore(flags);
+
+	if (printk_kthreads_available)
+		printk_start_kthread(newcon);
+
 	console_unlock();
 	console_sysfs_notify();
 
@@ -2896,9 +3129,6 @@ int unregister_console(struct console *console)
 	if (res)
 		goto out_disable_unlock;
 
-	if (console->flags & CON_EXTENDED)
-		nr_ext_console_drivers--;
-
 	/*
 	 * If this isn't the last console and it has CON_CONSDEV set, we
 	 * need to set it on the next preferred console.
@@ -2910,6 +3140,12 @@ int unregister_console(struct console *console)
 	console_unlock();
 	console_sysfs_notify();
 
+	/*
+	 * The console is no longer in the list, so its kthread stays
+	 * blocked and can be stopped without holding the console_lock.
+	 */
+	printk_stop_kthread(console);
+
 	if (console->exit)
 		res = console->exit(console);
 
@@ -3002,6 +3238,192 @@ static int __init printk_late_init(void)
 }
 late_initcall(printk_late_init);
 
+#ifdef CONFIG_PRINTK
+static bool printer_should_wake(struct console *con, u64 seq)
+{
+	short flags;
+
+	if (kthread_should_stop())
+		return true;
+
+	if (con->blocked || console_kthreads_atomically_blocked() ||
+	    console_emergency())
+		return false;
+
+	/*
+	 * This is an unsafe read from con->flags, but a false positive is
+	 * not a problem. Worst case it would allow the printer to wake up
+	 * although it is disabled. But the printer will notice that when
+	 * attempting to print and instead go back to sleep.
+	 */
+	flags = data_race(READ_ONCE(con->flags));
+	if (!__console_is_usable(flags))
+		return false;
+
+	return prb_read_valid(prb, seq, NULL);
+}
+
+static int printk_kthread_func(void *data)
+{
+	struct console *con = data;
+	char *dropped_text = NULL;
+	char *ext_text = NULL;
+	char *text;
+	u64 seq = 0;
+	int error;
+
+	text = kmalloc(LOG_LINE_MAX + PREFIX_MAX, GFP_KERNEL);
+	if (!text)
+		goto out_fallback;
+
+	if (con->flags & CON_EXTENDED) {
+		ext_text = kmalloc(CONSOLE_EXT_LOG_MAX, GFP_KERNEL);
+		if (!ext_text)
+			goto out_fallback;
+	} else {
+		dropped_text = kmalloc(DROPPED_TEXT_MAX, GFP_KERNEL);
+		if (!dropped_text)
+			goto out_fallback;
+	}
+
+	for (;;) {
+		error = wait_event_interruptible(log_wait,
+				printer_should_wake(con, seq));
+
+		if (kthread_should_stop())
+			break;
+
+		if (error)
+			continue;
+
+		error = mutex_lock_interruptible(&con->lock);
+		if (error)
+			continue;
+
+		if (con->blocked ||
+		    !console_kthread_printing_tryenter()) {
+			/* Another context has locked the console_lock. */
+			mutex_unlock(&con->lock);
+			continue;
+		}
+
+		/* Leave emergencies to direct printing, see console_trylock(). */
+		if (console_emergency()) {
+			console_kthread_printing_exit();
+			mutex_unlock(&con->lock);
+			continue;
+		}
+
+		/*
+		 * Although this context has not locked the console_lock, it
+		 * is known that the console_lock is not locked and it is not
+		 * possible for any other context to lock the console_lock.
+		 * Therefore it is safe to read con->flags.
+		 */
+		if (!__console_is_usable(con->flags)) {
+			console_kthread_printing_exit();
+			mutex_unlock(&con->lock);
+			continue;
+		}
+
+		console_emit_next_record(con, text, ext_text, dropped_text,
+					 NULL);
+
+		seq = con->seq;
+
+		console_kthread_printing_exit();
+
+		mutex_unlock(&con->lock);
+
+		cond_resched();
+	}
+	goto out;
+
+out_fallback:
+	/*
+	 * Without its buffers this console cannot be served by a kthread.
+	 * Fall back to printing directly from printk() and wait to be
+	 * stopped by unregister_console().
+	 */
+	pr_err("%sconsole [%s%d]: failed to allocate printing thread buffers\n",
+	       (con->flags & CON_BOOT) ? "boot" : "",
+	       con->name, con->index);
+	printk_kthreads_available = false;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+out:
+	kfree(dropped_text);
+	kfree(ext_text);
+	kfree(text);
+
+	return 0;
+}
+
+/*
+ * Start the printing kthread for @con. If it cannot be created, printk()
+ * falls back to printing directly to all consoles.
+ *
+ * Requires holding @console_sem.
+ */
+static void printk_start_kthread(struct console *con)
+{
+	struct task_struct *tsk;
+
+	tsk = kthread_create(printk_kthread_func, con, "pr/%s%d",
+			     con->name, con->index);
+	if (IS_ERR(tsk)) {
+		pr_err("%sconsole [%s%d]: unable to start printing thread\n",
+		       (con->flags & CON_BOOT) ? "boot" : "",
+		       con->name, con->index);
+		printk_kthreads_available = false;
+		return;
+	}
+
+	/* Pinned until printk_stop_kthread() has reaped the kthread. */
+	get_task_struct(tsk);
+	con->thread = tsk;
+	wake_up_process(tsk);
+}
+
+static void printk_stop_kthread(struct console *con)
+{
+	if (!con->thread)
+		return;
+
+	kthread_stop(con->thread);
+	put_task_struct(con->thread);
+	con->thread = NULL;
+}
+
+/*
+ * From here on printk() only stores records into the ringbuffer and wakes
+ * the printing kthreads, one per registered console, which drain it at the
+ * pace of their console.
+ */
+static int __init printk_activate_kthreads(void)
+{
+	struct console *con;
+
+	console_lock();
+	printk_kthreads_available = true;
+	for_each_console(con)
+		printk_start_kthread(con);
+	console_unlock();
+
+	return 0;
+}
+early_initcall(printk_activate_kthreads);
+#else /* CONFIG_PRINTK */
+static void printk_start_kthread(struct console *con) { }
+static void printk_stop_kthread(struct console *con) { }
+#endif /* CONFIG_PRINTK */
+
 #if defined CONFIG_PRINTK
 /*
  * Delayed printk version, for scheduler-internal messages:
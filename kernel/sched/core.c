@@ -2610,6 +2610,94 @@ static void __ttwu_queue_wakelist(struct task_struct *p, int cpu, int wake_flags
 	__smp_call_single_queue(cpu, &p->wake_entry.llist);
 }
 
+/*
+ * Batched wakeups, see sched_ttwu_batch_begin().  Remote wakeups are
+ * collected on the target CPUs rq::ttwu_batch list, and each target CPU
+ * gets a single IPI once the batch ends.
+ */
+struct ttwu_batch {
+	unsigned int		depth;
+	unsigned int		nr_tasks;
+	struct cpumask		cpus;
+};
+
+static DEFINE_PER_CPU(struct ttwu_batch, ttwu_batch);
+
+static void ttwu_batch_func(void *info)
+{
+	struct rq *rq = info;
+
+	sched_ttwu_pending(llist_del_all(&rq->ttwu_batch));
+}
+
+static void __ttwu_queue_batch(struct task_struct *p, int cpu, int wake_flags)
+{
+	struct ttwu_batch *batch = this_cpu_ptr(&ttwu_batch);
+	struct rq *rq = cpu_rq(cpu);
+
+	p->sched_remote_wakeup = !!(wake_flags & WF_MIGRATED);
+
+	WRITE_ONCE(rq->ttwu_pending, 1);
+	llist_add(&p->wake_entry.llist, &rq->ttwu_batch);
+
+	batch->nr_tasks++;
+	__cpumask_set_cpu(cpu, &batch->cpus);
+}
+
+/**
+ * sched_ttwu_batch_begin - start batching remote wakeups
+ *
+ * Until the matching sched_ttwu_batch_end(), the tasks woken up to other
+ * CPUs through their wakelist, as well as the ones woken up to idle CPUs
+ * which would need to be kicked anyway, are queued without sending an IPI.
+ *
+ * Must be called with preemption disabled, which must stay so until
+ * sched_ttwu_batch_end().
+ *
+ * Return: true if batching is enabled, and sched_ttwu_batch_end() must be
+ * called.
+ */
+bool sched_ttwu_batch_begin(void)
+{
+	if (!sched_feat(TTWU_BATCH))
+		return false;
+
+	this_cpu_inc(ttwu_batch.depth);
+	return true;
+}
+
+/**
+ * sched_ttwu_batch_end - end batching remote wakeups
+ *
+ * Send one IPI to each CPU which got tasks queued by the outermost batch.
+ */
+void sched_ttwu_batch_end(void)
+{
+	struct ttwu_batch *batch;
+	unsigned long flags;
+	int cpu;
+
+	local_irq_save(flags);
+	batch = this_cpu_ptr(&ttwu_batch);
+	if (--batch->depth || !batch->nr_tasks)
+		goto out;
+
+	schedstat_inc(this_rq()->ttwu_batch_count);
+	schedstat_add(this_rq()->ttwu_batch_tasks, batch->nr_tasks);
+	for_each_cpu(cpu, &batch->cpus) {
+		/*
+		 * -EBUSY means the csd is queued but its function hasn't
+		 * run yet, it will pick up the tasks added above.
+		 */
+		smp_call_function_single_async(cpu, &cpu_rq(cpu)->ttwu_batch_csd);
+		schedstat_inc(this_rq()->ttwu_batch_ipis);
+	}
+	cpumask_clear(&batch->cpus);
+	batch->nr_tasks = 0;
+out:
+	local_irq_restore(flags);
+}
+
 void wake_up_if_idle(int cpu)
 {
 	struct rq *rq = cpu_rq(cpu);
@@ -2657,6 +2745,16 @@ static inline bool ttwu_queue_cond(int cpu, int wake_flags)
 	if ((wake_flags & WF_ON_CPU) && cpu_rq(cpu)->nr_running <= 1)
 		return true;
 
+	/*
+	 * When waking up a batch of tasks, an idle CPU has to be kicked
+	 * anyway, so rather let it activate all the tasks woken up to it
+	 * after a single IPI.
+	 */
+	if (this_cpu_read(ttwu_batch.depth) && cpu != smp_processor_id() &&
+	    (cpumask_test_cpu(cpu, this_cpu_ptr(&ttwu_batch.cpus)) ||
+	     available_idle_cpu(cpu)))
+		return true;
+
 	return false;
 }
 
@@ -2667,7 +2765,10 @@ static bool ttwu_queue_wakelist(struct task_struct *p, int cpu, int wake_flags)
 			return false;
 
 		sched_clock_cpu(cpu); /* Sync clocks across CPUs */
-		__ttwu_queue_wakelist(p, cpu, wake_flags);
+		if (this_cpu_read(ttwu_batch.depth))
+			__ttwu_queue_batch(p, cpu, wake_flags);
+		else
+			__ttwu_queue_wakelist(p, cpu, wake_flags);
 		return true;
 	}
 
@@ -7184,6 +7285,8 @@ void __init sched_init(void)
 		INIT_LIST_HEAD(&rq->cfs_tasks);
 
 		rq_attach_root(rq, &def_root_domain);
+		init_llist_head(&rq->ttwu_batch);
+		rq_csd_init(rq, &rq->ttwu_batch_csd, ttwu_batch_func);
 #ifdef CONFIG_NO_HZ_COMMON
 		rq->last_blocked_load_update_tick = jiffies;
 		atomic_set(&rq->nohz_flags, 0);
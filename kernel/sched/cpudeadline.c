@@ -23,7 +23,7 @@ static inline int right_child(int i)
 	return (i << 1) + 2;
 }
 
-static void cpudl_heapify_down(struct cpudl *cp, int idx)
+static void cpudl_heapify_down(struct cpudl_heap *cp, int idx)
 {
 	int l, r, largest;
 
@@ -66,7 +66,7 @@ static void cpudl_heapify_down(struct cpudl *cp, int idx)
 	cp->elements[cp->elements[idx].cpu].idx = idx;
 }
 
-static void cpudl_heapify_up(struct cpudl *cp, int idx)
+static void cpudl_heapify_up(struct cpudl_heap *cp, int idx)
 {
 	int p;
 
@@ -92,7 +92,7 @@ static void cpudl_heapify_up(struct cpudl *cp, int idx)
 	cp->elements[cp->elements[idx].cpu].idx = idx;
 }
 
-static void cpudl_heapify(struct cpudl *cp, int idx)
+static void cpudl_heapify(struct cpudl_heap *cp, int idx)
 {
 	if (idx > 0 && dl_time_before(cp->elements[parent(idx)].dl,
 				cp->elements[idx].dl))
@@ -101,17 +101,54 @@ static void cpudl_heapify(struct cpudl *cp, int idx)
 		cpudl_heapify_down(cp, idx);
 }
 
-static inline int cpudl_maximum(struct cpudl *cp)
+static inline int cpudl_maximum(struct cpudl_heap *cp)
 {
 	return cp->elements[0].cpu;
 }
 
+static inline struct cpudl_heap *cpudl_heap_of(struct cpudl *cp, int cpu)
+{
+	return cp->heaps[cp->cpu_to_heap[cpu]];
+}
+
+/*
+ * Make the maximum of @heap the best candidate if @p may run there and its
+ * deadline is later than the one of the current *@best_cpu.
+ */
+static void cpudl_find_heap(struct cpudl_heap *heap, struct task_struct *p,
+			    int *best_cpu, u64 *best_dl)
+{
+	int cpu;
+	u64 dl;
+
+	if (!READ_ONCE(heap->size))
+		return;
+
+	cpu = cpudl_maximum(heap);
+	dl = heap->elements[0].dl;
+	schedstat_inc(this_rq()->cpudl_search_len);
+
+	WARN_ON(cpu != -1 && !cpu_present(cpu));
+
+	if (!cpumask_test_cpu(cpu, p->cpus_ptr))
+		return;
+
+	if (*best_cpu == -1 || dl_time_before(*best_dl, dl)) {
+		*best_cpu = cpu;
+		*best_dl = dl;
+	}
+}
+
 /*
  * cpudl_find - find the best (later-dl) CPU in the system
  * @cp: the cpudl max-heap context
  * @p: the task
  * @later_mask: a mask to fill in with the selected CPUs (or NULL)
  *
+ * The maxima of the heaps of the nodes with CPUs in the root domain are
+ * compared without taking their locks, starting with the node the task is
+ * on, so that of equally late CPUs the local one is picked.
+ *
  * Returns: int - CPUs were found
  */
 int cpudl_find(struct cpudl *cp, struct task_struct *p,
@@ -147,12 +184,20 @@ int cpudl_find(struct cpudl *cp, struct task_struct *p,
 
 		return 1;
 	} else {
-		int best_cpu = cpudl_maximum(cp);
-
-		WARN_ON(best_cpu != -1 && !cpu_present(best_cpu));
+		int node = cpu_to_node(task_cpu(p));
+		int i, best_cpu = -1;
+		u64 best_dl = 0;
+
+		cpudl_find_heap(cp->heaps[node], p, &best_cpu, &best_dl);
+		for_each_node_mask(i, *cp->nodes) {
+			if (i != node)
+				cpudl_find_heap(cp->heaps[i], p, &best_cpu,
+						&best_dl);
+		}
+		schedstat_inc(this_rq()->cpudl_find_count);
 
-		if (cpumask_test_cpu(best_cpu, p->cpus_ptr) &&
-		    dl_time_before(dl_se->deadline, cp->elements[0].dl)) {
+		if (best_cpu != -1 &&
+		    dl_time_before(dl_se->deadline, best_dl)) {
 			if (later_mask)
 				cpumask_set_cpu(best_cpu, later_mask);
 
@@ -171,8 +216,9 @@ int cpudl_find(struct cpudl *cp, struct task_struct *p,
  *
  * Returns: (void)
  */
-void cpudl_clear(struct cpudl *cp, int cpu)
+void cpudl_clear(struct cpudl *cl, int cpu)
 {
+	struct cpudl_heap *cp = cpudl_heap_of(cl, cpu);
 	int old_idx, new_cpu;
 	unsigned long flags;
 
@@ -196,7 +242,7 @@ void cpudl_clear(struct cpudl *cp, int cpu)
 		cp->elements[cpu].idx = IDX_INVALID;
 		cpudl_heapify(cp, old_idx);
 
-		cpumask_set_cpu(cpu, cp->free_cpus);
+		cpumask_set_cpu(cpu, cl->free_cpus);
 	}
 	raw_spin_unlock_irqrestore(&cp->lock, flags);
 }
@@ -211,8 +257,9 @@ void cpudl_clear(struct cpudl *cp, int cpu)
  *
  * Returns: (void)
  */
-void cpudl_set(struct cpudl *cp, int cpu, u64 dl)
+void cpudl_set(struct cpudl *cl, int cpu, u64 dl)
 {
+	struct cpudl_heap *cp = cpudl_heap_of(cl, cpu);
 	int old_idx;
 	unsigned long flags;
 
@@ -228,7 +275,7 @@ void cpudl_set(struct cpudl *cp, int cpu, u64 dl)
 		cp->elements[new_idx].cpu = cpu;
 		cp->elements[cpu].idx = new_idx;
 		cpudl_heapify_up(cp, new_idx);
-		cpumask_clear_cpu(cpu, cp->free_cpus);
+		cpumask_clear_cpu(cpu, cl->free_cpus);
 	} else {
 		cp->elements[old_idx].dl = dl;
 		cpudl_heapify(cp, old_idx);
@@ -260,29 +307,58 @@ void cpudl_clear_freecpu(struct cpudl *cp, int cpu)
 /*
  * cpudl_init - initialize the cpudl structure
  * @cp: the cpudl max-heap context
+ * @nodes: the nodes with CPUs in the root domain
  */
-int cpudl_init(struct cpudl *cp)
+int cpudl_init(struct cpudl *cp, const nodemask_t *nodes)
 {
-	int i;
+	int i, node;
 
-	raw_spin_lock_init(&cp->lock);
-	cp->size = 0;
-
-	cp->elements = kcalloc(nr_cpu_ids,
-			       sizeof(struct cpudl_item),
-			       GFP_KERNEL);
-	if (!cp->elements)
+	cp->nodes = nodes;
+	cp->heaps = kcalloc(nr_node_ids, sizeof(*cp->heaps), GFP_KERNEL);
+	if (!cp->heaps)
 		return -ENOMEM;
 
-	if (!zalloc_cpumask_var(&cp->free_cpus, GFP_KERNEL)) {
-		kfree(cp->elements);
-		return -ENOMEM;
+	for (node = 0; node < nr_node_ids; node++) {
+		struct cpudl_heap *heap;
+
+		heap = kzalloc_node(sizeof(*heap), GFP_KERNEL, node);
+		if (!heap)
+			goto cleanup;
+		cp->heaps[node] = heap;
+
+		raw_spin_lock_init(&heap->lock);
+		heap->size = 0;
+
+		/*
+		 * The elements are indexed both by heap position and by CPU,
+		 * hence sized for all CPUs even though only the node's CPUs
+		 * are ever inserted.
+		 */
+		heap->elements = kcalloc_node(nr_cpu_ids,
+					      sizeof(struct cpudl_item),
+					      GFP_KERNEL, node);
+		if (!heap->elements)
+			goto cleanup;
+
+		for_each_possible_cpu(i)
+			heap->elements[i].idx = IDX_INVALID;
 	}
 
+	cp->cpu_to_heap = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
+	if (!cp->cpu_to_heap)
+		goto cleanup;
+
 	for_each_possible_cpu(i)
-		cp->elements[i].idx = IDX_INVALID;
+		cp->cpu_to_heap[i] = cpu_to_node(i);
+
+	if (!zalloc_cpumask_var(&cp->free_cpus, GFP_KERNEL))
+		goto cleanup;
 
 	return 0;
+
+cleanup:
+	cpudl_cleanup(cp);
+	return -ENOMEM;
 }
 
 /*
@@ -291,6 +367,18 @@ int cpudl_init(struct cpudl *cp)
  */
 void cpudl_cleanup(struct cpudl *cp)
 {
+	int node;
+
 	free_cpumask_var(cp->free_cpus);
-	kfree(cp->elements);
+	kfree(cp->cpu_to_heap);
+	for (node = 0; node < nr_node_ids; node++) {
+		struct cpudl_heap *heap = cp->heaps[node];
+
+		if (!heap)
+			continue;
+
+		kfree(heap->elements);
+		kfree(heap);
+	}
+	kfree(cp->heaps);
 }
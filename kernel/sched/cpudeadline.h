@@ -8,18 +8,29 @@ struct cpudl_item {
 	int			idx;
 };
 
-struct cpudl {
+/*
+ * One max-heap per NUMA node, each with its own lock, so that deadline
+ * updates on different nodes don't contend.  Searches compare the maxima
+ * of all the heaps, starting with the task's own node.
+ */
+struct cpudl_heap {
 	raw_spinlock_t		lock;
 	int			size;
-	cpumask_var_t		free_cpus;
 	struct cpudl_item	*elements;
+} ____cacheline_aligned;
+
+struct cpudl {
+	struct cpudl_heap	**heaps;
+	const nodemask_t	*nodes;
+	int			*cpu_to_heap;
+	cpumask_var_t		free_cpus;
 };
 
 #ifdef CONFIG_SMP
 int  cpudl_find(struct cpudl *cp, struct task_struct *p, struct cpumask *later_mask);
 void cpudl_set(struct cpudl *cp, int cpu, u64 dl);
 void cpudl_clear(struct cpudl *cp, int cpu);
-int  cpudl_init(struct cpudl *cp);
+int  cpudl_init(struct cpudl *cp, const nodemask_t *nodes);
 void cpudl_set_freecpu(struct cpudl *cp, int cpu);
 void cpudl_clear_freecpu(struct cpudl *cp, int cpu);
 void cpudl_cleanup(struct cpudl *cp);
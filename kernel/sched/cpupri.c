@@ -41,10 +41,9 @@ static int convert_prio(int prio)
 	return cpupri;
 }
 
-static inline int __cpupri_find(struct cpupri *cp, struct task_struct *p,
-				struct cpumask *lowest_mask, int idx)
+static inline int __cpupri_find(struct cpupri_vec *vec, struct task_struct *p,
+				struct cpumask *lowest_mask)
 {
-	struct cpupri_vec *vec  = &cp->pri_to_cpu[idx];
 	int skip = 0;
 
 	if (!atomic_read(&(vec)->count))
@@ -94,6 +93,75 @@ static inline int __cpupri_find(struct cpupri *cp, struct task_struct *p,
 	return 1;
 }
 
+/*
+ * Same as __cpupri_find(), but for the vectors at priority @idx of the
+ * shards in @pending.  @lowest_mask gets the union of their CPUs.  Shards
+ * with no CPU left at priority @idx or above, up to @end, are dropped from
+ * @pending: the levels they are populated at have all been passed already.
+ */
+static int __cpupri_find_remote(struct cpupri *cp, struct task_struct *p,
+				struct cpumask *lowest_mask, int idx, int end,
+				nodemask_t *pending, unsigned int *probes)
+{
+	int node;
+
+	if (lowest_mask)
+		cpumask_clear(lowest_mask);
+
+	for_each_node_mask(node, *pending) {
+		struct cpupri_shard *shard = cp->shards[node];
+		struct cpupri_vec *vec = &shard->pri_to_cpu[idx];
+		int next, skip;
+
+		next = find_next_bit(shard->active, end, idx);
+		if (next >= end)
+			node_clear(node, *pending);
+		if (next != idx)
+			continue;
+
+		(*probes)++;
+		skip = !atomic_read(&vec->count);
+		/* See __cpupri_find() */
+		smp_rmb();
+		if (skip)
+			continue;
+
+		if (!lowest_mask) {
+			if (cpumask_intersects(p->cpus_ptr, vec->mask))
+				return 1;
+			continue;
+		}
+
+		cpumask_or(lowest_mask, lowest_mask, vec->mask);
+	}
+
+	if (!lowest_mask)
+		return 0;
+
+	return cpumask_and(lowest_mask, lowest_mask, p->cpus_ptr);
+}
+
+/* Ensure the capacity of the CPUs in @lowest_mask fit the task */
+static bool cpupri_fits(struct task_struct *p, struct cpumask *lowest_mask,
+			bool (*fitness_fn)(struct task_struct *p, int cpu))
+{
+	int cpu;
+
+	if (!lowest_mask || !fitness_fn)
+		return true;
+
+	for_each_cpu(cpu, lowest_mask) {
+		if (!fitness_fn(p, cpu))
+			cpumask_clear_cpu(cpu, lowest_mask);
+	}
+
+	/*
+	 * If no CPU at the current priority can fit the task
+	 * continue looking
+	 */
+	return !cpumask_empty(lowest_mask);
+}
+
 int cpupri_find(struct cpupri *cp, struct task_struct *p,
 		struct cpumask *lowest_mask)
 {
@@ -108,6 +176,14 @@ int cpupri_find(struct cpupri *cp, struct task_struct *p,
  * @fitness_fn: A pointer to a function to do custom checks whether the CPU
  *              fits a specific criteria so that we only return those CPUs.
  *
+ * At each priority level the shard of the node the task is on is looked at
+ * first, and only if it has no suitable CPU are the other shards searched.
+ * Only the shards of the nodes with CPUs in the root domain are searched,
+ * and each only until its highest populated level has been passed.
+ * The lowest priority level found is the same as with a single global
+ * vector, but when the local node has CPUs at that level only those are
+ * returned.
+ *
  * Note: This function returns the recommended CPUs as calculated during the
  * current invocation.  By the time the call returns, the CPUs may have in
  * fact changed priorities any number of times.  While not ideal, it is not
@@ -122,33 +198,41 @@ int cpupri_find_fitness(struct cpupri *cp, struct task_struct *p,
 		bool (*fitness_fn)(struct task_struct *p, int cpu))
 {
 	int task_pri = convert_prio(p->prio);
-	int idx, cpu;
+	int node = cpu_to_node(task_cpu(p));
+	nodemask_t pending = NODE_MASK_NONE;
+	unsigned int probes = 0;
+	int idx, found = 0;
 
 	BUG_ON(task_pri >= CPUPRI_NR_PRIORITIES);
 
-	for (idx = 0; idx < task_pri; idx++) {
-
-		if (!__cpupri_find(cp, p, lowest_mask, idx))
-			continue;
+	if (nr_node_ids > 1) {
+		pending = *cp->nodes;
+		node_clear(node, pending);
+	}
 
-		if (!lowest_mask || !fitness_fn)
-			return 1;
+	for (idx = 0; idx < task_pri; idx++) {
+		probes++;
+		if (__cpupri_find(&cp->shards[node]->pri_to_cpu[idx],
+				  p, lowest_mask) &&
+		    cpupri_fits(p, lowest_mask, fitness_fn)) {
+			found = 1;
+			break;
+		}
 
-		/* Ensure the capacity of the CPUs fit the task */
-		for_each_cpu(cpu, lowest_mask) {
-			if (!fitness_fn(p, cpu))
-				cpumask_clear_cpu(cpu, lowest_mask);
+		if (!nodes_empty(pending) &&
+		    __cpupri_find_remote(cp, p, lowest_mask, idx, task_pri,
+					 &pending, &probes) &&
+		    cpupri_fits(p, lowest_mask, fitness_fn)) {
+			found = 1;
+			break;
 		}
+	}
 
-		/*
-		 * If no CPU at the current priority can fit the task
-		 * continue looking
-		 */
-		if (cpumask_empty(lowest_mask))
-			continue;
+	schedstat_inc(this_rq()->cpupri_find_count);
+	schedstat_add(this_rq()->cpupri_search_len, probes);
 
+	if (found)
 		return 1;
-	}
 
 	/*
 	 * If we failed to find a fitting lowest_mask, kick off a new search
@@ -185,6 +269,7 @@ int cpupri_find_fitness(struct cpupri *cp, struct task_struct *p,
  */
 void cpupri_set(struct cpupri *cp, int cpu, int newpri)
 {
+	struct cpupri_shard *shard = cp->shards[cp->cpu_to_shard[cpu]];
 	int *currpri = &cp->cpu_to_pri[cpu];
 	int oldpri = *currpri;
 	int do_mb = 0;
@@ -203,7 +288,7 @@ void cpupri_set(struct cpupri *cp, int cpu, int newpri)
 	 * cpu being missed by the priority loop in cpupri_find.
 	 */
 	if (likely(newpri != CPUPRI_INVALID)) {
-		struct cpupri_vec *vec = &cp->pri_to_cpu[newpri];
+		struct cpupri_vec *vec = &shard->pri_to_cpu[newpri];
 
 		cpumask_set_cpu(cpu, vec->mask);
 		/*
@@ -212,11 +297,12 @@ void cpupri_set(struct cpupri *cp, int cpu, int newpri)
 		 * make sure the vector is visible when count is set.
 		 */
 		smp_mb__before_atomic();
-		atomic_inc(&(vec)->count);
+		if (atomic_inc_return(&(vec)->count) == 1)
+			set_bit(newpri, shard->active);
 		do_mb = 1;
 	}
 	if (likely(oldpri != CPUPRI_INVALID)) {
-		struct cpupri_vec *vec  = &cp->pri_to_cpu[oldpri];
+		struct cpupri_vec *vec  = &shard->pri_to_cpu[oldpri];
 
 		/*
 		 * Because the order of modification of the vec->count
@@ -237,7 +323,17 @@ void cpupri_set(struct cpupri *cp, int cpu, int newpri)
 		 * When removing from the vector, we decrement the counter first
 		 * do a memory barrier and then clear the mask.
 		 */
-		atomic_dec(&(vec)->count);
+		if (atomic_dec_and_test(&(vec)->count)) {
+			/*
+			 * Recheck after clearing the level's active bit: a
+			 * CPU that got there in the meantime may have set
+			 * the bit before we cleared it.
+			 */
+			clear_bit(oldpri, shard->active);
+			smp_mb__after_atomic();
+			if (atomic_read(&(vec)->count))
+				set_bit(oldpri, shard->active);
+		}
 		smp_mb__after_atomic();
 		cpumask_clear_cpu(cpu, vec->mask);
 	}
@@ -248,33 +344,54 @@ void cpupri_set(struct cpupri *cp, int cpu, int newpri)
 /**
  * cpupri_init - initialize the cpupri structure
  * @cp: The cpupri context
+ * @nodes: The nodes with CPUs in the root domain
  *
  * Return: -ENOMEM on memory allocation failure.
  */
-int cpupri_init(struct cpupri *cp)
+int cpupri_init(struct cpupri *cp, const nodemask_t *nodes)
 {
-	int i;
+	int i, node;
 
-	for (i = 0; i < CPUPRI_NR_PRIORITIES; i++) {
-		struct cpupri_vec *vec = &cp->pri_to_cpu[i];
+	cp->nodes = nodes;
+	cp->shards = kcalloc(nr_node_ids, sizeof(*cp->shards), GFP_KERNEL);
+	if (!cp->shards)
+		return -ENOMEM;
 
-		atomic_set(&vec->count, 0);
-		if (!zalloc_cpumask_var(&vec->mask, GFP_KERNEL))
+	for (node = 0; node < nr_node_ids; node++) {
+		struct cpupri_shard *shard;
+
+		shard = kzalloc_node(sizeof(*shard), GFP_KERNEL, node);
+		if (!shard)
 			goto cleanup;
+		cp->shards[node] = shard;
+
+		for (i = 0; i < CPUPRI_NR_PRIORITIES; i++) {
+			struct cpupri_vec *vec = &shard->pri_to_cpu[i];
+
+			atomic_set(&vec->count, 0);
+			if (!zalloc_cpumask_var_node(&vec->mask, GFP_KERNEL,
+						     node))
+				goto cleanup;
+		}
 	}
 
 	cp->cpu_to_pri = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
 	if (!cp->cpu_to_pri)
 		goto cleanup;
 
-	for_each_possible_cpu(i)
+	cp->cpu_to_shard = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
+	if (!cp->cpu_to_shard)
+		goto cleanup;
+
+	for_each_possible_cpu(i) {
 		cp->cpu_to_pri[i] = CPUPRI_INVALID;
+		cp->cpu_to_shard[i] = cpu_to_node(i);
+	}
 
 	return 0;
 
 cleanup:
-	for (i--; i >= 0; i--)
-		free_cpumask_var(cp->pri_to_cpu[i].mask);
+	cpupri_cleanup(cp);
 	return -ENOMEM;
 }
 
@@ -284,9 +401,19 @@ int cpupri_init(struct cpupri *cp)
  */
 void cpupri_cleanup(struct cpupri *cp)
 {
-	int i;
+	int i, node;
 
+	kfree(cp->cpu_to_shard);
 	kfree(cp->cpu_to_pri);
-	for (i = 0; i < CPUPRI_NR_PRIORITIES; i++)
-		free_cpumask_var(cp->pri_to_cpu[i].mask);
+	for (node = 0; node < nr_node_ids; node++) {
+		struct cpupri_shard *shard = cp->shards[node];
+
+		if (!shard)
+			continue;
+
+		for (i = 0; i < CPUPRI_NR_PRIORITIES; i++)
+			free_cpumask_var(shard->pri_to_cpu[i].mask);
+		kfree(shard);
+	}
+	kfree(cp->shards);
 }
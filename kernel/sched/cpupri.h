@@ -12,9 +12,23 @@ struct cpupri_vec {
 	cpumask_var_t		mask;
 };
 
-struct cpupri {
+/*
+ * The priority vectors are sharded per NUMA node: a CPU changing priority
+ * only writes to the counts and masks of its own node, and searches look at
+ * the task's node before falling back to the other ones.  @active has a bit
+ * set for each non-empty vector, so that searches can skip the levels, and
+ * eventually the whole shard, with no CPU on them.
+ */
+struct cpupri_shard {
 	struct cpupri_vec	pri_to_cpu[CPUPRI_NR_PRIORITIES];
+	DECLARE_BITMAP(active, CPUPRI_NR_PRIORITIES);
+};
+
+struct cpupri {
+	struct cpupri_shard	**shards;
+	const nodemask_t	*nodes;
 	int			*cpu_to_pri;
+	int			*cpu_to_shard;
 };
 
 #ifdef CONFIG_SMP
@@ -24,6 +38,6 @@ int  cpupri_find_fitness(struct cpupri *cp, struct task_struct *p,
 			 struct cpumask *lowest_mask,
 			 bool (*fitness_fn)(struct task_struct *p, int cpu));
 void cpupri_set(struct cpupri *cp, int cpu, int pri);
-int  cpupri_init(struct cpupri *cp);
+int  cpupri_init(struct cpupri *cp, const nodemask_t *nodes);
 void cpupri_cleanup(struct cpupri *cp);
 #endif
@@ -2184,6 +2184,7 @@ static int push_dl_task(struct rq *rq)
 	 */
 	update_rq_clock(later_rq);
 	activate_task(later_rq, next_task, ENQUEUE_NOCLOCK);
+	schedstat_inc(rq->dl_push_count);
 	ret = 1;
 
 	resched_curr(later_rq);
@@ -2272,6 +2273,7 @@ static void pull_dl_task(struct rq *this_rq)
 			deactivate_task(src_rq, p, 0);
 			set_task_cpu(p, this_cpu);
 			activate_task(this_rq, p, 0);
+			schedstat_inc(this_rq->dl_pull_count);
 			dmin = p->dl.deadline;
 
 			/* Is there any other task even earlier? */
@@ -2363,14 +2365,18 @@ void __init init_sched_dl_class(void)
 					GFP_KERNEL, cpu_to_node(i));
 }
 
-void dl_add_task_root_domain(struct task_struct *p)
+/*
+ * Account @p's bandwidth to its root domain, provided it runs on one of
+ * @cpus, the CPUs whose root domain accounting is being recomputed.
+ */
+void dl_add_task_root_domain(struct task_struct *p, const struct cpumask *cpus)
 {
 	struct rq_flags rf;
 	struct rq *rq;
 	struct dl_bw *dl_b;
 
 	rq = task_rq_lock(p, &rf);
-	if (!dl_task(p))
+	if (!dl_task(p) || !cpumask_test_cpu(cpu_of(rq), cpus))
 		goto unlock;
 
 	dl_b = &rq->rd->dl_bw;
@@ -714,6 +714,20 @@ do {									\
 		P(sched_goidle);
 		P(ttwu_count);
 		P(ttwu_local);
+#ifdef CONFIG_SMP
+		P(rt_push_count);
+		P(rt_pull_count);
+		P(rt_push_ipi_count);
+		P(dl_push_count);
+		P(dl_pull_count);
+		P(cpupri_find_count);
+		P(cpupri_search_len);
+		P(cpudl_find_count);
+		P(cpudl_search_len);
+		P(ttwu_batch_count);
+		P(ttwu_batch_tasks);
+		P(ttwu_batch_ipis);
+#endif
 	}
 #undef P
 
@@ -84,6 +84,35 @@ static unsigned int normalized_sysctl_sched_wakeup_granularity	= 1000000UL;
 
 const_debug unsigned int sysctl_sched_migration_cost	= 500000UL;
 
+/*
+ * Maximum number of leaf cfs_rqs decayed by one update_blocked_averages()
+ * call; the walk resumes where it stopped on the next call. Bounds the rq
+ * lock hold time with many cgroups.
+ *
+ * (default: 0 - walk the whole list)
+ */
+unsigned int sysctl_sched_nr_blocked_update;
+
+#ifdef CONFIG_SYSCTL
+static struct ctl_table sched_fair_sysctls[] = {
+	{
+		.procname	= "sched_nr_blocked_update",
+		.data		= &sysctl_sched_nr_blocked_update,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_douintvec,
+	},
+	{}
+};
+
+static int __init sched_fair_sysctl_init(void)
+{
+	register_sysctl("kernel", sched_fair_sysctls);
+	return 0;
+}
+late_initcall(sched_fair_sysctl_init);
+#endif
+
 int sched_thermal_decay_shift;
 static int __init setup_sched_thermal_decay_shift(char *str)
 {
@@ -307,6 +336,7 @@ static inline bool list_add_leaf_cfs_rq(struct cfs_rq *cfs_rq)
 		return rq->tmp_alone_branch == &rq->leaf_cfs_rq_list;
 
 	cfs_rq->on_list = 1;
+	rq->nr_leaf_cfs_rq++;
 
 	/*
 	 * Ensure we either appear before our parent (if already
@@ -381,8 +411,23 @@ static inline void list_del_leaf_cfs_rq(struct cfs_rq *cfs_rq)
 		if (rq->tmp_alone_branch == &cfs_rq->leaf_cfs_rq_list)
 			rq->tmp_alone_branch = cfs_rq->leaf_cfs_rq_list.prev;
 
+		/*
+		 * Don't leave a budget limited update_blocked_averages() walk
+		 * pointing at a cfs_rq that is going away; resume at the next
+		 * one, or start a new pass if this was the last.
+		 */
+		if (rq->blocked_cfs_rq_next == cfs_rq) {
+			if (list_is_last(&cfs_rq->leaf_cfs_rq_list,
+					 &rq->leaf_cfs_rq_list))
+				rq->blocked_cfs_rq_next = NULL;
+			else
+				rq->blocked_cfs_rq_next = list_next_entry(cfs_rq,
+							leaf_cfs_rq_list);
+		}
+
 		list_del_rcu(&cfs_rq->leaf_cfs_rq_list);
 		cfs_rq->on_list = 0;
+		rq->nr_leaf_cfs_rq--;
 	}
 }
 
@@ -5634,8 +5679,10 @@ static void dequeue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	sub_nr_running(rq, 1);
 
 	/* balance early to pull high priority tasks */
-	if (unlikely(!was_sched_idle && sched_idle_rq(rq)))
+	if (unlikely(!was_sched_idle && sched_idle_rq(rq))) {
 		rq->next_balance = jiffies;
+		update_idle_cpumask(rq, true);
+	}
 
 dequeue_throttle:
 	util_est_dequeue(&rq->cfs, p, task_sleep);
@@ -6008,18 +6055,24 @@ static inline bool test_idle_cores(int cpu, bool def)
 
 /*
  * Scans the local SMT mask to see if the entire core is idle, and records this
- * information in sd_llc_shared->has_idle_cores.
+ * information in sd_llc_shared->has_idle_cores and the idle-core mask.
  *
  * Since SMT siblings share all cache levels, inspecting this limited remote
  * state should be fairly cheap.
  */
 void __update_idle_core(struct rq *rq)
 {
+	struct sched_domain_shared *sds;
 	int core = cpu_of(rq);
 	int cpu;
 
 	rcu_read_lock();
-	if (test_idle_cores(core, true))
+	sds = rcu_dereference(per_cpu(sd_llc_shared, core));
+	if (!sds)
+		goto unlock;
+
+	if (READ_ONCE(sds->has_idle_cores) &&
+	    cpumask_test_cpu(core, sds_idle_cores(sds)))
 		goto unlock;
 
 	for_each_cpu(cpu, cpu_smt_mask(core)) {
@@ -6030,15 +6083,38 @@ void __update_idle_core(struct rq *rq)
 			goto unlock;
 	}
 
-	set_idle_cores(core, 1);
+	for_each_cpu(cpu, cpu_smt_mask(core))
+		cpumask_set_cpu(cpu, sds_idle_cores(sds));
+	WRITE_ONCE(sds->has_idle_cores, 1);
 unlock:
 	rcu_read_unlock();
 }
 
+/*
+ * A sibling of the core is about to run something; the core is no longer
+ * fully idle.
+ */
+static inline void clear_idle_core(struct sched_domain_shared *sds, int core)
+{
+	int cpu;
+
+	if (!static_branch_likely(&sched_smt_present))
+		return;
+
+	if (!cpumask_test_cpu(core, sds_idle_cores(sds)))
+		return;
+
+	for_each_cpu(cpu, cpu_smt_mask(core))
+		cpumask_clear_cpu(cpu, sds_idle_cores(sds));
+}
+
 /*
  * Scan the entire LLC domain for idle cores; this dynamically switches off if
  * there are no idle cores left in the system; tracked through
  * sd_llc->shared->has_idle_cores and enabled through update_idle_core() above.
+ *
+ * With SIS_IDLE_MASK only the cores recorded in the idle-core mask are
+ * inspected instead of the whole LLC span.
  */
 static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
 {
@@ -6051,11 +6127,17 @@ static int select_idle_core(struct task_struct *p, struct sched_domain *sd, int
 	if (!test_idle_cores(target, false))
 		return -1;
 
-	cpumask_and(cpus, sched_domain_span(sd), p->cpus_ptr);
+	if (sched_feat(SIS_IDLE_MASK) && sd->shared)
+		cpumask_and(cpus, sds_idle_cores(sd->shared), p->cpus_ptr);
+	else
+		cpumask_copy(cpus, p->cpus_ptr);
+	cpumask_and(cpus, cpus, sched_domain_span(sd));
 
 	for_each_cpu_wrap(core, cpus, target) {
 		bool idle = true;
 
+		schedstat_inc(sd->sis_scanned);
+
 		for_each_cpu(cpu, cpu_smt_mask(core)) {
 			if (!available_idle_cpu(cpu)) {
 				idle = false;
@@ -6090,6 +6172,7 @@ static int select_idle_smt(struct task_struct *p, struct sched_domain *sd, int t
 		if (!cpumask_test_cpu(cpu, p->cpus_ptr) ||
 		    !cpumask_test_cpu(cpu, sched_domain_span(sd)))
 			continue;
+		schedstat_inc(sd->sis_scanned);
 		if (available_idle_cpu(cpu) || sched_idle_cpu(cpu))
 			return cpu;
 	}
@@ -6099,6 +6182,8 @@ static int select_idle_smt(struct task_struct *p, struct sched_domain *sd, int t
 
 #else /* CONFIG_SCHED_SMT */
 
+static inline void clear_idle_core(struct sched_domain_shared *sds, int core) { }
+
 static inline int select_idle_core(struct task_struct *p, struct sched_domain *sd, int target)
 {
 	return -1;
@@ -6111,6 +6196,53 @@ static inline int select_idle_smt(struct task_struct *p, struct sched_domain *sd
 
 #endif /* CONFIG_SCHED_SMT */
 
+/*
+ * Record in the per-LLC idle mask consulted by select_idle_cpu() that @rq's
+ * CPU became a candidate, i.e. went idle or only has SCHED_IDLE tasks left,
+ * or that it is about to leave the idle task.  Only the idle task exit of a
+ * CPU running nothing but SCHED_IDLE tasks keeps its bit.
+ *
+ * Bits going stale otherwise are dropped by select_idle_cpu(), see
+ * clear_stale_idle_cpu().
+ */
+void update_idle_cpumask(struct rq *rq, bool idle)
+{
+	struct sched_domain_shared *sds;
+	int cpu = cpu_of(rq);
+
+	rcu_read_lock();
+	sds = rcu_dereference(per_cpu(sd_llc_shared, cpu));
+	if (!sds)
+		goto unlock;
+
+	if (idle) {
+		/* Order against clear_stale_idle_cpu(), see there. */
+		smp_mb();
+		if (!cpumask_test_cpu(cpu, sds_idle_cpus(sds)))
+			cpumask_set_cpu(cpu, sds_idle_cpus(sds));
+	} else {
+		if (!sched_idle_rq(rq) &&
+		    cpumask_test_cpu(cpu, sds_idle_cpus(sds)))
+			cpumask_clear_cpu(cpu, sds_idle_cpus(sds));
+		clear_idle_core(sds, cpu);
+	}
+unlock:
+	rcu_read_unlock();
+}
+
+/*
+ * Drop a busy CPU from the idle mask.  If that races with the CPU going idle,
+ * either we see its nr_running drop to 0 and put the bit back, or its
+ * update_idle_cpumask() sees the bit cleared and sets it again.
+ */
+static void clear_stale_idle_cpu(struct cpumask *idle_cpus, int cpu)
+{
+	cpumask_clear_cpu(cpu, idle_cpus);
+	smp_mb__after_atomic();
+	if (!READ_ONCE(cpu_rq(cpu)->nr_running))
+		cpumask_set_cpu(cpu, idle_cpus);
+}
+
 /*
  * Scan the LLC domain for idle CPUs; this is dynamically regulated by
  * comparing the average scan cost (tracked in sd->avg_scan_cost) against the
@@ -6119,6 +6251,7 @@ static inline int select_idle_smt(struct task_struct *p, struct sched_domain *sd
 static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int target)
 {
 	struct cpumask *cpus = this_cpu_cpumask_var_ptr(select_idle_mask);
+	struct cpumask *idle_cpus = NULL;
 	struct sched_domain *this_sd;
 	u64 avg_cost, avg_idle;
 	u64 time;
@@ -6149,13 +6282,27 @@ static int select_idle_cpu(struct task_struct *p, struct sched_domain *sd, int t
 
 	time = cpu_clock(this);
 
-	cpumask_and(cpus, sched_domain_span(sd), p->cpus_ptr);
+	/*
+	 * With SIS_IDLE_MASK, only scan the CPUs recorded as idle or running
+	 * only SCHED_IDLE tasks.  Those found busy are dropped from the mask,
+	 * and the scan stays bounded as the mask may still be stale.
+	 */
+	if (sched_feat(SIS_IDLE_MASK) && sd->shared) {
+		idle_cpus = sds_idle_cpus(sd->shared);
+		cpumask_and(cpus, idle_cpus, p->cpus_ptr);
+		cpumask_and(cpus, cpus, sched_domain_span(sd));
+	} else {
+		cpumask_and(cpus, sched_domain_span(sd), p->cpus_ptr);
+	}
 
 	for_each_cpu_wrap(cpu, cpus, target) {
 		if (!--nr)
 			return -1;
+		schedstat_inc(sd->sis_scanned);
 		if (available_idle_cpu(cpu) || sched_idle_cpu(cpu))
 			break;
+		if (idle_cpus)
+			clear_stale_idle_cpu(idle_cpus, cpu);
 	}
 
 	time = cpu_clock(this) - time;
@@ -6271,19 +6418,26 @@ static int select_idle_sibling(struct task_struct *p, int prev, int target)
 	if (!sd)
 		return target;
 
+	schedstat_inc(sd->sis_search);
+
 	i = select_idle_core(p, sd, target);
 	if ((unsigned)i < nr_cpumask_bits)
-		return i;
+		goto found;
 
 	i = select_idle_cpu(p, sd, target);
 	if ((unsigned)i < nr_cpumask_bits)
-		return i;
+		goto found;
 
 	i = select_idle_smt(p, sd, target);
 	if ((unsigned)i < nr_cpumask_bits)
-		return i;
+		goto found;
 
+	schedstat_inc(sd->sis_miss);
 	return target;
+
+found:
+	schedstat_inc(sd->sis_hit);
+	return i;
 }
 
 /**
@@ -7885,17 +8039,36 @@ static inline bool cfs_rq_is_decayed(struct cfs_rq *cfs_rq)
 
 static bool __update_blocked_fair(struct rq *rq, bool *done)
 {
+	unsigned int budget = sysctl_sched_nr_blocked_update;
 	struct cfs_rq *cfs_rq, *pos;
 	bool decayed = false;
 	int cpu = cpu_of(rq);
 
+	/*
+	 * With a budget the walk is spread over several calls; pick up where
+	 * the previous one stopped, or start a new pass over the list.
+	 */
+	cfs_rq = rq->blocked_cfs_rq_next;
+	if (!cfs_rq) {
+		cfs_rq = list_first_entry(&rq->leaf_cfs_rq_list, struct cfs_rq,
+					  leaf_cfs_rq_list);
+		rq->blocked_cfs_rq_pending = false;
+	}
+
 	/*
 	 * Iterates the task_group tree in a bottom up fashion, see
 	 * list_add_leaf_cfs_rq() for details.
 	 */
-	for_each_leaf_cfs_rq_safe(rq, cfs_rq, pos) {
+	list_for_each_entry_safe_from(cfs_rq, pos, &rq->leaf_cfs_rq_list,
+				      leaf_cfs_rq_list) {
 		struct sched_entity *se;
 
+		if (sysctl_sched_nr_blocked_update && !budget--) {
+			rq->blocked_cfs_rq_next = cfs_rq;
+			*done = false;
+			return decayed;
+		}
+
 		if (update_cfs_rq_load_avg(cfs_rq_clock_pelt(cfs_rq), cfs_rq)) {
 			update_tg_load_avg(cfs_rq);
 
@@ -7917,9 +8090,14 @@ static bool __update_blocked_fair(struct rq *rq, bool *done)
 
 		/* Don't need periodic decay once load/util_avg are null */
 		if (cfs_rq_has_blocked(cfs_rq))
-			*done = false;
+			rq->blocked_cfs_rq_pending = true;
 	}
 
+	/* Completed a pass over the whole list */
+	rq->blocked_cfs_rq_next = NULL;
+	if (rq->blocked_cfs_rq_pending)
+		*done = false;
+
 	return decayed;
 }
 
@@ -7993,13 +8171,22 @@ static void update_blocked_averages(int cpu)
 	bool decayed = false, done = true;
 	struct rq *rq = cpu_rq(cpu);
 	struct rq_flags rf;
+	u64 start = 0;
 
 	rq_lock_irqsave(rq, &rf);
 	update_rq_clock(rq);
 
+	if (schedstat_enabled())
+		start = local_clock();
+
 	decayed |= __update_blocked_others(rq, &done);
 	decayed |= __update_blocked_fair(rq, &done);
 
+	if (schedstat_enabled()) {
+		__schedstat_inc(rq->blocked_update_count);
+		__schedstat_add(rq->blocked_update_time, local_clock() - start);
+	}
+
 	update_blocked_load_status(rq, !done);
 	if (decayed)
 		cpufreq_update_util(rq, 0);
@@ -51,12 +51,24 @@ SCHED_FEAT(NONTASK_CAPACITY, true)
  */
 SCHED_FEAT(TTWU_QUEUE, true)
 
+/*
+ * Batch the remote wakeups done by a single wake_up() call, so that each
+ * target CPU only gets one IPI.
+ */
+SCHED_FEAT(TTWU_BATCH, true)
+
 /*
  * When doing wakeups, attempt to limit superfluous scans of the LLC domain.
  */
 SCHED_FEAT(SIS_AVG_CPU, false)
 SCHED_FEAT(SIS_PROP, true)
 
+/*
+ * Pick idle CPUs and cores from the per-LLC idle masks maintained on idle
+ * entry/exit instead of scanning the LLC span.
+ */
+SCHED_FEAT(SIS_IDLE_MASK, true)
+
 /*
  * Issue a WARN when we do multiple update_rq_clock() calls
  * in a single rq->lock section. Default disabled because the
@@ -9,11 +9,23 @@
  */
 #include "sched.h"
 
+#include <linux/irq.h>
+
 DEFINE_STATIC_KEY_FALSE(housekeeping_overridden);
 EXPORT_SYMBOL_GPL(housekeeping_overridden);
 static cpumask_var_t housekeeping_mask;
 static unsigned int housekeeping_flags;
 
+/*
+ * The housekeeping duties which follow housekeeping_update().  The tick
+ * (nohz_full=) and RCU callback offloading are set up for good at boot.
+ */
+#define HK_FLAG_RUNTIME	(HK_FLAG_TIMER | HK_FLAG_DOMAIN | HK_FLAG_WQ | \
+			 HK_FLAG_MANAGED_IRQ | HK_FLAG_KTHREAD)
+
+/* Serializes housekeeping_update() */
+static DEFINE_MUTEX(housekeeping_mutex);
+
 bool housekeeping_enabled(enum hk_flags flags)
 {
 	return !!(housekeeping_flags & flags);
@@ -63,6 +75,136 @@ bool housekeeping_test_cpu(int cpu, enum hk_flags flags)
 }
 EXPORT_SYMBOL_GPL(housekeeping_test_cpu);
 
+/*
+ * Move the unbound kernel threads which were affine to @old, the previous
+ * housekeeping_cpumask(HK_FLAG_KTHREAD), to the new housekeeping CPUs.
+ * Threads that were bound to some other set of CPUs are left alone.
+ */
+static void housekeeping_update_kthreads(const struct cpumask *old)
+{
+	struct task_struct *t;
+	struct pid *pid;
+	int nr = 1;
+
+	for (;;) {
+		rcu_read_lock();
+		pid = find_ge_pid(nr, &init_pid_ns);
+		if (!pid) {
+			rcu_read_unlock();
+			break;
+		}
+		nr = pid_nr(pid) + 1;
+
+		t = pid_task(pid, PIDTYPE_PID);
+		if (t && (t->flags & PF_KTHREAD) &&
+		    !(t->flags & PF_NO_SETAFFINITY) &&
+		    cpumask_equal(t->cpus_ptr, old))
+			get_task_struct(t);
+		else
+			t = NULL;
+		rcu_read_unlock();
+
+		if (t) {
+			set_cpus_allowed_ptr(t, housekeeping_mask);
+			put_task_struct(t);
+		}
+		cond_resched();
+	}
+}
+
+/**
+ * housekeeping_update - Change the isolated CPUs at runtime
+ * @isolated: the CPUs to exclude from housekeeping work
+ *
+ * Make all the possible CPUs but @isolated the housekeeping ones, then move
+ * the sched domains, unbound workqueues, unbound kernel threads and managed
+ * interrupts accordingly.  Timers follow lazily, as new ones are queued on
+ * housekeeping CPUs only.
+ *
+ * Return: 0 on success, -EINVAL if no online CPU would be left for
+ * housekeeping, -EBUSY if nohz_full= is in use.
+ */
+int housekeeping_update(const struct cpumask *isolated)
+{
+	cpumask_var_t new, old;
+	unsigned int enabled, changed = 0;
+	int ret = 0;
+
+	if (!zalloc_cpumask_var(&new, GFP_KERNEL))
+		return -ENOMEM;
+	if (!zalloc_cpumask_var(&old, GFP_KERNEL)) {
+		free_cpumask_var(new);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&housekeeping_mutex);
+	cpus_read_lock();
+
+	/* The nohz_full CPUs and the housekeeping ones must stay complementary */
+	if (housekeeping_flags & HK_FLAG_TICK) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	cpumask_andnot(new, cpu_possible_mask, isolated);
+	if (!cpumask_intersects(new, cpu_online_mask)) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	if (!static_branch_unlikely(&housekeeping_overridden)) {
+		if (!cpumask_available(housekeeping_mask) &&
+		    !zalloc_cpumask_var(&housekeeping_mask, GFP_KERNEL)) {
+			ret = -ENOMEM;
+			goto unlock;
+		}
+		cpumask_copy(housekeeping_mask, cpu_possible_mask);
+		static_branch_enable_cpuslocked(&housekeeping_overridden);
+	}
+
+	/*
+	 * Kthreads were affine to all the possible CPUs unless
+	 * HK_FLAG_KTHREAD was set already, and the duties enabled just now
+	 * have to follow the new mask even if it doesn't change.
+	 */
+	cpumask_copy(old, housekeeping_cpumask(HK_FLAG_KTHREAD));
+	enabled = HK_FLAG_RUNTIME & ~housekeeping_flags;
+	housekeeping_flags |= HK_FLAG_RUNTIME;
+	if (cpumask_equal(housekeeping_mask, new))
+		changed = enabled;
+	else
+		changed = housekeeping_flags;
+
+	/*
+	 * Readers access the mask locklessly, add the new CPUs before
+	 * removing the old ones so that it never looks empty.
+	 */
+	cpumask_or(housekeeping_mask, housekeeping_mask, new);
+	cpumask_and(housekeeping_mask, housekeeping_mask, new);
+
+	if (changed & HK_FLAG_MANAGED_IRQ)
+		irq_affinity_housekeeping_update();
+unlock:
+	cpus_read_unlock();
+
+	if (ret || !changed)
+		goto out;
+
+	if (changed & HK_FLAG_KTHREAD)
+		housekeeping_update_kthreads(old);
+	if (changed & HK_FLAG_WQ) {
+		cpumask_copy(new, housekeeping_mask);
+		workqueue_set_unbound_cpumask(new);
+	}
+	if (changed & HK_FLAG_DOMAIN)
+		rebuild_sched_domains();
+out:
+	mutex_unlock(&housekeeping_mutex);
+	free_cpumask_var(old);
+	free_cpumask_var(new);
+	return ret;
+}
+
 void __init housekeeping_init(void)
 {
 	if (!housekeeping_flags)
@@ -697,17 +697,11 @@ static void psi_group_change(struct psi_group *group, int cpu,
 	groupc = per_cpu_ptr(group->pcpu, cpu);
 
 	/*
-	 * First we assess the aggregate resource states this CPU's
-	 * tasks have been in since the last change, and account any
-	 * SOME and FULL time these may have resulted in.
-	 *
-	 * Then we update the task counts according to the state
-	 * change requested through the @clear and @set bits.
+	 * Update the task counts according to the state change
+	 * requested through the @clear and @set bits. The counts are
+	 * only ever touched from this CPU under its rq lock and are
+	 * not part of the seqcount protected aggregation state.
 	 */
-	write_seqcount_begin(&groupc->seq);
-
-	record_times(groupc, cpu, false);
-
 	for (t = 0, m = clear; m; m &= ~(1 << t), t++) {
 		if (!(m & (1 << t)))
 			continue;
@@ -730,9 +724,26 @@ static void psi_group_change(struct psi_group *group, int cpu,
 		if (test_state(groupc->tasks, s))
 			state_mask |= (1 << s);
 	}
-	groupc->state_mask = state_mask;
 
-	write_seqcount_end(&groupc->seq);
+	/*
+	 * Time spent in the currently active states accrues against
+	 * state_start and is folded in lazily by the aggregators, see
+	 * get_recent_times(). As long as the aggregate state doesn't
+	 * change there is nothing to record. This is the common case
+	 * for the ancestors of a task's cgroup, which stay busy with
+	 * other tasks, and saves a clock read and seqcount write per
+	 * level of the hierarchy.
+	 */
+	if (state_mask != groupc->state_mask) {
+		/*
+		 * Account any SOME and FULL time the previous states
+		 * may have resulted in, then switch to the new ones.
+		 */
+		write_seqcount_begin(&groupc->seq);
+		record_times(groupc, cpu, false);
+		groupc->state_mask = state_mask;
+		write_seqcount_end(&groupc->seq);
+	}
 
 	if (state_mask & group->poll_states)
 		psi_schedule_poll_work(group, 1);
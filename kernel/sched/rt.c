@@ -1927,6 +1927,7 @@ static int push_rt_task(struct rq *rq)
 	deactivate_task(rq, next_task, 0);
 	set_task_cpu(next_task, lowest_rq->cpu);
 	activate_task(lowest_rq, next_task, 0);
+	schedstat_inc(rq->rt_push_count);
 	ret = 1;
 
 	resched_curr(lowest_rq);
@@ -2075,6 +2076,7 @@ static void tell_cpu_to_push(struct rq *rq)
 	if (cpu >= 0) {
 		/* Make sure the rd does not get freed while pushing */
 		sched_get_rd(rq->rd);
+		schedstat_inc(rq->rt_push_ipi_count);
 		irq_work_queue_on(&rq->rd->rto_push_work, cpu);
 	}
 }
@@ -2112,6 +2114,7 @@ void rto_push_irq_work_func(struct irq_work *work)
 	}
 
 	/* Try the next RT overloaded CPU */
+	schedstat_inc(rq->rt_push_ipi_count);
 	irq_work_queue_on(&rd->rto_push_work, cpu);
 }
 #endif /* HAVE_RT_PUSH_IPI */
@@ -2199,6 +2202,7 @@ static void pull_rt_task(struct rq *this_rq)
 			deactivate_task(src_rq, p, 0);
 			set_task_cpu(p, this_cpu);
 			activate_task(this_rq, p, 0);
+			schedstat_inc(this_rq->rt_pull_count);
 			/*
 			 * We continue with the search, just in
 			 * case there's an even higher prio task
@@ -782,6 +782,9 @@ struct root_domain {
 	cpumask_var_t		span;
 	cpumask_var_t		online;
 
+	/* Nodes with CPUs in span, for the per-node cpupri and cpudl shards */
+	nodemask_t		nodes;
+
 	/*
 	 * Indicate pullable load on at least one CPU, e.g:
 	 * - More than one runnable task
@@ -918,6 +921,8 @@ struct rq {
 
 #ifdef CONFIG_SMP
 	unsigned int		ttwu_pending;
+	struct llist_head	ttwu_batch;
+	call_single_data_t	ttwu_batch_csd;
 #endif
 	u64			nr_switches;
 
@@ -936,6 +941,11 @@ struct rq {
 	/* list of leaf cfs_rq on this CPU: */
 	struct list_head	leaf_cfs_rq_list;
 	struct list_head	*tmp_alone_branch;
+	unsigned int		nr_leaf_cfs_rq;
+
+	/* update_blocked_averages() resume point and pass state: */
+	struct cfs_rq		*blocked_cfs_rq_next;
+	bool			blocked_cfs_rq_pending;
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
 	/*
@@ -1042,6 +1052,26 @@ struct rq {
 	/* try_to_wake_up() stats */
 	unsigned int		ttwu_count;
 	unsigned int		ttwu_local;
+
+	/* RT/DL push-pull and cpupri/cpudl search stats */
+	unsigned int		rt_push_count;
+	unsigned int		rt_pull_count;
+	unsigned int		rt_push_ipi_count;
+	unsigned int		dl_push_count;
+	unsigned int		dl_pull_count;
+	unsigned int		cpupri_find_count;
+	unsigned int		cpupri_search_len;
+	unsigned int		cpudl_find_count;
+	unsigned int		cpudl_search_len;
+
+	/* Batched wakeup stats */
+	unsigned int		ttwu_batch_count;
+	unsigned int		ttwu_batch_tasks;
+	unsigned int		ttwu_batch_ipis;
+
+	/* update_blocked_averages() stats */
+	unsigned int		blocked_update_count;
+	u64			blocked_update_time;
 #endif
 
 #ifdef CONFIG_CPU_IDLE
@@ -1089,6 +1119,12 @@ static inline void update_idle_core(struct rq *rq)
 static inline void update_idle_core(struct rq *rq) { }
 #endif
 
+#ifdef CONFIG_SMP
+extern void update_idle_cpumask(struct rq *rq, bool idle);
+#else
+static inline void update_idle_cpumask(struct rq *rq, bool idle) { }
+#endif
+
 DECLARE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
 
 #define cpu_rq(cpu)		(&per_cpu(runqueues, (cpu)))
@@ -1715,6 +1751,14 @@ static inline int task_on_rq_migrating(struct task_struct *p)
 #define WF_MIGRATED		0x04		/* Internal use, task got migrated */
 #define WF_ON_CPU		0x08		/* Wakee is on_cpu */
 
+#ifdef CONFIG_SMP
+extern bool sched_ttwu_batch_begin(void);
+extern void sched_ttwu_batch_end(void);
+#else
+static inline bool sched_ttwu_batch_begin(void) { return false; }
+static inline void sched_ttwu_batch_end(void) { }
+#endif
+
 /*
  * To aid in avoiding the subversion of "niceness" due to uneven distribution
  * of tasks with abnormal "nice" values across CPUs the contribution that
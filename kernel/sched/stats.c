@@ -9,8 +9,21 @@
  *
  * Bump this up when changing the output format or the meaning of an existing
  * format, so that tools can adapt (or abort)
+ *
+ * Version 16 appends to each cpu line:
+ *
+ *   nr_leaf_cfs_rq        leaf cfs_rqs on the CPU's list
+ *   blocked_update_count  update_blocked_averages() calls
+ *   blocked_update_time   time spent in them, in ns
+ *
+ * and to each domain line the select_idle_sibling() stats of the domain:
+ *
+ *   sis_search            searches started in the domain
+ *   sis_scanned           CPUs (or cores) inspected while searching
+ *   sis_hit               searches that found an idle CPU
+ *   sis_miss              searches that fell back to the target CPU
  */
-#define SCHEDSTAT_VERSION 15
+#define SCHEDSTAT_VERSION 16
 
 static int show_schedstat(struct seq_file *seq, void *v)
 {
@@ -20,6 +33,7 @@ static int show_schedstat(struct seq_file *seq, void *v)
 		seq_printf(seq, "version %d\n", SCHEDSTAT_VERSION);
 		seq_printf(seq, "timestamp %lu\n", jiffies);
 	} else {
+		unsigned int nr_leaf_cfs_rq = 0;
 		struct rq *rq;
 #ifdef CONFIG_SMP
 		struct sched_domain *sd;
@@ -27,15 +41,20 @@ static int show_schedstat(struct seq_file *seq, void *v)
 #endif
 		cpu = (unsigned long)(v - 2);
 		rq = cpu_rq(cpu);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+		nr_leaf_cfs_rq = READ_ONCE(rq->nr_leaf_cfs_rq);
+#endif
 
 		/* runqueue-specific stats */
 		seq_printf(seq,
-		    "cpu%d %u 0 %u %u %u %u %llu %llu %lu",
+		    "cpu%d %u 0 %u %u %u %u %llu %llu %lu %u %u %llu",
 		    cpu, rq->yld_count,
 		    rq->sched_count, rq->sched_goidle,
 		    rq->ttwu_count, rq->ttwu_local,
 		    rq->rq_cpu_time,
-		    rq->rq_sched_info.run_delay, rq->rq_sched_info.pcount);
+		    rq->rq_sched_info.run_delay, rq->rq_sched_info.pcount,
+		    nr_leaf_cfs_rq, rq->blocked_update_count,
+		    rq->blocked_update_time);
 
 		seq_printf(seq, "\n");
 
@@ -60,12 +79,15 @@ static int show_schedstat(struct seq_file *seq, void *v)
 				    sd->lb_nobusyg[itype]);
 			}
 			seq_printf(seq,
-				   " %u %u %u %u %u %u %u %u %u %u %u %u\n",
+				   " %u %u %u %u %u %u %u %u %u %u %u %u"
+				   " %u %u %u %u\n",
 			    sd->alb_count, sd->alb_failed, sd->alb_pushed,
 			    sd->sbe_count, sd->sbe_balanced, sd->sbe_pushed,
 			    sd->sbf_count, sd->sbf_balanced, sd->sbf_pushed,
 			    sd->ttwu_wake_remote, sd->ttwu_move_affine,
-			    sd->ttwu_move_balance);
+			    sd->ttwu_move_balance,
+			    sd->sis_search, sd->sis_scanned,
+			    sd->sis_hit, sd->sis_miss);
 		}
 		rcu_read_unlock();
 #endif
@@ -463,6 +463,9 @@ void rq_attach_root(struct rq *rq, struct root_domain *rd)
 			set_rq_offline(rq);
 
 		cpumask_clear_cpu(rq->cpu, old_rd->span);
+		if (!cpumask_intersects(old_rd->span,
+					cpumask_of_node(cpu_to_node(rq->cpu))))
+			node_clear(cpu_to_node(rq->cpu), old_rd->nodes);
 
 		/*
 		 * If we dont want to free the old_rd yet then
@@ -477,6 +480,7 @@ void rq_attach_root(struct rq *rq, struct root_domain *rd)
 	rq->rd = rd;
 
 	cpumask_set_cpu(rq->cpu, rd->span);
+	node_set(cpu_to_node(rq->cpu), rd->nodes);
 	if (cpumask_test_cpu(rq->cpu, cpu_active_mask))
 		set_rq_online(rq);
 
@@ -517,10 +521,10 @@ static int init_rootdomain(struct root_domain *rd)
 #endif
 
 	init_dl_bw(&rd->dl_bw);
-	if (cpudl_init(&rd->cpudl) != 0)
+	if (cpudl_init(&rd->cpudl, &rd->nodes) != 0)
 		goto free_rto_mask;
 
-	if (cpupri_init(&rd->cpupri) != 0)
+	if (cpupri_init(&rd->cpupri, &rd->nodes) != 0)
 		goto free_cpudl;
 	return 0;
 
@@ -1326,6 +1330,7 @@ sd_init(struct sched_domain_topology_level *tl,
 	struct sd_data *sdd = &tl->data;
 	struct sched_domain *sd = *per_cpu_ptr(sdd->sd, cpu);
 	int sd_id, sd_weight, sd_flags = 0;
+	int i;
 
 #ifdef CONFIG_NUMA
 	/*
@@ -1419,6 +1424,14 @@ sd_init(struct sched_domain_topology_level *tl,
 		sd->shared = *per_cpu_ptr(sdd->sds, sd_id);
 		atomic_inc(&sd->shared->ref);
 		atomic_set(&sd->shared->nr_busy_cpus, sd_weight);
+		/*
+		 * Seed the mask with the currently idle CPUs, the others get
+		 * in the next time they enter the idle task.
+		 */
+		for_each_cpu(i, sched_domain_span(sd)) {
+			if (idle_cpu(i))
+				cpumask_set_cpu(i, sds_idle_cpus(sd->shared));
+		}
 	}
 
 	sd->private = sdd;
@@ -1781,7 +1794,8 @@ static int __sdt_alloc(const struct cpumask *cpu_map)
 
 			*per_cpu_ptr(sdd->sd, j) = sd;
 
-			sds = kzalloc_node(sizeof(struct sched_domain_shared),
+			sds = kzalloc_node(sizeof(struct sched_domain_shared) +
+					2 * cpumask_size(),
 					GFP_KERNEL, cpu_to_node(j));
 			if (!sds)
 				return -ENOMEM;
@@ -2094,6 +2108,14 @@ static struct sched_domain_attr		*dattr_cur;
  */
 static cpumask_var_t			fallback_doms;
 
+/*
+ * CPUs whose root domain was replaced by partition_sched_domains(), or that
+ * are attached to def_root_domain after it changed, since the deadline
+ * bandwidth accounting was last recomputed.  See rebuild_root_domains() in
+ * the cpuset code, which clears it once done.
+ */
+static cpumask_var_t			doms_rebuilt;
+
 /*
  * arch_update_cpu_topology lets virtualized architectures update the
  * CPU core maps. It is supposed to return 1 if the topology changed
@@ -2140,6 +2162,7 @@ int sched_init_domains(const struct cpumask *cpu_map)
 	zalloc_cpumask_var(&sched_domains_tmpmask, GFP_KERNEL);
 	zalloc_cpumask_var(&sched_domains_tmpmask2, GFP_KERNEL);
 	zalloc_cpumask_var(&fallback_doms, GFP_KERNEL);
+	zalloc_cpumask_var(&doms_rebuilt, GFP_KERNEL);
 
 	arch_update_cpu_topology();
 	ndoms_cur = 1;
@@ -2171,6 +2194,22 @@ static void detach_destroy_domains(const struct cpumask *cpu_map)
 	rcu_read_unlock();
 }
 
+/**
+ * sched_domains_rebuilt_mask - CPUs with rebuilt root domains
+ *
+ * Return the CPUs whose root domain's deadline bandwidth accounting has to be
+ * recomputed after the last partition_sched_domains() calls.  The caller may
+ * clear the mask once it has done so.
+ *
+ * Call with sched_domains_mutex held.
+ */
+struct cpumask *sched_domains_rebuilt_mask(void)
+{
+	lockdep_assert_held(&sched_domains_mutex);
+
+	return doms_rebuilt;
+}
+
 /* handle null as "default" */
 static int dattrs_equal(struct sched_domain_attr *cur, int idx_cur,
 			struct sched_domain_attr *new, int idx_new)
@@ -2208,6 +2247,11 @@ static int dattrs_equal(struct sched_domain_attr *cur, int idx_cur,
  * and partition_sched_domains() will fallback to the single partition
  * 'fallback_doms', it also forces the domains to be rebuilt.
  *
+ * Domains that are left as they are keep their root domain, including its
+ * deadline bandwidth accounting.  The CPUs of all the other ones are added
+ * to sched_domains_rebuilt_mask() so that only their accounting needs to be
+ * recomputed.
+ *
  * If doms_new == NULL it will be replaced with cpu_online_mask.
  * ndoms_new == 0 is a special case for destroying existing domains,
  * and it will not create the default domain.
@@ -2218,6 +2262,7 @@ void partition_sched_domains_locked(int ndoms_new, cpumask_var_t doms_new[],
 				    struct sched_domain_attr *dattr_new)
 {
 	bool __maybe_unused has_eas = false;
+	bool changed = false;
 	int i, j, n;
 	int new_topology;
 
@@ -2245,23 +2290,18 @@ void partition_sched_domains_locked(int ndoms_new, cpumask_var_t doms_new[],
 	/* Destroy deleted domains: */
 	for (i = 0; i < ndoms_cur; i++) {
 		for (j = 0; j < n && !new_topology; j++) {
+			/*
+			 * This domain won't be destroyed, and its root
+			 * domain's dl_bw->total_bw stays valid.
+			 */
 			if (cpumask_equal(doms_cur[i], doms_new[j]) &&
-			    dattrs_equal(dattr_cur, i, dattr_new, j)) {
-				struct root_domain *rd;
-
-				/*
-				 * This domain won't be destroyed and as such
-				 * its dl_bw->total_bw needs to be cleared.  It
-				 * will be recomputed in function
-				 * update_tasks_root_domain().
-				 */
-				rd = cpu_rq(cpumask_any(doms_cur[i]))->rd;
-				dl_clear_root_domain(rd);
+			    dattrs_equal(dattr_cur, i, dattr_new, j))
 				goto match1;
-			}
 		}
 		/* No match - a current sched domain not in new doms_new[] */
 		detach_destroy_domains(doms_cur[i]);
+		cpumask_or(doms_rebuilt, doms_rebuilt, doms_cur[i]);
+		changed = true;
 match1:
 		;
 	}
@@ -2283,10 +2323,24 @@ void partition_sched_domains_locked(int ndoms_new, cpumask_var_t doms_new[],
 		}
 		/* No match - add a new doms_new */
 		build_sched_domains(doms_new[i], dattr_new ? dattr_new + i : NULL);
+		cpumask_or(doms_rebuilt, doms_rebuilt, doms_new[i]);
+		changed = true;
 match2:
 		;
 	}
 
+	/*
+	 * CPUs may have been moved to or away from def_root_domain, so its
+	 * accounting has to be recomputed for all the CPUs still attached
+	 * to it.
+	 */
+	if (changed) {
+		for_each_cpu(i, cpu_active_mask) {
+			if (cpu_rq(i)->rd == &def_root_domain)
+				cpumask_set_cpu(i, doms_rebuilt);
+		}
+	}
+
 #if defined(CONFIG_ENERGY_MODEL) && defined(CONFIG_CPU_FREQ_GOV_SCHEDUTIL)
 	/* Build perf. domains: */
 	for (i = 0; i < ndoms_new; i++) {
@@ -68,6 +68,7 @@ static int __wake_up_common(struct wait_queue_head *wq_head, unsigned int mode,
 			wait_queue_entry_t *bookmark)
 {
 	wait_queue_entry_t *curr, *next;
+	bool batch = false;
 	int cnt = 0;
 
 	lockdep_assert_held(&wq_head->lock);
@@ -83,6 +84,14 @@ static int __wake_up_common(struct wait_queue_head *wq_head, unsigned int mode,
 	if (&curr->entry == &wq_head->head)
 		return nr_exclusive;
 
+	/*
+	 * Several tasks may get woken up, let them be queued on their target
+	 * CPUs with a single IPI per CPU.  The wait queue lock keeps us from
+	 * being preempted until the batch ends.
+	 */
+	if (curr->entry.next != &wq_head->head)
+		batch = sched_ttwu_batch_begin();
+
 	list_for_each_entry_safe_from(curr, next, &wq_head->head, entry) {
 		unsigned flags = curr->flags;
 		int ret;
@@ -104,6 +113,9 @@ static int __wake_up_common(struct wait_queue_head *wq_head, unsigned int mode,
 		}
 	}
 
+	if (batch)
+		sched_ttwu_batch_end();
+
 	return nr_exclusive;
 }
 
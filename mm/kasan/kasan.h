@@ -195,6 +195,7 @@ static inline void quarantine_remove_cache(struct kmem_cache *cache) { }
 void print_tags(u8 addr_tag, const void *addr);
 
 u8 random_tag(void);
+u8 sampled_tag(void);
 
 #else
 
@@ -205,6 +206,11 @@ static inline u8 random_tag(void)
 	return 0;
 }
 
+static inline u8 sampled_tag(void)
+{
+	return 0;
+}
+
 #endif
 
 #ifndef arch_kasan_set_tag
@@ -18,12 +18,17 @@
  *
  */
 
+#include <linux/cpuhotplug.h>
+#include <linux/debugfs.h>
 #include <linux/gfp.h>
 #include <linux/hash.h>
+#include <linux/irq_work.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <linux/mm.h>
 #include <linux/percpu.h>
 #include <linux/printk.h>
+#include <linux/seq_file.h>
 #include <linux/shrinker.h>
 #include <linux/slab.h>
 #include <linux/srcu.h>
@@ -89,29 +94,59 @@ static void qlist_move_all(struct qlist_head *from, struct qlist_head *to)
 }
 
 #define QUARANTINE_PERCPU_SIZE (1 << 20)
-#define QUARANTINE_BATCHES \
-	(1024 > 4 * CONFIG_NR_CPUS ? 1024 : 4 * CONFIG_NR_CPUS)
+#define QUARANTINE_RING_SIZE 4
+#define QUARANTINE_NODE_BATCHES 64
 
 /*
- * The object quarantine consists of per-cpu queues and a global queue,
- * guarded by quarantine_lock.
+ * The object quarantine consists of per-cpu queues and per-node queues.
+ *
+ * A full per-cpu queue is handed to its node without locking through a
+ * per-cpu ring of batches, which has a single producer (the cpu, with
+ * interrupts disabled) and whose consumers hold the node lock. A per-node
+ * kthread moves the batches from the rings into the node queue and evicts
+ * the oldest batches from it in the background. Until the kthreads run, or
+ * when a ring is full, batches are added to the node queue directly.
  */
-static DEFINE_PER_CPU(struct qlist_head, cpu_quarantine);
-
-/* Round-robin FIFO array of batches. */
-static struct qlist_head global_quarantine[QUARANTINE_BATCHES];
-static int quarantine_head;
-static int quarantine_tail;
-/* Total size of all objects in global_quarantine across all batches. */
-static unsigned long quarantine_size;
-static DEFINE_RAW_SPINLOCK(quarantine_lock);
+struct qlist_ring {
+	struct qlist_head batch[QUARANTINE_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct cpu_quarantine {
+	struct qlist_head q;
+	struct qlist_ring ring;
+};
+
+static DEFINE_PER_CPU(struct cpu_quarantine, cpu_quarantine);
+
+struct node_quarantine {
+	raw_spinlock_t lock;
+	/* Round-robin FIFO array of batches. */
+	struct qlist_head batches[QUARANTINE_NODE_BATCHES];
+	int head;
+	int tail;
+	/* Total size of all objects in the node queue across all batches. */
+	unsigned long size;
+	struct task_struct *thread;
+	struct irq_work wake_work;
+	atomic_long_t contended;
+	atomic_long_t evicted_bg;
+	atomic_long_t evicted_sync;
+} ____cacheline_aligned_in_smp;
+
+static struct node_quarantine node_quarantine[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = {
+		.lock = __RAW_SPIN_LOCK_UNLOCKED(node_quarantine.lock),
+	},
+};
 DEFINE_STATIC_SRCU(remove_cache_srcu);
 
-/* Maximum size of the global queue. */
+/* Maximum size of a node queue. */
 static unsigned long quarantine_max_size;
 
 /*
- * Target size of a batch in global_quarantine.
+ * Target size of a batch in the node queues.
  * Usually equal to QUARANTINE_PERCPU_SIZE unless we have too much RAM.
  */
 static unsigned long quarantine_batch_size;
@@ -123,6 +158,18 @@ static unsigned long quarantine_batch_size;
  */
 #define QUARANTINE_FRACTION 32
 
+/*
+ * The kthreads keep the node queues below this size, so that
+ * quarantine_reduce() only has to evict when they fall behind.
+ */
+static unsigned long quarantine_bg_size(void)
+{
+	unsigned long max_size = READ_ONCE(quarantine_max_size);
+
+	/* One batch of headroom, which is what quarantine_reduce() evicts. */
+	return max_size - min(max_size, READ_ONCE(quarantine_batch_size));
+}
+
 static struct kmem_cache *qlink_to_cache(struct qlist_node *qlink)
 {
 	return virt_to_head_page(qlink)->slab_cache;
@@ -171,56 +218,143 @@ static void qlist_free_all(struct qlist_head *q, struct kmem_cache *cache)
 	qlist_init(q);
 }
 
+/* Called by the owning cpu with interrupts disabled. */
+static bool qring_push(struct qlist_ring *ring, struct qlist_head *q)
+{
+	unsigned int tail = ring->tail;
+
+	if (tail - smp_load_acquire(&ring->head) >= QUARANTINE_RING_SIZE)
+		return false;
+
+	ring->batch[tail % QUARANTINE_RING_SIZE] = *q;
+	qlist_init(q);
+	smp_store_release(&ring->tail, tail + 1);
+	return true;
+}
+
+/* Called with the node lock held. */
+static void qring_pop_all(struct qlist_ring *ring, struct qlist_head *to)
+{
+	unsigned int head = ring->head;
+	unsigned int tail = smp_load_acquire(&ring->tail);
+
+	for (; head != tail; head++)
+		qlist_move_all(&ring->batch[head % QUARANTINE_RING_SIZE], to);
+	smp_store_release(&ring->head, head);
+}
+
+static bool qring_empty(struct qlist_ring *ring)
+{
+	return READ_ONCE(ring->head) == READ_ONCE(ring->tail);
+}
+
+/* Called with interrupts disabled. */
+static void qnode_lock(struct node_quarantine *qn)
+{
+	if (!raw_spin_trylock(&qn->lock)) {
+		atomic_long_inc(&qn->contended);
+		raw_spin_lock(&qn->lock);
+	}
+}
+
+static void qnode_add(struct node_quarantine *qn, struct qlist_head *q)
+{
+	WRITE_ONCE(qn->size, qn->size + q->bytes);
+	qlist_move_all(q, &qn->batches[qn->tail]);
+	if (qn->batches[qn->tail].bytes >=
+			READ_ONCE(quarantine_batch_size)) {
+		int new_tail;
+
+		new_tail = qn->tail + 1;
+		if (new_tail == QUARANTINE_NODE_BATCHES)
+			new_tail = 0;
+		if (new_tail != qn->head)
+			qn->tail = new_tail;
+	}
+}
+
+/* Move the batches handed off by the cpus of the node into its queue. */
+static void qnode_pull_rings(struct node_quarantine *qn, int nid)
+{
+	struct qlist_head temp = QLIST_INIT;
+	int cpu;
+
+	/* The rings of offline cpus are drained by quarantine_cpu_dead(). */
+	for_each_cpu(cpu, cpumask_of_node(nid)) {
+		qring_pop_all(&per_cpu(cpu_quarantine, cpu).ring, &temp);
+		qnode_add(qn, &temp);
+	}
+}
+
 void quarantine_put(struct kasan_free_meta *info, struct kmem_cache *cache)
 {
 	unsigned long flags;
-	struct qlist_head *q;
+	struct cpu_quarantine *cq;
+	struct node_quarantine *qn;
 	struct qlist_head temp = QLIST_INIT;
 
 	/*
 	 * Note: irq must be disabled until after we move the batch to the
-	 * global quarantine. Otherwise quarantine_remove_cache() can miss
-	 * some objects belonging to the cache if they are in our local temp
-	 * list. quarantine_remove_cache() executes on_each_cpu() at the
-	 * beginning which ensures that it either sees the objects in per-cpu
-	 * lists or in the global quarantine.
+	 * ring or the node quarantine. Otherwise quarantine_remove_cache()
+	 * can miss some objects belonging to the cache if they are in our
+	 * local temp list. quarantine_remove_cache() executes on_each_cpu()
+	 * at the beginning which ensures that it either sees the objects in
+	 * per-cpu lists or in the rings and node quarantines.
 	 */
 	local_irq_save(flags);
 
-	q = this_cpu_ptr(&cpu_quarantine);
-	qlist_put(q, &info->quarantine_link, cache->size);
-	if (unlikely(q->bytes > QUARANTINE_PERCPU_SIZE)) {
-		qlist_move_all(q, &temp);
-
-		raw_spin_lock(&quarantine_lock);
-		WRITE_ONCE(quarantine_size, quarantine_size + temp.bytes);
-		qlist_move_all(&temp, &global_quarantine[quarantine_tail]);
-		if (global_quarantine[quarantine_tail].bytes >=
-				READ_ONCE(quarantine_batch_size)) {
-			int new_tail;
-
-			new_tail = quarantine_tail + 1;
-			if (new_tail == QUARANTINE_BATCHES)
-				new_tail = 0;
-			if (new_tail != quarantine_head)
-				quarantine_tail = new_tail;
+	cq = this_cpu_ptr(&cpu_quarantine);
+	qlist_put(&cq->q, &info->quarantine_link, cache->size);
+	if (unlikely(cq->q.bytes > QUARANTINE_PERCPU_SIZE)) {
+		qn = &node_quarantine[numa_node_id()];
+
+		if (!READ_ONCE(qn->thread) || !qring_push(&cq->ring, &cq->q)) {
+			qlist_move_all(&cq->q, &temp);
+
+			qnode_lock(qn);
+			qnode_add(qn, &temp);
+			raw_spin_unlock(&qn->lock);
 		}
-		raw_spin_unlock(&quarantine_lock);
+		if (READ_ONCE(qn->thread))
+			irq_work_queue(&qn->wake_work);
 	}
 
 	local_irq_restore(flags);
 }
 
-void quarantine_reduce(void)
+static void quarantine_update_limits(void)
 {
 	size_t total_size, new_quarantine_size, percpu_quarantines;
+	unsigned int nr_nodes = num_online_nodes();
+
+	/*
+	 * Update quarantine size in case of hotplug. Allocate a fraction of
+	 * the installed memory to quarantine minus per-cpu queue limits, and
+	 * split it evenly between the nodes. The rings are not charged: the
+	 * node kthread is woken as soon as a batch is pushed, so they hold
+	 * more than a batch or so only while it is not getting to run.
+	 */
+	total_size = (totalram_pages() << PAGE_SHIFT) /
+		QUARANTINE_FRACTION;
+	percpu_quarantines = QUARANTINE_PERCPU_SIZE * num_online_cpus();
+	new_quarantine_size = (total_size < percpu_quarantines) ?
+		0 : (total_size - percpu_quarantines) / nr_nodes;
+	WRITE_ONCE(quarantine_max_size, new_quarantine_size);
+	/* Aim at consuming at most 1/2 of slots in quarantine. */
+	WRITE_ONCE(quarantine_batch_size, max((size_t)QUARANTINE_PERCPU_SIZE,
+		2 * total_size / nr_nodes / QUARANTINE_NODE_BATCHES));
+}
+
+/*
+ * Evict the oldest batch of the node queue if it is larger than @limit.
+ * Returns true if something was evicted.
+ */
+static bool quarantine_evict(struct node_quarantine *qn, unsigned long limit)
+{
+	struct qlist_head to_free = QLIST_INIT;
 	unsigned long flags;
+	size_t evicted;
 	int srcu_idx;
-	struct qlist_head to_free = QLIST_INIT;
-
-	if (likely(READ_ONCE(quarantine_size) <=
-		   READ_ONCE(quarantine_max_size)))
-		return;
 
 	/*
 	 * srcu critical section ensures that quarantine_remove_cache()
@@ -232,34 +366,39 @@ void quarantine_reduce(void)
 	 * expected case).
 	 */
 	srcu_idx = srcu_read_lock(&remove_cache_srcu);
-	raw_spin_lock_irqsave(&quarantine_lock, flags);
-
-	/*
-	 * Update quarantine size in case of hotplug. Allocate a fraction of
-	 * the installed memory to quarantine minus per-cpu queue limits.
-	 */
-	total_size = (totalram_pages() << PAGE_SHIFT) /
-		QUARANTINE_FRACTION;
-	percpu_quarantines = QUARANTINE_PERCPU_SIZE * num_online_cpus();
-	new_quarantine_size = (total_size < percpu_quarantines) ?
-		0 : total_size - percpu_quarantines;
-	WRITE_ONCE(quarantine_max_size, new_quarantine_size);
-	/* Aim at consuming at most 1/2 of slots in quarantine. */
-	WRITE_ONCE(quarantine_batch_size, max((size_t)QUARANTINE_PERCPU_SIZE,
-		2 * total_size / QUARANTINE_BATCHES));
-
-	if (likely(quarantine_size > quarantine_max_size)) {
-		qlist_move_all(&global_quarantine[quarantine_head], &to_free);
-		WRITE_ONCE(quarantine_size, quarantine_size - to_free.bytes);
-		quarantine_head++;
-		if (quarantine_head == QUARANTINE_BATCHES)
-			quarantine_head = 0;
+	local_irq_save(flags);
+	qnode_lock(qn);
+
+	if (likely(qn->size > limit)) {
+		qlist_move_all(&qn->batches[qn->head], &to_free);
+		WRITE_ONCE(qn->size, qn->size - to_free.bytes);
+		if (qn->head != qn->tail) {
+			qn->head++;
+			if (qn->head == QUARANTINE_NODE_BATCHES)
+				qn->head = 0;
+		}
 	}
 
-	raw_spin_unlock_irqrestore(&quarantine_lock, flags);
+	raw_spin_unlock_irqrestore(&qn->lock, flags);
 
+	evicted = to_free.bytes;
 	qlist_free_all(&to_free, NULL);
 	srcu_read_unlock(&remove_cache_srcu, srcu_idx);
+
+	return evicted != 0;
+}
+
+void quarantine_reduce(void)
+{
+	struct node_quarantine *qn = &node_quarantine[numa_node_id()];
+
+	if (likely(READ_ONCE(qn->size) <=
+		   READ_ONCE(quarantine_max_size)))
+		return;
+
+	quarantine_update_limits();
+	if (quarantine_evict(qn, READ_ONCE(quarantine_max_size)))
+		atomic_long_inc(&qn->evicted_sync);
 }
 
 static void qlist_move_cache(struct qlist_head *from,
@@ -292,7 +431,7 @@ static void per_cpu_remove_cache(void *arg)
 	struct qlist_head to_free = QLIST_INIT;
 	struct qlist_head *q;
 
-	q = this_cpu_ptr(&cpu_quarantine);
+	q = &this_cpu_ptr(&cpu_quarantine)->q;
 	qlist_move_cache(q, &to_free, cache);
 	qlist_free_all(&to_free, cache);
 }
@@ -302,29 +441,147 @@ void quarantine_remove_cache(struct kmem_cache *cache)
 {
 	unsigned long flags, i;
 	struct qlist_head to_free = QLIST_INIT;
+	struct node_quarantine *qn;
+	size_t bytes;
+	int nid;
 
 	/*
 	 * Must be careful to not miss any objects that are being moved from
-	 * per-cpu list to the global quarantine in quarantine_put(),
-	 * nor objects being freed in quarantine_reduce(). on_each_cpu()
+	 * per-cpu list to the rings or node quarantines in quarantine_put(),
+	 * nor objects being freed in quarantine_evict(). on_each_cpu()
 	 * achieves the first goal, while synchronize_srcu() achieves the
 	 * second.
 	 */
 	on_each_cpu(per_cpu_remove_cache, cache, 1);
 
-	raw_spin_lock_irqsave(&quarantine_lock, flags);
-	for (i = 0; i < QUARANTINE_BATCHES; i++) {
-		if (qlist_empty(&global_quarantine[i]))
-			continue;
-		qlist_move_cache(&global_quarantine[i], &to_free, cache);
-		/* Scanning whole quarantine can take a while. */
-		raw_spin_unlock_irqrestore(&quarantine_lock, flags);
-		cond_resched();
-		raw_spin_lock_irqsave(&quarantine_lock, flags);
+	for_each_node(nid) {
+		qn = &node_quarantine[nid];
+
+		raw_spin_lock_irqsave(&qn->lock, flags);
+		qnode_pull_rings(qn, nid);
+		for (i = 0; i < QUARANTINE_NODE_BATCHES; i++) {
+			if (qlist_empty(&qn->batches[i]))
+				continue;
+			bytes = to_free.bytes;
+			qlist_move_cache(&qn->batches[i], &to_free, cache);
+			WRITE_ONCE(qn->size, qn->size - (to_free.bytes - bytes));
+			/* Scanning whole quarantine can take a while. */
+			raw_spin_unlock_irqrestore(&qn->lock, flags);
+			cond_resched();
+			raw_spin_lock_irqsave(&qn->lock, flags);
+		}
+		raw_spin_unlock_irqrestore(&qn->lock, flags);
 	}
-	raw_spin_unlock_irqrestore(&quarantine_lock, flags);
 
 	qlist_free_all(&to_free, cache);
 
 	synchronize_srcu(&remove_cache_srcu);
 }
+
+static bool quarantine_kthread_pending(struct node_quarantine *qn, int nid)
+{
+	int cpu;
+
+	if (READ_ONCE(qn->size) > quarantine_bg_size())
+		return true;
+	for_each_cpu(cpu, cpumask_of_node(nid)) {
+		if (!qring_empty(&per_cpu(cpu_quarantine, cpu).ring))
+			return true;
+	}
+	return false;
+}
+
+static int quarantine_kthread(void *data)
+{
+	int nid = (long)data;
+	struct node_quarantine *qn = &node_quarantine[nid];
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!quarantine_kthread_pending(qn, nid))
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		raw_spin_lock_irq(&qn->lock);
+		qnode_pull_rings(qn, nid);
+		raw_spin_unlock_irq(&qn->lock);
+
+		quarantine_update_limits();
+		while (quarantine_evict(qn, quarantine_bg_size())) {
+			atomic_long_inc(&qn->evicted_bg);
+			cond_resched();
+		}
+	}
+	return 0;
+}
+
+static void quarantine_wake(struct irq_work *work)
+{
+	struct node_quarantine *qn =
+		container_of(work, struct node_quarantine, wake_work);
+
+	wake_up_process(qn->thread);
+}
+
+static int quarantine_stats_show(struct seq_file *m, void *v)
+{
+	struct node_quarantine *qn;
+	int nid;
+
+	seq_printf(m, "max size per node: %lu batch size: %lu\n",
+		   READ_ONCE(quarantine_max_size),
+		   READ_ONCE(quarantine_batch_size));
+	for_each_online_node(nid) {
+		qn = &node_quarantine[nid];
+		seq_printf(m, "node %d: size %lu contended %ld evicted %ld background, %ld sync\n",
+			   nid, READ_ONCE(qn->size),
+			   atomic_long_read(&qn->contended),
+			   atomic_long_read(&qn->evicted_bg),
+			   atomic_long_read(&qn->evicted_sync));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(quarantine_stats);
+
+/* Hand the batches left in the ring of a dead cpu to its node. */
+static int quarantine_cpu_dead(unsigned int cpu)
+{
+	struct node_quarantine *qn = &node_quarantine[cpu_to_node(cpu)];
+	struct qlist_head temp = QLIST_INIT;
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&qn->lock, flags);
+	qring_pop_all(&per_cpu(cpu_quarantine, cpu).ring, &temp);
+	qnode_add(qn, &temp);
+	raw_spin_unlock_irqrestore(&qn->lock, flags);
+	return 0;
+}
+
+static int __init quarantine_kthreads_init(void)
+{
+	struct node_quarantine *qn;
+	struct task_struct *t;
+	int nid;
+
+	for_each_node_with_cpus(nid) {
+		qn = &node_quarantine[nid];
+		t = kthread_create_on_node(quarantine_kthread, (void *)(long)nid,
+					   nid, "kasan_quarantine/%d", nid);
+		if (IS_ERR(t)) {
+			pr_warn("kasan: failed to start quarantine thread for node %d\n",
+				nid);
+			continue;
+		}
+		kthread_bind_mask(t, cpumask_of_node(nid));
+		init_irq_work(&qn->wake_work, quarantine_wake);
+		WRITE_ONCE(qn->thread, t);
+		wake_up_process(t);
+	}
+
+	cpuhp_setup_state_nocalls(CPUHP_BP_PREPARE_DYN, "mm/kasan:dead",
+				  NULL, quarantine_cpu_dead);
+	debugfs_create_file("kasan_quarantine", 0444, NULL, NULL,
+			    &quarantine_stats_fops);
+	return 0;
+}
+late_initcall(quarantine_kthreads_init);
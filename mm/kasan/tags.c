@@ -70,6 +70,38 @@ u8 random_tag(void)
 	return (u8)(state % (KASAN_TAG_MAX + 1));
 }
 
+#ifdef MODULE_PARAM_PREFIX
+#undef MODULE_PARAM_PREFIX
+#endif
+#define MODULE_PARAM_PREFIX "kasan."
+
+/*
+ * With kasan.tag_sample_rate=N, only about one in N allocations gets a random
+ * tag, the others get the match-all KASAN_TAG_KERNEL tag and accesses through
+ * them are never checked. This trades detection probability for performance.
+ * Changing the rate at runtime only affects new allocations.
+ */
+static unsigned int tag_sample_rate __read_mostly = 1;
+module_param(tag_sample_rate, uint, 0644);
+
+u8 sampled_tag(void)
+{
+	unsigned int rate = READ_ONCE(tag_sample_rate);
+	u32 state;
+
+	if (rate <= 1)
+		return random_tag();
+
+	state = this_cpu_read(prng_state);
+	state = 1664525 * state + 1013904223;
+	this_cpu_write(prng_state, state);
+
+	/* The low bits of the LCG are weak, decide on the high ones. */
+	if ((state >> 16) % rate)
+		return KASAN_TAG_KERNEL;
+	return (u8)(state % (KASAN_TAG_MAX + 1));
+}
+
 void *kasan_reset_tag(const void *addr)
 {
 	return reset_tag(addr);